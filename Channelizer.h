@@ -0,0 +1,133 @@
+/*
+ *
+ *
+ *    Channelizer.h
+ *
+ *    Polyphase DFT filter-bank channelizer.
+ *
+ *    Copyright (C) 2018 by Matt Roberts, KK5JY.
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef KK5JY_CHANNELIZER_H
+#define KK5JY_CHANNELIZER_H
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "FFT.h"
+#include "FirFilter.h"
+
+namespace KK5JY {
+	namespace DSP {
+
+		//
+		//  Channelizer - splits a complex stream at 'fs' into M channels,
+		//                each at fs/M, centered on k * fs/M
+		//
+		//  This is the critically-sampled polyphase DFT filter bank: the
+		//  prototype low-pass (M * P taps) is split into M branches of P
+		//  taps, each new block of M inputs is run through the branches,
+		//  and one M-point FFT turns the branch outputs into one sample
+		//  for every channel.  The cost per input sample is P multiplies
+		//  plus log2(M) FFT butterflies, whatever the number of channels.
+		//
+		//  Channels k >= M/2 are the negative frequencies, (k - M) * fs/M.
+		//
+		template <typename sample_t>
+		class Channelizer {
+			public:
+				typedef std::complex<sample_t> complex_t;
+
+			private:
+				const size_t m_Channels;
+				const size_t m_Length;             // prototype length, M * P
+				std::vector<sample_t> m_Coefs;
+				std::vector<complex_t> m_History;  // doubled, newest first
+				size_t m_Pos;
+				size_t m_Count;                    // inputs since the last output
+				std::vector<complex_t> m_Output;
+				FFT<sample_t> m_FFT;
+
+			private:
+				Channelizer(const Channelizer&);
+				Channelizer &operator=(const Channelizer&);
+
+			public:
+				//
+				//  channels  - M, a power of two
+				//  taps      - P, taps per polyphase branch
+				//  cutoff    - prototype cutoff, as a fraction of the channel spacing
+				//
+				Channelizer(size_t channels, size_t taps = 24, double cutoff = 0.35)
+					: m_Channels(channels),
+					  m_Length(channels * taps),
+					  m_Coefs(channels * taps, 0),
+					  m_History(2 * channels * taps, complex_t(0, 0)),
+					  m_Pos(0),
+					  m_Count(0),
+					  m_Output(channels),
+					  m_FFT(channels) {
+					if (channels < 2 || taps < 1)
+						throw FFTException("Channelizer needs at least two channels");
+
+					// odd-length prototype, padded to M * P; scaled by M to
+					//    undo the 1/M of the inverse FFT
+					const int len = static_cast<int>(m_Length) - 1;
+					double *h = FirFilterUtils::GenerateLowPassCoefficients<double>(
+						FirFilterUtils::BlackmanWindow, len, 2.0 * M_PI * cutoff / channels);
+					for (int i = 0; i != len; ++i)
+						m_Coefs[i] = h[i] * channels;
+					delete[] h;
+				}
+
+			public:
+				size_t channels() const {
+					return m_Channels;
+				}
+
+				//
+				//  write(...) - add one input sample; returns true when a new
+				//               output() is ready, once every M inputs
+				//
+				bool write(const complex_t &x) {
+					m_Pos = (m_Pos == 0) ? (m_Length - 1) : (m_Pos - 1);
+					m_History[m_Pos] = m_History[m_Pos + m_Length] = x;
+					if (++m_Count != m_Channels)
+						return false;
+					m_Count = 0;
+
+					// window and fold the history into the M branches
+					const complex_t *newest = &m_History[m_Pos];
+					for (size_t r = 0; r != m_Channels; ++r) {
+						complex_t acc(0, 0);
+						for (size_t l = r; l < m_Length; l += m_Channels)
+							acc += newest[l] * m_Coefs[l];
+						m_Output[r] = acc;
+					}
+
+					// y[k] = sum(u[r] * exp(+j 2 pi k r / M))
+					m_FFT.inverse(&m_Output[0]);
+					return true;
+				}
+
+				// the latest sample of every channel
+				const complex_t *output() const {
+					return &m_Output[0];
+				}
+
+				// the center of channel 'k', as a fraction of the input rate
+				double center(size_t k) const {
+					const double f = static_cast<double>(k) / m_Channels;
+					return (f >= 0.5) ? (f - 1.0) : f;
+				}
+		};
+	}
+}
+
+#endif // KK5JY_CHANNELIZER_H
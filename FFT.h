@@ -0,0 +1,126 @@
+/*
+ *
+ *
+ *    FFT.h
+ *
+ *    Radix-2 complex FFT.
+ *
+ *    Copyright (C) 2018 by Matt Roberts, KK5JY.
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef KK5JY_FFT_H
+#define KK5JY_FFT_H
+
+#include <cmath>
+#include <complex>
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace KK5JY {
+	namespace DSP {
+
+		//
+		//  Exception class for reporting errors from the FFT configuration
+		//
+		class FFTException : public std::exception {
+			private:
+				std::string userMsg;
+			public:
+				FFTException(const std::string &s) : userMsg(s) { /* nop */ }
+				~FFTException() throw() { /* nop */ }
+				const char *what() const throw() { return userMsg.c_str(); }
+		};
+
+
+		//
+		//  In-place iterative radix-2 FFT; the twiddle factors and the
+		//  bit-reversal table are computed once, in the constructor, so
+		//  transform() does no allocation.
+		//
+		template <typename sample_t>
+		class FFT {
+			public:
+				typedef std::complex<sample_t> complex_t;
+
+			private:
+				size_t m_Length;
+				std::vector<complex_t> m_Twiddle;
+				std::vector<size_t> m_Reverse;
+
+			private:
+				void transform(complex_t *data, bool inverse) const {
+					// bit-reversed reordering
+					for (size_t i = 0; i != m_Length; ++i) {
+						const size_t j = m_Reverse[i];
+						if (j > i)
+							std::swap(data[i], data[j]);
+					}
+
+					// butterflies
+					for (size_t span = 1; span < m_Length; span <<= 1) {
+						const size_t step = m_Length / (span << 1);
+						for (size_t start = 0; start < m_Length; start += (span << 1)) {
+							for (size_t k = 0; k != span; ++k) {
+								complex_t w = m_Twiddle[k * step];
+								if (inverse)
+									w = std::conj(w);
+								const complex_t t = w * data[start + k + span];
+								data[start + k + span] = data[start + k] - t;
+								data[start + k] += t;
+							}
+						}
+					}
+				}
+
+			public:
+				FFT(size_t length) : m_Length(length) {
+					if (length < 2 || (length & (length - 1)) != 0)
+						throw FFTException("FFT length must be a power of two");
+
+					m_Twiddle.resize(length / 2);
+					for (size_t k = 0; k != length / 2; ++k) {
+						const double phi = -2.0 * M_PI * k / length;
+						m_Twiddle[k] = complex_t(cos(phi), sin(phi));
+					}
+
+					size_t bits = 0;
+					while ((static_cast<size_t>(1) << bits) < length)
+						++bits;
+					m_Reverse.resize(length);
+					for (size_t i = 0; i != length; ++i) {
+						size_t r = 0;
+						for (size_t b = 0; b != bits; ++b) {
+							if (i & (static_cast<size_t>(1) << b))
+								r |= static_cast<size_t>(1) << (bits - 1 - b);
+						}
+						m_Reverse[i] = r;
+					}
+				}
+
+			public:
+				// the transform length
+				size_t length() const { return m_Length; }
+
+				// forward transform, in place
+				void forward(complex_t *data) const {
+					transform(data, false);
+				}
+
+				// inverse transform, in place; scaled by 1/N
+				void inverse(complex_t *data) const {
+					transform(data, true);
+					const sample_t scale = static_cast<sample_t>(1.0 / m_Length);
+					for (size_t i = 0; i != m_Length; ++i)
+						data[i] *= scale;
+				}
+		};
+	}
+}
+
+#endif // KK5JY_FFT_H
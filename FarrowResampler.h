@@ -0,0 +1,93 @@
+/*
+ *
+ *
+ *    FarrowResampler.h
+ *
+ *    Fine-grained arbitrary-ratio resampler, by cubic Farrow structure.
+ *
+ *    Copyright (C) 2018 by Matt Roberts, KK5JY.
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef KK5JY_FARROWRESAMPLER_H
+#define KK5JY_FARROWRESAMPLER_H
+
+#include <cstddef>
+
+namespace KK5JY {
+	namespace DSP {
+
+		//
+		//  FarrowResampler - resamples by a ratio near one, which may be
+		//                    changed at any sample
+		//
+		//  Each output is the cubic Lagrange polynomial through the four
+		//  newest inputs, evaluated between the middle two; in Farrow form,
+		//  that is four fixed sub-filters and three multiplies by the
+		//  fractional position 'mu'.  The step is the inputs consumed per
+		//  output, so a step above one makes fewer outputs than inputs.
+		//
+		//  Cubic interpolation is only clean well below the Nyquist rate,
+		//  so this belongs after the rate converters, at the card rate.
+		//
+		template <typename sample_t>
+		class FarrowResampler {
+			private:
+				sample_t m_X[4];   // oldest first
+				double m_Step;
+				double m_Mu;       // the next output, from m_X[1]
+
+			public:
+				FarrowResampler() : m_Step(1.0), m_Mu(1.0) {
+					m_X[0] = m_X[1] = m_X[2] = m_X[3] = 0;
+				}
+
+			public:
+				// set the inputs consumed per output; between 0.5 and 2
+				void step(double s) {
+					m_Step = (s < 0.5) ? 0.5 : (s > 2.0) ? 2.0 : s;
+				}
+
+				double step() const {
+					return m_Step;
+				}
+
+				// the delay, in input samples
+				double delay() const {
+					return 1.0 + m_Mu;
+				}
+
+				//
+				//  write one input, and the outputs it completes to 'y',
+				//  which must have room for two; returns the number written
+				//
+				size_t write(sample_t x, sample_t *y) {
+					m_X[0] = m_X[1];
+					m_X[1] = m_X[2];
+					m_X[2] = m_X[3];
+					m_X[3] = x;
+					m_Mu -= 1.0;
+
+					// the Farrow sub-filters
+					const sample_t c0 = m_X[1];
+					const sample_t c1 = m_X[2] - m_X[0] / 3 - m_X[1] / 2 - m_X[3] / 6;
+					const sample_t c2 = (m_X[0] + m_X[2]) / 2 - m_X[1];
+					const sample_t c3 = (m_X[3] - m_X[0]) / 6 + (m_X[1] - m_X[2]) / 2;
+
+					size_t n = 0;
+					while (m_Mu < 1.0) {
+						const sample_t mu = static_cast<sample_t>(m_Mu);
+						y[n++] = ((c3 * mu + c2) * mu + c1) * mu + c0;
+						m_Mu += m_Step;
+					}
+					return n;
+				}
+		};
+	}
+}
+
+#endif // KK5JY_FARROWRESAMPLER_H
@@ -0,0 +1,260 @@
+/*
+ *
+ *
+ *    FastFirFilter.h
+ *
+ *    Long FIR filters, by direct form or FFT overlap-save convolution.
+ *
+ *    Copyright (C) 2018 by Matt Roberts, KK5JY.
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef KK5JY_FASTFIRFILTER_H
+#define KK5JY_FASTFIRFILTER_H
+
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "FFT.h"
+#include "IFilter.h"
+
+// the cost of one FFT-path multiply, relative to one direct-form
+//    multiply-add, as measured by fdvfirbench
+#define FAST_FIR_FFT_WEIGHT 4.0
+
+// the largest FFT considered, as a multiple of the filter length
+#define FAST_FIR_MAX_SPAN 32
+
+namespace KK5JY {
+	namespace DSP {
+
+		//
+		//  FastFirFilter - an FIR filter that runs direct form when it is
+		//                  short, and by FFT overlap-save when that is cheaper
+		//
+		//  For M taps and an N-point FFT, each transform yields L = N - M + 1
+		//  outputs per real stream; since the taps are real, two successive
+		//  blocks of input ride in one complex transform, as its real and
+		//  imaginary parts, so each transform yields 2L outputs.  The FFT
+		//  path delays the output by those 2L samples; 'block' caps that
+		//  delay, and direct form is used when no allowed FFT size is
+		//  cheaper.
+		//
+		//  The taps are applied newest-first: y[n] = sum(h[k] * x[n - k]).
+		//
+		template <typename sample_t>
+		class FastFirFilter : public IFilter<sample_t> {
+			public:
+				typedef std::complex<sample_t> complex_t;
+
+				typedef enum {
+					Auto,    // whichever is cheaper
+					Direct,  // always direct form
+					Fast,    // always FFT, at the cheapest size
+				} Modes;
+
+			private:
+				size_t m_Taps;
+				std::vector<sample_t> m_Coefs;
+
+				// direct form
+				std::vector<sample_t> m_History;   // doubled, newest first
+				size_t m_Pos;
+
+				// FFT overlap-save; no FFT means direct form
+				FFT<sample_t> *m_FFT;
+				size_t m_Hop;                      // L
+				std::vector<complex_t> m_Response; // H
+				std::vector<complex_t> m_Work;
+				std::vector<sample_t> m_In;        // M - 1 old, then 2L new
+				std::vector<sample_t> m_Out;       // 2L, from the last transform
+				size_t m_Fill;
+
+			private:
+				FastFirFilter(const FastFirFilter&);
+				FastFirFilter &operator=(const FastFirFilter&);
+
+				// run one transform over m_In
+				void frame() {
+					const size_t n = m_FFT->length();
+					for (size_t i = 0; i != n; ++i)
+						m_Work[i] = complex_t(m_In[i], m_In[i + m_Hop]);
+					m_FFT->forward(&m_Work[0]);
+					for (size_t i = 0; i != n; ++i) {
+						const complex_t a = m_Work[i], b = m_Response[i];
+						m_Work[i] = complex_t(
+							a.real() * b.real() - a.imag() * b.imag(),
+							a.real() * b.imag() + a.imag() * b.real());
+					}
+					m_FFT->inverse(&m_Work[0]);
+
+					// the first M - 1 outputs of each stream are wrapped
+					const complex_t *w = &m_Work[m_Taps - 1];
+					for (size_t i = 0; i != m_Hop; ++i) {
+						m_Out[i] = w[i].real();
+						m_Out[i + m_Hop] = w[i].imag();
+					}
+					memmove(&m_In[0], &m_In[2 * m_Hop], (m_Taps - 1) * sizeof(sample_t));
+				}
+
+			public:
+				//
+				//  cost(...) - multiplies per output, for M taps by an N-point
+				//              FFT, in direct-form multiply-adds
+				//
+				static double cost(size_t taps, size_t length) {
+					if (length < 2 * taps)
+						return HUGE_VAL;
+					const double n = length;
+					const double hop = n - taps + 1;
+					// two transforms of (N/2) log2(N) butterflies, and the
+					//    product, each a four-multiply complex multiply, and
+					//    the inverse scaling
+					return FAST_FIR_FFT_WEIGHT * (4.0 * n * log2(n) + 6.0 * n) / (2.0 * hop);
+				}
+
+				//
+				//  fftLength(...) - the cheapest FFT for M taps whose delay
+				//                   fits in 'block' (if not zero), or zero
+				//
+				static size_t fftLength(size_t taps, size_t block) {
+					size_t best = 0;
+					size_t n = 2;
+					while (n < 2 * taps)
+						n <<= 1;
+					for ( ; n <= FAST_FIR_MAX_SPAN * taps || best == 0; n <<= 1) {
+						if (block && 2 * (n - taps + 1) > block)
+							break;
+						if (!best || cost(taps, n) < cost(taps, best))
+							best = n;
+					}
+					return best;
+				}
+
+			public:
+				//
+				//  coefs  - the taps, h[0] first
+				//  block  - the most delay the FFT path may add, in samples;
+				//           zero for no limit
+				//  mode   - Auto to choose by cost
+				//
+				FastFirFilter(const std::vector<sample_t> &coefs, size_t block = 0, Modes mode = Auto)
+					: m_Taps(std::max(coefs.size(), static_cast<size_t>(1))),
+					  m_Coefs(coefs),
+					  m_Pos(0),
+					  m_FFT(0),
+					  m_Hop(0),
+					  m_Fill(0) {
+					if (m_Coefs.empty())
+						m_Coefs.push_back(1);
+
+					size_t n = 0;
+					if (mode != Direct) {
+						n = fftLength(m_Taps, block);
+						if (mode == Fast && n == 0)
+							n = fftLength(m_Taps, 0);
+						if (mode == Auto && n && cost(m_Taps, n) >= m_Taps)
+							n = 0;
+					}
+
+					if (n == 0) {
+						m_History.assign(2 * m_Taps, 0);
+						return;
+					}
+
+					m_FFT = new FFT<sample_t>(n);
+					m_Hop = n - m_Taps + 1;
+					m_Response.assign(n, complex_t(0, 0));
+					for (size_t i = 0; i != m_Taps; ++i)
+						m_Response[i] = complex_t(m_Coefs[i], 0);
+					m_FFT->forward(&m_Response[0]);
+					m_Work.assign(n, complex_t(0, 0));
+					m_In.assign(m_Taps - 1 + 2 * m_Hop, 0);
+					m_Out.assign(2 * m_Hop, 0);
+				}
+
+				~FastFirFilter() {
+					delete m_FFT;
+				}
+
+			public:
+				// returns true if the FFT path is in use
+				bool fast() const {
+					return m_FFT != 0;
+				}
+
+				// the FFT length, or zero for direct form
+				size_t fftLength() const {
+					return m_FFT ? m_FFT->length() : 0;
+				}
+
+				// the delay added by the FFT path, in samples
+				size_t delay() const {
+					return 2 * m_Hop;
+				}
+
+				size_t length() const {
+					return m_Taps;
+				}
+
+				using IFilter<sample_t>::filter;
+
+				//
+				//  the sample-by-sample filter function
+				//
+				sample_t filter(sample_t x) {
+					if (!m_FFT) {
+						m_Pos = (m_Pos == 0) ? (m_Taps - 1) : (m_Pos - 1);
+						m_History[m_Pos] = m_History[m_Pos + m_Taps] = x;
+						const sample_t *h = &m_History[m_Pos];
+						sample_t acc = 0;
+						for (size_t k = 0; k != m_Taps; ++k)
+							acc += m_Coefs[k] * h[k];
+						return acc;
+					}
+
+					m_In[m_Taps - 1 + m_Fill] = x;
+					const sample_t y = m_Out[m_Fill];
+					if (++m_Fill == 2 * m_Hop) {
+						frame();
+						m_Fill = 0;
+					}
+					return y;
+				}
+
+				//
+				//  the block filter function; 'in' and 'out' may be the same
+				//
+				void filter(const sample_t *in, sample_t *out, size_t count) {
+					if (!m_FFT) {
+						for (size_t i = 0; i != count; ++i)
+							out[i] = filter(in[i]);
+						return;
+					}
+
+					while (count) {
+						const size_t n = std::min(count, 2 * m_Hop - m_Fill);
+						memcpy(&m_In[m_Taps - 1 + m_Fill], in, n * sizeof(sample_t));
+						memcpy(out, &m_Out[m_Fill], n * sizeof(sample_t));
+						in += n;
+						out += n;
+						count -= n;
+						m_Fill += n;
+						if (m_Fill == 2 * m_Hop) {
+							frame();
+							m_Fill = 0;
+						}
+					}
+				}
+		};
+	}
+}
+
+#endif // KK5JY_FASTFIRFILTER_H
@@ -522,6 +522,8 @@ namespace KK5JY {
 				}
 
 			public:
+				using IFilter<sample_t>::filter;
+
 				//
 				//  the sample-by-sample filter function
 				//
@@ -16,10 +16,19 @@
 #ifndef __KK5JY_IFILTER_H
 #define __KK5JY_IFILTER_H
 
+#include <cstddef>
+
 template <typename sample_t>
 class IFilter {
 	public:
 		virtual sample_t filter(sample_t sample) = 0;
+
+		// filter a block; 'in' and 'out' may be the same
+		virtual void filter(const sample_t *in, sample_t *out, size_t count) {
+			for (size_t i = 0; i != count; ++i)
+				out[i] = filter(in[i]);
+		}
+
 		virtual ~IFilter() { /* nop */ };
 };
 
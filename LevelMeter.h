@@ -0,0 +1,191 @@
+/*
+ *
+ *
+ *    LevelMeter.h
+ *
+ *    Block peak/RMS level meter.
+ *
+ *    Copyright (C) 2018 by Matt Roberts, KK5JY.
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef KK5JY_LEVELMETER_H
+#define KK5JY_LEVELMETER_H
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// the number of strided samples gathered per vector pass
+#define LEVEL_METER_CHUNK 256
+
+namespace KK5JY {
+	namespace DSP {
+
+		//
+		//  the levels of one block of samples
+		//
+		struct BlockLevels {
+			float peak;    // largest magnitude
+			float sumsq;   // sum of squares
+			size_t clips;  // samples at or above the clip limit
+		};
+
+
+		//
+		//  LevelMeter - decaying peak and averaged RMS, in dBFS
+		//
+		//  block() is called once per buffer by the audio thread; the
+		//  accessors may be called from any thread.
+		//
+		class LevelMeter {
+			private:
+				const double m_Fs;
+				const float m_Limit;
+				const double m_PeakDecay;  // per-sample peak decay factor
+				const double m_Tau;        // RMS averaging time constant (sec)
+
+				std::atomic<float> m_Peak;
+				std::atomic<float> m_Power;
+				std::atomic<uint64_t> m_Clips;
+
+			public:
+				//
+				//  fs        - sample rate (Hz)
+				//  limit     - clip threshold (full scale = 1.0)
+				//  decay     - peak fall rate (dB/sec)
+				//  tau       - RMS averaging time constant (sec)
+				//
+				LevelMeter(double fs, float limit, double decay = 20.0, double tau = 0.3)
+					: m_Fs(fs),
+					  m_Limit(limit),
+					  m_PeakDecay(pow(10.0, -decay / (20.0 * fs))),
+					  m_Tau(tau),
+					  m_Peak(0),
+					  m_Power(0),
+					  m_Clips(0) {
+					// nop
+				}
+
+			public:
+				//
+				//  measure(...) - levels of 'count' contiguous samples
+				//
+				static void measure(const float *x, size_t count, float limit, BlockLevels &result) {
+					float peak = 0, sumsq = 0;
+					size_t clips = 0;
+					size_t i = 0;
+
+					#if defined(__GNUC__)
+					// four lanes at a time; GCC maps these onto SSE or NEON
+					typedef float v4sf __attribute__((vector_size(16)));
+					typedef int32_t v4si __attribute__((vector_size(16)));
+					const v4si absMask = { 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF };
+					const v4sf lim = { limit, limit, limit, limit };
+					v4sf vpeak = { 0, 0, 0, 0 };
+					v4sf vsum = { 0, 0, 0, 0 };
+					v4si vclips = { 0, 0, 0, 0 };
+					for (; i + 4 <= count; i += 4) {
+						v4sf v;
+						memcpy(&v, x + i, sizeof(v));
+						const v4sf a = (v4sf)((v4si)v & absMask);
+						vpeak = (a > vpeak) ? a : vpeak;
+						vsum += v * v;
+						vclips -= (a >= lim); // true lanes are -1
+					}
+					for (int l = 0; l != 4; ++l) {
+						if (vpeak[l] > peak) peak = vpeak[l];
+						sumsq += vsum[l];
+						clips += vclips[l];
+					}
+					#endif
+
+					// scalar tail (or everything, without vector support)
+					for (; i != count; ++i) {
+						const float a = fabsf(x[i]);
+						if (a > peak) peak = a;
+						sumsq += x[i] * x[i];
+						if (a >= limit) ++clips;
+					}
+
+					result.peak = peak;
+					result.sumsq = sumsq;
+					result.clips = clips;
+				}
+
+				//
+				//  block(...) - meter one buffer; 'stride' steps over any
+				//               interleaved channels; returns the clip count
+				//
+				size_t block(const float *x, size_t count, size_t stride = 1) {
+					BlockLevels total = { 0, 0, 0 };
+					if (stride == 1) {
+						measure(x, count, m_Limit, total);
+					} else {
+						// gather into a contiguous buffer for the vector pass
+						float chunk[LEVEL_METER_CHUNK];
+						for (size_t done = 0; done < count; done += LEVEL_METER_CHUNK) {
+							const size_t n = (count - done < LEVEL_METER_CHUNK) ? (count - done) : LEVEL_METER_CHUNK;
+							for (size_t i = 0; i != n; ++i) {
+								chunk[i] = *x;
+								x += stride;
+							}
+							BlockLevels part;
+							measure(chunk, n, m_Limit, part);
+							if (part.peak > total.peak) total.peak = part.peak;
+							total.sumsq += part.sumsq;
+							total.clips += part.clips;
+						}
+					}
+					update(total, count);
+					return total.clips;
+				}
+
+				//
+				//  update(...) - fold one block's levels into the meter
+				//
+				void update(const BlockLevels &b, size_t count) {
+					if (count == 0)
+						return;
+
+					// decaying peak
+					float peak = m_Peak.load(std::memory_order_relaxed) * pow(m_PeakDecay, count);
+					if (b.peak > peak)
+						peak = b.peak;
+					m_Peak.store(peak, std::memory_order_relaxed);
+
+					// exponentially averaged power
+					const double alpha = 1.0 - exp(-static_cast<double>(count) / (m_Tau * m_Fs));
+					float power = m_Power.load(std::memory_order_relaxed);
+					power += alpha * ((b.sumsq / count) - power);
+					m_Power.store(power, std::memory_order_relaxed);
+
+					if (b.clips)
+						m_Clips.fetch_add(b.clips, std::memory_order_relaxed);
+				}
+
+			public:
+				// decaying peak level (dBFS)
+				float peakDb() const {
+					return 20.0f * log10f(m_Peak.load(std::memory_order_relaxed) + 1e-10f);
+				}
+
+				// averaged RMS level (dBFS, full-scale sine = -3)
+				float rmsDb() const {
+					return 10.0f * log10f(m_Power.load(std::memory_order_relaxed) + 1e-20f);
+				}
+
+				// total samples at or above the clip limit
+				uint64_t clips() const {
+					return m_Clips.load(std::memory_order_relaxed);
+				}
+		};
+	}
+}
+
+#endif // KK5JY_LEVELMETER_H
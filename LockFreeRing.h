@@ -0,0 +1,129 @@
+/*
+ *
+ *
+ *    LockFreeRing.h
+ *
+ *    Single-producer, single-consumer lock-free ring buffer.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __KK5JY_LOCKFREERING_H
+#define __KK5JY_LOCKFREERING_H
+
+#include <atomic>
+#include <cstddef>
+
+//
+//  LockFreeRing<T> - fixed-capacity SPSC queue
+//
+//  Exactly one thread may call push(), and exactly one other thread may
+//  call pop().  Neither call allocates, locks, or blocks, so either end
+//  may safely be used from the audio callback.
+//
+template <typename T>
+class LockFreeRing {
+	private:
+		T *m_Items;
+		const size_t m_Slots;
+		std::atomic<size_t> m_Head; // next slot to read (consumer)
+		std::atomic<size_t> m_Tail; // next slot to write (producer)
+
+	private:
+		LockFreeRing(const LockFreeRing&);
+		LockFreeRing &operator=(const LockFreeRing&);
+
+	public:
+		// ctor - one slot is kept empty to distinguish full from empty
+		LockFreeRing(size_t capacity)
+			: m_Items(new T[capacity + 1]),
+			  m_Slots(capacity + 1),
+			  m_Head(0),
+			  m_Tail(0) {
+			// nop
+		}
+
+		~LockFreeRing() {
+			delete[] m_Items;
+		}
+
+	public:
+		// add an item; returns false if the ring is full
+		bool push(const T &item) {
+			const size_t tail = m_Tail.load(std::memory_order_relaxed);
+			const size_t next = (tail + 1) % m_Slots;
+			if (next == m_Head.load(std::memory_order_acquire))
+				return false;
+			m_Items[tail] = item;
+			m_Tail.store(next, std::memory_order_release);
+			return true;
+		}
+
+		// remove an item; returns false if the ring is empty
+		bool pop(T &item) {
+			const size_t head = m_Head.load(std::memory_order_relaxed);
+			if (head == m_Tail.load(std::memory_order_acquire))
+				return false;
+			item = m_Items[head];
+			m_Head.store((head + 1) % m_Slots, std::memory_order_release);
+			return true;
+		}
+
+		// add 'count' items, all or none; returns false if there is no room
+		bool push(const T *items, size_t count) {
+			const size_t tail = m_Tail.load(std::memory_order_relaxed);
+			const size_t head = m_Head.load(std::memory_order_acquire);
+			const size_t room = (head + m_Slots - tail - 1) % m_Slots;
+			if (count > room)
+				return false;
+			size_t pos = tail;
+			for (size_t i = 0; i != count; ++i) {
+				m_Items[pos] = items[i];
+				if (++pos == m_Slots)
+					pos = 0;
+			}
+			m_Tail.store(pos, std::memory_order_release);
+			return true;
+		}
+
+		// remove up to 'count' items; returns the number removed
+		size_t pop(T *items, size_t count) {
+			const size_t head = m_Head.load(std::memory_order_relaxed);
+			const size_t tail = m_Tail.load(std::memory_order_acquire);
+			const size_t avail = (tail + m_Slots - head) % m_Slots;
+			if (count > avail)
+				count = avail;
+			size_t pos = head;
+			for (size_t i = 0; i != count; ++i) {
+				items[i] = m_Items[pos];
+				if (++pos == m_Slots)
+					pos = 0;
+			}
+			m_Head.store(pos, std::memory_order_release);
+			return count;
+		}
+
+		// the number of items waiting (approximate when called concurrently)
+		size_t size() const {
+			const size_t head = m_Head.load(std::memory_order_acquire);
+			const size_t tail = m_Tail.load(std::memory_order_acquire);
+			return (tail + m_Slots - head) % m_Slots;
+		}
+
+		// true if nothing is waiting
+		bool empty() const {
+			return size() == 0;
+		}
+
+		// the maximum number of items
+		size_t capacity() const {
+			return m_Slots - 1;
+		}
+};
+
+#endif // __KK5JY_LOCKFREERING_H
@@ -0,0 +1,506 @@
+/*
+ *
+ *
+ *    Resampler.h
+ *
+ *    Multistage integer-ratio decimator and interpolator.
+ *
+ *    Copyright (C) 2018 by Matt Roberts, KK5JY.
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef KK5JY_RESAMPLER_H
+#define KK5JY_RESAMPLER_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "FirFilter.h"
+
+namespace KK5JY {
+	namespace DSP {
+
+		//
+		//  ResamplerDesign - Kaiser-window low-pass design from a passband
+		//                    edge, stopband edge, and stopband attenuation
+		//
+		//  Frequencies are fractions of the sampling rate.
+		//
+		class ResamplerDesign {
+			public:
+				// modified Bessel function of the first kind, order zero
+				static double BesselI0(double x) {
+					double sum = 1.0, term = 1.0;
+					const double q = x * x / 4.0;
+					for (int k = 1; k != 64 && term > 1e-12 * sum; ++k) {
+						term *= q / (static_cast<double>(k) * k);
+						sum += term;
+					}
+					return sum;
+				}
+
+				// the Kaiser window shape for 'atten' dB of stopband
+				static double KaiserBeta(double atten) {
+					if (atten > 50)
+						return 0.1102 * (atten - 8.7);
+					if (atten >= 21)
+						return 0.5842 * pow(atten - 21, 0.4) + 0.07886 * (atten - 21);
+					return 0;
+				}
+
+				// the odd length that gives 'atten' dB over a transition 'width' wide
+				static int KaiserLength(double atten, double width) {
+					int length = static_cast<int>(ceil((atten - 7.95) / (14.36 * width))) + 1;
+					if (length < 3)
+						length = 3;
+					return length | 1;
+				}
+
+				// windowed-sinc low-pass of odd 'length', cut off at 'fc',
+				//    scaled to unity gain at DC; the window is Kaiser, for
+				//    'atten' dB, unless one of the FirFilterUtils windows is given
+				static std::vector<double> LowPass(int length, double fc, double atten, WindowFunction window = 0) {
+					std::vector<double> result(length);
+					const double beta = KaiserBeta(atten);
+					const double norm = BesselI0(beta);
+					const int limit = length / 2;
+					double sum = 0;
+					for (int i = -limit; i <= limit; ++i) {
+						const double r = static_cast<double>(i) / limit;
+						const double w = window ? window(i, length) :
+							BesselI0(beta * sqrt(std::max(0.0, 1.0 - r * r))) / norm;
+						const double h = FirFilterUtils::IdealLowPass(2.0 * M_PI * fc, i, length);
+						result[i + limit] = w * h;
+						sum += w * h;
+					}
+					for (int i = 0; i != length; ++i)
+						result[i] /= sum;
+					return result;
+				}
+		};
+
+
+		//
+		//  HalfBandDecimator - 2:1 decimation by a half-band filter
+		//
+		//  A low-pass cut off at fs/4 has every other tap zero, except the
+		//  center; with symmetry, each output costs (K + 2) multiplies for a
+		//  (4K + 3)-tap filter, and outputs are only computed for every
+		//  second input.
+		//
+		template <typename sample_t>
+		class HalfBandDecimator {
+			private:
+				size_t m_Length;                   // 4K + 3
+				std::vector<sample_t> m_Taps;      // the nonzero side taps, K + 1
+				sample_t m_Center;
+				std::vector<sample_t> m_History;   // doubled, newest first
+				size_t m_Pos;
+				bool m_Phase;
+
+			public:
+				//
+				//  rate   - the input rate
+				//  pass   - the passband edge; the stopband starts at rate/2 - pass
+				//  atten  - the stopband attenuation, in dB
+				//
+				HalfBandDecimator(double rate, double pass, double atten, WindowFunction window = 0)
+					: m_Pos(0),
+					  m_Phase(false) {
+					int length = ResamplerDesign::KaiserLength(atten, (rate / 2 - 2 * pass) / rate);
+					while ((length % 4) != 3)
+						length += 2;
+					const std::vector<double> h = ResamplerDesign::LowPass(length, 0.25, atten, window);
+					const size_t c = length / 2;
+					m_Length = length;
+					m_Center = h[c];
+					for (size_t o = 1; o <= c; o += 2)
+						m_Taps.push_back(h[c - o]);
+					m_History.assign(2 * m_Length, 0);
+				}
+
+			public:
+				// returns true, and sets 'y', on every second input
+				bool write(sample_t x, sample_t &y) {
+					m_Pos = (m_Pos == 0) ? (m_Length - 1) : (m_Pos - 1);
+					m_History[m_Pos] = m_History[m_Pos + m_Length] = x;
+					m_Phase = !m_Phase;
+					if (m_Phase)
+						return false;
+
+					const sample_t *h = &m_History[m_Pos];
+					const size_t c = m_Length / 2;
+					sample_t acc = m_Center * h[c];
+					for (size_t j = 0; j != m_Taps.size(); ++j)
+						acc += m_Taps[j] * (h[c - 1 - 2 * j] + h[c + 1 + 2 * j]);
+					y = acc;
+					return true;
+				}
+
+				// the full filter length
+				size_t length() const {
+					return m_Length;
+				}
+
+				// the group delay, in input samples
+				double delay() const {
+					return (m_Length - 1) / 2.0;
+				}
+
+				// multiplies per input sample
+				double macs() const {
+					return (m_Taps.size() + 1) / 2.0;
+				}
+		};
+
+
+		//
+		//  HalfBandInterpolator - 1:2 interpolation by a half-band filter
+		//
+		//  Of the two output phases, one is only the center tap (a delayed
+		//  copy of the input), and the other uses the K + 1 side taps, each
+		//  applied to a symmetric pair.
+		//
+		template <typename sample_t>
+		class HalfBandInterpolator {
+			private:
+				size_t m_Length;                   // input history, 2K + 2
+				std::vector<sample_t> m_Taps;      // K + 1, scaled by two
+				sample_t m_Center;
+				std::vector<sample_t> m_History;   // doubled, newest first
+				size_t m_Pos;
+
+			public:
+				//
+				//  rate   - the output rate
+				//  pass   - the passband edge; images start at rate/2 - pass
+				//  atten  - the stopband attenuation, in dB
+				//
+				HalfBandInterpolator(double rate, double pass, double atten, WindowFunction window = 0)
+					: m_Pos(0) {
+					int length = ResamplerDesign::KaiserLength(atten, (rate / 2 - 2 * pass) / rate);
+					while ((length % 4) != 3)
+						length += 2;
+					const std::vector<double> h = ResamplerDesign::LowPass(length, 0.25, atten, window);
+					m_Length = (length + 1) / 2;
+					m_Center = 2 * h[length / 2];
+					for (size_t i = 0; i != m_Length / 2; ++i)
+						m_Taps.push_back(2 * h[2 * i]);
+					m_History.assign(2 * m_Length, 0);
+				}
+
+			public:
+				// writes two outputs to 'y'
+				void write(sample_t x, sample_t *y) {
+					m_Pos = (m_Pos == 0) ? (m_Length - 1) : (m_Pos - 1);
+					m_History[m_Pos] = m_History[m_Pos + m_Length] = x;
+
+					const sample_t *h = &m_History[m_Pos];
+					sample_t acc = 0;
+					for (size_t i = 0; i != m_Taps.size(); ++i)
+						acc += m_Taps[i] * (h[i] + h[m_Length - 1 - i]);
+					y[0] = acc;
+					y[1] = m_Center * h[m_Length / 2 - 1];
+				}
+
+				// the group delay, in output samples
+				double delay() const {
+					return m_Length - 1.0;
+				}
+
+				// multiplies per output sample
+				double macs() const {
+					return (m_Taps.size() + 1) / 2.0;
+				}
+		};
+
+
+		//
+		//  PolyphaseDecimator - M:1 decimation, computing only the kept outputs
+		//
+		template <typename sample_t>
+		class PolyphaseDecimator {
+			private:
+				size_t m_Factor;
+				size_t m_Length;
+				std::vector<sample_t> m_Taps;
+				std::vector<sample_t> m_History;   // doubled, newest first
+				size_t m_Pos;
+				size_t m_Count;
+
+			public:
+				//
+				//  factor - M
+				//  rate   - the input rate
+				//  pass   - the passband edge; the stopband starts at rate/M - pass
+				//  atten  - the stopband attenuation, in dB
+				//
+				PolyphaseDecimator(size_t factor, double rate, double pass, double atten, WindowFunction window = 0)
+					: m_Factor(factor),
+					  m_Pos(0),
+					  m_Count(0) {
+					const double out = rate / factor;
+					const std::vector<double> h = ResamplerDesign::LowPass(
+						ResamplerDesign::KaiserLength(atten, (out - 2 * pass) / rate), 0.5 / factor, atten, window);
+					m_Length = h.size();
+					m_Taps.assign(h.begin(), h.end());
+					m_History.assign(2 * m_Length, 0);
+				}
+
+			public:
+				// returns true, and sets 'y', on every M'th input
+				bool write(sample_t x, sample_t &y) {
+					m_Pos = (m_Pos == 0) ? (m_Length - 1) : (m_Pos - 1);
+					m_History[m_Pos] = m_History[m_Pos + m_Length] = x;
+					if (++m_Count != m_Factor)
+						return false;
+					m_Count = 0;
+
+					const sample_t *h = &m_History[m_Pos];
+					sample_t acc = 0;
+					for (size_t i = 0; i != m_Length; ++i)
+						acc += m_Taps[i] * h[i];
+					y = acc;
+					return true;
+				}
+
+				// the group delay, in input samples
+				double delay() const {
+					return (m_Length - 1) / 2.0;
+				}
+
+				// multiplies per input sample
+				double macs() const {
+					return static_cast<double>(m_Length) / m_Factor;
+				}
+		};
+
+
+		//
+		//  PolyphaseInterpolator - 1:L interpolation, by L sub-filters that
+		//                          each run at the input rate
+		//
+		template <typename sample_t>
+		class PolyphaseInterpolator {
+			private:
+				size_t m_Factor;
+				size_t m_Length;                   // taps per phase
+				size_t m_Full;                     // the prototype filter length
+				std::vector<sample_t> m_Taps;      // phase by phase, scaled by L
+				std::vector<sample_t> m_History;   // doubled, newest first
+				size_t m_Pos;
+
+			public:
+				//
+				//  factor - L
+				//  rate   - the output rate
+				//  pass   - the passband edge; images start at rate/L - pass
+				//  atten  - the stopband attenuation, in dB
+				//
+				PolyphaseInterpolator(size_t factor, double rate, double pass, double atten, WindowFunction window = 0)
+					: m_Factor(factor),
+					  m_Pos(0) {
+					const double in = rate / factor;
+					const std::vector<double> h = ResamplerDesign::LowPass(
+						ResamplerDesign::KaiserLength(atten, (in - 2 * pass) / rate), 0.5 / factor, atten, window);
+					m_Full = h.size();
+					m_Length = (h.size() + factor - 1) / factor;
+					m_Taps.assign(m_Length * factor, 0);
+					for (size_t p = 0; p != factor; ++p)
+						for (size_t i = 0; i != m_Length && p + i * factor < h.size(); ++i)
+							m_Taps[p * m_Length + i] = factor * h[p + i * factor];
+					m_History.assign(2 * m_Length, 0);
+				}
+
+			public:
+				// writes L outputs to 'y'
+				void write(sample_t x, sample_t *y) {
+					m_Pos = (m_Pos == 0) ? (m_Length - 1) : (m_Pos - 1);
+					m_History[m_Pos] = m_History[m_Pos + m_Length] = x;
+
+					const sample_t *h = &m_History[m_Pos];
+					const sample_t *t = &m_Taps[0];
+					for (size_t p = 0; p != m_Factor; ++p) {
+						sample_t acc = 0;
+						for (size_t i = 0; i != m_Length; ++i)
+							acc += *t++ * h[i];
+						y[p] = acc;
+					}
+				}
+
+				// the group delay, in output samples
+				double delay() const {
+					return (m_Full - 1) / 2.0;
+				}
+
+				// multiplies per output sample
+				double macs() const {
+					return static_cast<double>(m_Length);
+				}
+		};
+
+
+		//
+		//  Decimator - R:1 decimation, as 2:1 half-band stages while R is
+		//              even, then one polyphase stage for what is left
+		//
+		//  Each stage protects only the final passband, so the early stages,
+		//  at the highest rates, get by with very short filters.
+		//
+		template <typename sample_t>
+		class Decimator {
+			private:
+				size_t m_Ratio;
+				std::vector<HalfBandDecimator<sample_t> > m_HalfBands;
+				std::vector<PolyphaseDecimator<sample_t> > m_Final;
+				double m_Macs;
+				double m_Delay;
+
+			public:
+				//
+				//  ratio  - R
+				//  rate   - the input rate
+				//  pass   - the passband edge
+				//  atten  - the stopband attenuation, in dB
+				//  window - a FirFilterUtils window, or zero for Kaiser
+				//
+				Decimator(size_t ratio, double rate, double pass, double atten, WindowFunction window = 0)
+					: m_Ratio(ratio),
+					  m_Macs(0),
+					  m_Delay(0) {
+					double scale = 1.0;
+					while (ratio > 1 && (ratio % 2) == 0) {
+						m_HalfBands.push_back(HalfBandDecimator<sample_t>(rate, pass, atten, window));
+						m_Macs += scale * m_HalfBands.back().macs();
+						m_Delay += m_HalfBands.back().delay() / scale;
+						rate /= 2;
+						ratio /= 2;
+						scale /= 2;
+					}
+					if (ratio > 1) {
+						m_Final.push_back(PolyphaseDecimator<sample_t>(ratio, rate, pass, atten, window));
+						m_Macs += scale * m_Final.back().macs();
+						m_Delay += m_Final.back().delay() / scale;
+					}
+				}
+
+			public:
+				// returns true, and sets 'y', on every R'th input
+				bool write(sample_t x, sample_t &y) {
+					for (size_t i = 0; i != m_HalfBands.size(); ++i)
+						if (!m_HalfBands[i].write(x, x))
+							return false;
+					if (!m_Final.empty())
+						return m_Final[0].write(x, y);
+					y = x;
+					return true;
+				}
+
+				size_t ratio() const {
+					return m_Ratio;
+				}
+
+				// multiplies per input sample, over all stages
+				double macs() const {
+					return m_Macs;
+				}
+
+				// the group delay, over all stages, in input samples
+				double delay() const {
+					return m_Delay;
+				}
+		};
+
+
+		//
+		//  Interpolator - 1:R interpolation, the mirror of Decimator: one
+		//                 polyphase stage at the lowest rate, then 1:2
+		//                 half-band stages
+		//
+		template <typename sample_t>
+		class Interpolator {
+			private:
+				size_t m_Ratio;
+				std::vector<PolyphaseInterpolator<sample_t> > m_First;
+				std::vector<HalfBandInterpolator<sample_t> > m_HalfBands;
+				std::vector<sample_t> m_Work[2];
+				double m_Macs;
+				double m_Delay;
+
+			public:
+				//
+				//  ratio  - R
+				//  rate   - the output rate
+				//  pass   - the passband edge
+				//  atten  - the stopband attenuation, in dB
+				//  window - a FirFilterUtils window, or zero for Kaiser
+				//
+				Interpolator(size_t ratio, double rate, double pass, double atten, WindowFunction window = 0)
+					: m_Ratio(ratio),
+					  m_Macs(0),
+					  m_Delay(0) {
+					size_t odd = ratio;
+					while (odd > 1 && (odd % 2) == 0)
+						odd /= 2;
+					double stage = rate / ratio * odd;
+					if (odd > 1) {
+						m_First.push_back(PolyphaseInterpolator<sample_t>(odd, stage, pass, atten, window));
+						m_Macs += m_First.back().macs() * odd / ratio;
+						m_Delay += m_First.back().delay() * ratio / odd;
+					}
+					for (size_t r = odd; r != ratio; r *= 2) {
+						stage *= 2;
+						m_HalfBands.push_back(HalfBandInterpolator<sample_t>(stage, pass, atten, window));
+						m_Macs += m_HalfBands.back().macs() * (2 * r) / ratio;
+						m_Delay += m_HalfBands.back().delay() * ratio / (2 * r);
+					}
+					m_Work[0].assign(ratio, 0);
+					m_Work[1].assign(ratio, 0);
+				}
+
+			public:
+				// writes R outputs to 'y'
+				void write(sample_t x, sample_t *y) {
+					sample_t *a = &m_Work[0][0];
+					sample_t *b = &m_Work[1][0];
+					size_t n = 1;
+					if (m_First.empty()) {
+						a[0] = x;
+					} else {
+						m_First[0].write(x, a);
+						n = m_Ratio;
+						for (size_t i = 0; i != m_HalfBands.size(); ++i)
+							n /= 2;
+					}
+					for (size_t s = 0; s != m_HalfBands.size(); ++s) {
+						for (size_t i = 0; i != n; ++i)
+							m_HalfBands[s].write(a[i], b + 2 * i);
+						std::swap(a, b);
+						n *= 2;
+					}
+					std::copy(a, a + n, y);
+				}
+
+				size_t ratio() const {
+					return m_Ratio;
+				}
+
+				// multiplies per output sample, over all stages
+				double macs() const {
+					return m_Macs;
+				}
+
+				// the group delay, over all stages, in output samples
+				double delay() const {
+					return m_Delay;
+				}
+		};
+	}
+}
+
+#endif // KK5JY_RESAMPLER_H
@@ -0,0 +1,179 @@
+/*
+ *
+ *
+ *    TxText.h
+ *
+ *    TX text message queue shared between the control and audio threads.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_TXTEXT_H
+#define __FDVCORE_TXTEXT_H
+
+#include <atomic>
+#include <string>
+
+#include "LockFreeRing.h"
+
+// the number of one-shot messages that may wait for transmission
+#define TX_TEXT_QUEUE_LEN 16
+
+//
+//  TxTextQueue - TX text for the FreeDV text channel
+//
+//  The control thread owns every message buffer; the modem thread only
+//  borrows them.  A 'beacon' message repeats whenever nothing else is
+//  waiting, and one-shot messages are sent once each, in order.  New
+//  buffers are handed over by pointer, so the modem always reads a
+//  complete, immutable string, and buffers the modem is finished with
+//  are handed back for the control thread to free.
+//
+class TxTextQueue {
+	private:
+		typedef std::string message;
+
+		// control -> modem: replacement beacon
+		std::atomic<message*> m_NewBeacon;
+
+		// control -> modem: one-shot messages
+		LockFreeRing<message*> m_Pending;
+
+		// modem -> control: buffers to free; large enough for every
+		//    buffer that can be outstanding between two reclaim() calls
+		LockFreeRing<message*> m_Retired;
+
+		// modem thread state
+		message *m_Beacon;
+		message *m_Current;
+		size_t m_Pos;
+
+		// control thread copy of the beacon text
+		std::string m_BeaconText;
+
+	private:
+		TxTextQueue(const TxTextQueue&);
+		TxTextQueue &operator=(const TxTextQueue&);
+
+		// free buffers that the modem has released (control thread)
+		void reclaim() {
+			message *m = 0;
+			while (m_Retired.pop(m)) {
+				delete m;
+			}
+		}
+
+		// hand a buffer back to the control thread (modem thread)
+		void retire(message *m) {
+			if (m) {
+				// can't fail by construction; leak rather than free here
+				m_Retired.push(m);
+			}
+		}
+
+	public:
+		TxTextQueue(const std::string &initial)
+			: m_NewBeacon(0),
+			  m_Pending(TX_TEXT_QUEUE_LEN),
+			  m_Retired((2 * TX_TEXT_QUEUE_LEN) + 4),
+			  m_Beacon(new message(initial)),
+			  m_Current(0),
+			  m_Pos(0),
+			  m_BeaconText(initial) {
+			m_Current = m_Beacon;
+		}
+
+		~TxTextQueue() {
+			reclaim();
+			message *m = 0;
+			while (m_Pending.pop(m)) {
+				delete m;
+			}
+			delete m_NewBeacon.exchange(0);
+			if (m_Current != m_Beacon)
+				delete m_Current;
+			delete m_Beacon;
+		}
+
+	public: // control thread
+		//
+		//  beacon(s) - replace the repeating message; takes effect at
+		//              the next character if the beacon is being sent
+		//
+		void beacon(const std::string &s) {
+			reclaim();
+			m_BeaconText = s;
+			// if the modem never picked up the previous one, it is still ours
+			delete m_NewBeacon.exchange(new message(s), std::memory_order_acq_rel);
+		}
+
+		//
+		//  beacon() - return the repeating message
+		//
+		const std::string &beacon() const {
+			return m_BeaconText;
+		}
+
+		//
+		//  enqueue(s) - send a message once, after the current message;
+		//               returns false if the queue is full
+		//
+		bool enqueue(const std::string &s) {
+			reclaim();
+			if (s.empty())
+				return false;
+			message *m = new message(s);
+			if (!m_Pending.push(m)) {
+				delete m;
+				return false;
+			}
+			return true;
+		}
+
+		//
+		//  pending() - the number of one-shot messages not yet started
+		//
+		size_t pending() const {
+			return m_Pending.size();
+		}
+
+	public: // modem thread
+		//
+		//  next() - return the next character to send
+		//
+		char next() {
+			// pick up a new beacon, restarting it if it was in progress
+			message *nb = m_NewBeacon.exchange(0, std::memory_order_acq_rel);
+			if (nb) {
+				if (m_Current == m_Beacon) {
+					m_Current = nb;
+					m_Pos = 0;
+				}
+				retire(m_Beacon);
+				m_Beacon = nb;
+			}
+
+			if (m_Current->empty())
+				return 0;
+
+			char c = (*m_Current)[m_Pos++];
+
+			// at the end of a message, move to the next one
+			if (m_Pos == m_Current->size()) {
+				if (m_Current != m_Beacon)
+					retire(m_Current);
+				message *m = 0;
+				m_Current = m_Pending.pop(m) ? m : m_Beacon;
+				m_Pos = 0;
+			}
+
+			return c;
+		}
+};
+
+#endif // __FDVCORE_TXTEXT_H
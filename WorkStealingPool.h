@@ -0,0 +1,172 @@
+/*
+ *
+ *
+ *    WorkStealingPool.h
+ *
+ *    Thread pool with per-worker queues and work stealing.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __KK5JY_WORKSTEALINGPOOL_H
+#define __KK5JY_WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+//  WorkStealingPool - runs submitted tasks on a fixed set of threads
+//
+//  Tasks are dealt round-robin onto per-worker queues.  Each worker takes
+//  from the front of its own queue, and when that is empty, steals from
+//  the back of another worker's, so a few slow tasks don't leave the
+//  other threads idle.  wait() blocks until every submitted task is done.
+//
+class WorkStealingPool {
+	public:
+		typedef std::function<void()> Task;
+
+	private:
+		struct Worker {
+			std::mutex lock;
+			std::deque<Task> tasks;
+		};
+
+		std::vector<Worker*> m_Workers;
+		std::vector<std::thread> m_Threads;
+		std::atomic<size_t> m_Next;      // round-robin submit position
+		std::atomic<uint64_t> m_Steals;
+
+		// sleeping and completion
+		std::mutex m_Lock;
+		std::condition_variable m_Work;
+		std::condition_variable m_Done;
+		size_t m_Queued;                 // tasks not yet taken
+		size_t m_Pending;                // tasks not yet finished
+		bool m_Running;
+
+	private:
+		WorkStealingPool(const WorkStealingPool&);
+		WorkStealingPool &operator=(const WorkStealingPool&);
+
+		// take a task from worker 'w', or steal one from another
+		bool take(size_t w, Task &task) {
+			{
+				std::lock_guard<std::mutex> l(m_Workers[w]->lock);
+				if (!m_Workers[w]->tasks.empty()) {
+					task.swap(m_Workers[w]->tasks.front());
+					m_Workers[w]->tasks.pop_front();
+					return true;
+				}
+			}
+			for (size_t i = 1; i != m_Workers.size(); ++i) {
+				Worker *victim = m_Workers[(w + i) % m_Workers.size()];
+				std::lock_guard<std::mutex> l(victim->lock);
+				if (!victim->tasks.empty()) {
+					task.swap(victim->tasks.back());
+					victim->tasks.pop_back();
+					m_Steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// the worker thread body
+		void run(size_t w) {
+			Task task;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> l(m_Lock);
+					m_Work.wait(l, [this]() { return m_Queued != 0 || !m_Running; });
+					if (!m_Running && m_Queued == 0)
+						return;
+					--m_Queued;
+				}
+
+				// a task is reserved for this thread; find it
+				while (!take(w, task))
+					std::this_thread::yield();
+				task();
+				task = Task();
+
+				std::lock_guard<std::mutex> l(m_Lock);
+				if (--m_Pending == 0)
+					m_Done.notify_all();
+			}
+		}
+
+	public:
+		// 'threads' of zero uses one per core
+		WorkStealingPool(unsigned threads = 0)
+			: m_Next(0),
+			  m_Steals(0),
+			  m_Queued(0),
+			  m_Pending(0),
+			  m_Running(true) {
+			if (threads == 0)
+				threads = std::thread::hardware_concurrency();
+			if (threads == 0)
+				threads = 1;
+			for (unsigned i = 0; i != threads; ++i)
+				m_Workers.push_back(new Worker);
+			for (unsigned i = 0; i != threads; ++i)
+				m_Threads.push_back(std::thread(&WorkStealingPool::run, this, i));
+		}
+
+		// finishes any queued tasks, then stops the threads
+		~WorkStealingPool() {
+			{
+				std::lock_guard<std::mutex> l(m_Lock);
+				m_Running = false;
+			}
+			m_Work.notify_all();
+			for (size_t i = 0; i != m_Threads.size(); ++i)
+				m_Threads[i].join();
+			for (size_t i = 0; i != m_Workers.size(); ++i)
+				delete m_Workers[i];
+		}
+
+	public:
+		// queue a task
+		void submit(const Task &task) {
+			Worker *w = m_Workers[m_Next++ % m_Workers.size()];
+			{
+				std::lock_guard<std::mutex> l(w->lock);
+				w->tasks.push_back(task);
+			}
+			{
+				std::lock_guard<std::mutex> l(m_Lock);
+				++m_Queued;
+				++m_Pending;
+			}
+			m_Work.notify_one();
+		}
+
+		// wait for every submitted task to finish
+		void wait() {
+			std::unique_lock<std::mutex> l(m_Lock);
+			m_Done.wait(l, [this]() { return m_Pending == 0; });
+		}
+
+		size_t threads() const {
+			return m_Threads.size();
+		}
+
+		// the number of tasks run by a thread other than the one dealt them
+		uint64_t steals() const {
+			return m_Steals.load(std::memory_order_relaxed);
+		}
+};
+
+#endif
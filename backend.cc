@@ -0,0 +1,567 @@
+/*
+ *
+ *
+ *    backend.cc
+ *
+ *    Audio backends for SoundCard: null, file/pipe, and ALSA mmap.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "backend.h"
+#include "localtypes.h"
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+
+// the number of periods in the ALSA ring, and the number primed with
+//    silence at start; the difference is the headroom for the callback
+#define ALSA_PERIODS 3
+#define ALSA_PRIME_PERIODS 2
+
+// the most windows the file backend reads or writes in one call
+#define FILE_BACKEND_WINDOWS 16
+
+
+//
+//  toFloat(...) / toShort(...) - sample format conversion
+//
+static inline float toFloat(int16_t s) {
+	return static_cast<float>(s) / SHRT_MAX;
+}
+
+static inline int16_t toShort(float f) {
+	if (f >= 1.0f) return SHRT_MAX;
+	if (f <= -1.0f) return -SHRT_MAX;
+	return static_cast<int16_t>(f * SHRT_MAX);
+}
+
+
+//
+//  NullBackend::ctor
+//
+NullBackend::NullBackend(uint16_t in, uint16_t out)
+	: AudioBackend(in, out),
+	  m_Running(false) {
+	// nop
+}
+
+
+//
+//  NullBackend::start(...)
+//
+bool NullBackend::start(SoundCard *card, unsigned rate, unsigned &win) {
+	if (m_Running || rate == 0 || win == 0)
+		return false;
+	mCard = card;
+	m_In.assign(win * mChannelsIn, 0.0f);
+	m_Out.assign(win * mChannelsOut, 0.0f);
+	m_Running = true;
+	m_Clock = std::thread(&NullBackend::run, this, rate, win);
+	return true;
+}
+
+
+//
+//  NullBackend::stop()
+//
+void NullBackend::stop() {
+	m_Running = false;
+	if (m_Clock.joinable())
+		m_Clock.join();
+}
+
+
+//
+//  NullBackend::run(...) - clock thread body
+//
+void NullBackend::run(unsigned rate, unsigned win) {
+	const std::chrono::microseconds period((static_cast<uint64_t>(win) * 1000000) / rate);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	while (m_Running) {
+		deliver(mCard, &m_In[0], &m_Out[0], win);
+
+		// if the callback overran, start the clock again from now; this
+		//    clock is the only producer, so a slip is one late output
+		next += period;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (next < now) {
+			xrun(mCard, false, true);
+			next = now;
+		}
+		std::this_thread::sleep_until(next);
+	}
+}
+
+
+//
+//  FileBackend::ctor
+//
+FileBackend::FileBackend(const std::string &in, const std::string &out, uint16_t channels)
+	: AudioBackend(channels, channels),
+	  m_InPath(in),
+	  m_OutPath(out),
+	  m_InFd(-1),
+	  m_OutFd(-1),
+	  m_Running(false),
+	  m_Finished(false) {
+	if (channels == 0)
+		throw local_exception("Invalid channel count");
+	m_InFd = (in == "-") ? dup(STDIN_FILENO) : open(in.c_str(), O_RDONLY);
+	if (m_InFd < 0)
+		throw local_exception("Could not open " + in);
+	m_OutFd = (out == "-") ? dup(STDOUT_FILENO) : open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_OutFd < 0) {
+		close(m_InFd);
+		m_InFd = -1;
+		throw local_exception("Could not open " + out);
+	}
+}
+
+
+//
+//  FileBackend::dtor
+//
+FileBackend::~FileBackend() {
+	stop();
+	if (m_InFd >= 0)
+		close(m_InFd);
+	if (m_OutFd >= 0)
+		close(m_OutFd);
+}
+
+
+//
+//  FileBackend::start(...)
+//
+bool FileBackend::start(SoundCard *card, unsigned rate, unsigned &win) {
+	if (m_Running || win == 0)
+		return false;
+	mCard = card;
+	m_Running = true;
+	m_Reader = std::thread(&FileBackend::run, this, win);
+	return true;
+}
+
+
+//
+//  FileBackend::stop()
+//
+void FileBackend::stop() {
+	m_Running = false;
+	if (m_Reader.joinable())
+		m_Reader.join();
+}
+
+
+//
+//  writeAll(...) - write a whole buffer, across short writes
+//
+static bool writeAll(int fd, const void *data, size_t bytes) {
+	const char *p = static_cast<const char*>(data);
+	while (bytes) {
+		const ssize_t n = write(fd, p, bytes);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+
+//
+//  FileBackend::run(...) - stream thread body
+//
+//  Reads whatever is ready, up to FILE_BACKEND_WINDOWS windows at a time,
+//  runs each whole window through the card, and writes all of the output
+//  back in one go; a partial window waits for the next read.
+//
+void FileBackend::run(unsigned win) {
+	const size_t inWindow = win * mChannelsIn * sizeof(int16_t);
+	const size_t inBytes = inWindow * FILE_BACKEND_WINDOWS;
+	std::vector<int16_t> inRaw(win * mChannelsIn * FILE_BACKEND_WINDOWS);
+	std::vector<int16_t> outRaw(win * mChannelsOut * FILE_BACKEND_WINDOWS);
+	std::vector<float> in(win * mChannelsIn);
+	std::vector<float> out(win * mChannelsOut);
+	char *raw = reinterpret_cast<char*>(&inRaw[0]);
+	size_t have = 0;
+	bool eof = false;
+
+	while (m_Running && !eof) {
+		// wait for input, waking periodically to check for shutdown
+		struct pollfd pfd;
+		pfd.fd = m_InFd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 100) == 0)
+			continue;
+
+		const ssize_t n = read(m_InFd, raw + have, inBytes - have);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			// end of input; pad out the last window with silence
+			eof = true;
+			const size_t padded = ((have + inWindow - 1) / inWindow) * inWindow;
+			memset(raw + have, 0, padded - have);
+			have = padded;
+		} else {
+			have += n;
+		}
+
+		// run every whole window
+		const size_t windows = have / inWindow;
+		for (size_t w = 0; w != windows; ++w) {
+			const int16_t *src = &inRaw[w * in.size()];
+			for (size_t i = 0; i != in.size(); ++i)
+				in[i] = toFloat(src[i]);
+			deliver(mCard, &in[0], &out[0], win);
+			int16_t *dst = &outRaw[w * out.size()];
+			for (size_t i = 0; i != out.size(); ++i)
+				dst[i] = toShort(out[i]);
+		}
+		if (windows && !writeAll(m_OutFd, &outRaw[0], windows * out.size() * sizeof(int16_t)))
+			break;
+
+		// keep any partial window for next time
+		const size_t used = windows * inWindow;
+		memmove(raw, raw + used, have - used);
+		have -= used;
+	}
+	m_Finished = true;
+}
+
+
+//
+//  pickChannels(...) - stereo if the device allows it, else its minimum
+//
+static unsigned pickChannels(snd_pcm_t *pcm) {
+	snd_pcm_hw_params_t *hw = 0;
+	if (snd_pcm_hw_params_malloc(&hw) < 0)
+		return 0;
+	unsigned result = 0;
+	if (snd_pcm_hw_params_any(pcm, hw) >= 0) {
+		if (snd_pcm_hw_params_test_channels(pcm, hw, 2) == 0)
+			result = 2;
+		else if (snd_pcm_hw_params_get_channels_min(hw, &result) < 0)
+			result = 0;
+	}
+	snd_pcm_hw_params_free(hw);
+	return result;
+}
+
+
+//
+//  AlsaBackend::ctor
+//
+AlsaBackend::AlsaBackend(const std::string &device)
+	: AudioBackend(0, 0),
+	  m_Device(device),
+	  m_Capture(0),
+	  m_Playback(0),
+	  m_FloatIn(false),
+	  m_FloatOut(false),
+	  m_Linked(false),
+	  m_Period(0),
+	  m_Running(false) {
+	int rc = snd_pcm_open(&m_Capture, device.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+	if (rc < 0)
+		throw local_exception("Could not open " + device + " for capture: " + snd_strerror(rc));
+	rc = snd_pcm_open(&m_Playback, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+	if (rc < 0) {
+		snd_pcm_close(m_Capture);
+		m_Capture = 0;
+		throw local_exception("Could not open " + device + " for playback: " + snd_strerror(rc));
+	}
+	mChannelsIn = pickChannels(m_Capture);
+	mChannelsOut = pickChannels(m_Playback);
+	if (!mChannelsIn || !mChannelsOut) {
+		snd_pcm_close(m_Capture);
+		snd_pcm_close(m_Playback);
+		m_Capture = m_Playback = 0;
+		throw local_exception("Could not read the channel count of " + device);
+	}
+}
+
+
+//
+//  AlsaBackend::dtor
+//
+AlsaBackend::~AlsaBackend() {
+	stop();
+	if (m_Capture)
+		snd_pcm_close(m_Capture);
+	if (m_Playback)
+		snd_pcm_close(m_Playback);
+}
+
+
+//
+//  AlsaBackend::configure(...) - set up one stream; returns the format
+//                                in 'isFloat' and the period in 'period'
+//
+bool AlsaBackend::configure(snd_pcm_t *pcm, unsigned channels, unsigned rate, unsigned &period, bool &isFloat) {
+	snd_pcm_hw_params_t *hw = 0;
+	if (snd_pcm_hw_params_malloc(&hw) < 0)
+		return false;
+
+	bool ok = false;
+	do {
+		if (snd_pcm_hw_params_any(pcm, hw) < 0) break;
+		if (snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0) break;
+
+		// float needs no conversion; most hardware only does S16
+		isFloat = (snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_FLOAT_LE) == 0);
+		if (!isFloat && snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16_LE) < 0) break;
+
+		if (snd_pcm_hw_params_set_channels(pcm, hw, channels) < 0) break;
+		if (snd_pcm_hw_params_set_rate_resample(pcm, hw, 0) < 0) break;
+		if (snd_pcm_hw_params_set_rate(pcm, hw, rate, 0) < 0) break;
+		snd_pcm_uframes_t frames = period;
+		if (snd_pcm_hw_params_set_period_size_near(pcm, hw, &frames, 0) < 0) break;
+		unsigned periods = ALSA_PERIODS;
+		if (snd_pcm_hw_params_set_periods_near(pcm, hw, &periods, 0) < 0) break;
+		if (snd_pcm_hw_params(pcm, hw) < 0) break;
+		period = frames;
+		ok = true;
+	} while (false);
+	snd_pcm_hw_params_free(hw);
+	if (!ok)
+		return false;
+
+	// wake once per period; never start on its own, so that the linked
+	//    streams are started together by restart()
+	snd_pcm_sw_params_t *sw = 0;
+	if (snd_pcm_sw_params_malloc(&sw) < 0)
+		return false;
+	ok = snd_pcm_sw_params_current(pcm, sw) >= 0 &&
+	     snd_pcm_sw_params_set_avail_min(pcm, sw, period) >= 0 &&
+	     snd_pcm_sw_params_set_start_threshold(pcm, sw, LONG_MAX) >= 0 &&
+	     snd_pcm_sw_params(pcm, sw) >= 0;
+	snd_pcm_sw_params_free(sw);
+	return ok;
+}
+
+
+//
+//  AlsaBackend::silence(...) - write silence to the playback ring
+//
+void AlsaBackend::silence(unsigned frames) {
+	while (frames) {
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset, count = frames;
+		if (snd_pcm_mmap_begin(m_Playback, &areas, &offset, &count) < 0 || count == 0)
+			return;
+		snd_pcm_areas_silence(areas, offset, mChannelsOut, count,
+			m_FloatOut ? SND_PCM_FORMAT_FLOAT_LE : SND_PCM_FORMAT_S16_LE);
+		if (snd_pcm_mmap_commit(m_Playback, offset, count) != static_cast<snd_pcm_sframes_t>(count))
+			return;
+		frames -= count;
+	}
+}
+
+
+//
+//  AlsaBackend::restart() - prepare, prime, and start both streams
+//
+bool AlsaBackend::restart() {
+	snd_pcm_drop(m_Capture);
+	if (!m_Linked)
+		snd_pcm_drop(m_Playback);
+	if (snd_pcm_prepare(m_Capture) < 0)
+		return false;
+	if (!m_Linked && snd_pcm_prepare(m_Playback) < 0)
+		return false;
+
+	silence(ALSA_PRIME_PERIODS * m_Period);
+
+	if (snd_pcm_start(m_Capture) < 0)
+		return false;
+	if (!m_Linked && snd_pcm_start(m_Playback) < 0)
+		return false;
+	return true;
+}
+
+
+//
+//  AlsaBackend::start(...)
+//
+bool AlsaBackend::start(SoundCard *card, unsigned rate, unsigned &win) {
+	if (m_Running)
+		return false;
+	mCard = card;
+
+	// both directions must agree on the period, which becomes the window
+	unsigned period = win, playPeriod = 0;
+	if (!configure(m_Capture, mChannelsIn, rate, period, m_FloatIn))
+		return false;
+	playPeriod = period;
+	if (!configure(m_Playback, mChannelsOut, rate, playPeriod, m_FloatOut) || playPeriod != period)
+		return false;
+	m_Period = win = period;
+	m_In.assign(m_Period * mChannelsIn, 0.0f);
+	m_Out.assign(m_Period * mChannelsOut, 0.0f);
+
+	m_Linked = (snd_pcm_link(m_Capture, m_Playback) == 0);
+	if (!restart()) {
+		// stop() won't run for a stream that never started
+		snd_pcm_drop(m_Capture);
+		snd_pcm_drop(m_Playback);
+		if (m_Linked) {
+			snd_pcm_unlink(m_Capture);
+			m_Linked = false;
+		}
+		return false;
+	}
+
+	m_Running = true;
+	m_Worker = std::thread(&AlsaBackend::run, this);
+	return true;
+}
+
+
+//
+//  AlsaBackend::stop()
+//
+void AlsaBackend::stop() {
+	if (!m_Running)
+		return;
+	m_Running = false;
+	if (m_Worker.joinable())
+		m_Worker.join();
+	snd_pcm_drop(m_Capture);
+	snd_pcm_drop(m_Playback);
+	if (m_Linked) {
+		snd_pcm_unlink(m_Capture);
+		m_Linked = false;
+	}
+}
+
+
+//
+//  AlsaBackend::run() - stream thread body
+//
+void AlsaBackend::run() {
+	while (m_Running) {
+		const int rc = snd_pcm_wait(m_Capture, 100);
+		if (rc == 0)
+			continue; // timeout; check m_Running
+		if (rc < 0) {
+			xrun(mCard, true, false);
+			restart();
+			continue;
+		}
+
+		const snd_pcm_sframes_t inAvail = snd_pcm_avail_update(m_Capture);
+		const snd_pcm_sframes_t outAvail = snd_pcm_avail_update(m_Playback);
+		if (inAvail < 0 || outAvail < 0) {
+			xrun(mCard, inAvail < 0, outAvail < 0);
+			restart();
+			continue;
+		}
+		if (inAvail < static_cast<snd_pcm_sframes_t>(m_Period))
+			continue;
+		if (outAvail < static_cast<snd_pcm_sframes_t>(m_Period)) {
+			// playback is behind; let it drain a period
+			snd_pcm_wait(m_Playback, 100);
+			continue;
+		}
+
+		// map one period of each ring
+		const snd_pcm_channel_area_t *inAreas, *outAreas;
+		snd_pcm_uframes_t inOffset, outOffset;
+		snd_pcm_uframes_t inFrames = m_Period, outFrames = m_Period;
+		if (snd_pcm_mmap_begin(m_Capture, &inAreas, &inOffset, &inFrames) < 0 ||
+		    snd_pcm_mmap_begin(m_Playback, &outAreas, &outOffset, &outFrames) < 0) {
+			xrun(mCard, true, true);
+			restart();
+			continue;
+		}
+		const snd_pcm_uframes_t frames = std::min(inFrames, outFrames);
+
+		// interleaved: every channel shares the first area's layout
+		char *inBase = static_cast<char*>(inAreas[0].addr) + (inAreas[0].first / 8) + (inOffset * (inAreas[0].step / 8));
+		char *outBase = static_cast<char*>(outAreas[0].addr) + (outAreas[0].first / 8) + (outOffset * (outAreas[0].step / 8));
+
+		// convert only where the device isn't float
+		float *in = reinterpret_cast<float*>(inBase);
+		float *out = reinterpret_cast<float*>(outBase);
+		if (!m_FloatIn) {
+			const int16_t *s = reinterpret_cast<const int16_t*>(inBase);
+			for (size_t i = 0; i != frames * mChannelsIn; ++i)
+				m_In[i] = toFloat(s[i]);
+			in = &m_In[0];
+		}
+		if (!m_FloatOut)
+			out = &m_Out[0];
+
+		deliver(mCard, in, out, frames);
+
+		if (!m_FloatOut) {
+			int16_t *d = reinterpret_cast<int16_t*>(outBase);
+			for (size_t i = 0; i != frames * mChannelsOut; ++i)
+				d[i] = toShort(m_Out[i]);
+		}
+
+		const snd_pcm_sframes_t inDone = snd_pcm_mmap_commit(m_Capture, inOffset, frames);
+		const snd_pcm_sframes_t outDone = snd_pcm_mmap_commit(m_Playback, outOffset, frames);
+		if (inDone != static_cast<snd_pcm_sframes_t>(frames) || outDone != static_cast<snd_pcm_sframes_t>(frames)) {
+			xrun(mCard, inDone != static_cast<snd_pcm_sframes_t>(frames), outDone != static_cast<snd_pcm_sframes_t>(frames));
+			restart();
+		}
+	}
+}
+
+
+//
+//  createBackend(...)
+//
+AudioBackend *createBackend(const std::string &spec) {
+	// a plain number is an RtAudio device
+	if (!spec.empty() && spec.find_first_not_of("0123456789") == std::string::npos)
+		return new RtAudioBackend(atoi(spec.c_str()));
+
+	const size_t colon = spec.find(':');
+	const std::string type = spec.substr(0, colon);
+	const std::string args = (colon == std::string::npos) ? std::string() : spec.substr(colon + 1);
+
+	if (type == "null") {
+		unsigned in = 2, out = 2;
+		if (!args.empty() && (sscanf(args.c_str(), "%u,%u", &in, &out) != 2 || !in || !out))
+			throw local_exception("Usage: null[:<in>,<out>]");
+		return new NullBackend(in, out);
+	}
+	if (type == "file") {
+		const size_t c1 = args.find(',');
+		if (c1 == std::string::npos)
+			throw local_exception("Usage: file:<in>,<out>[,<channels>]");
+		const size_t c2 = args.find(',', c1 + 1);
+		const std::string in = args.substr(0, c1);
+		const std::string out = args.substr(c1 + 1, (c2 == std::string::npos) ? std::string::npos : c2 - c1 - 1);
+		const int channels = (c2 == std::string::npos) ? 1 : atoi(args.substr(c2 + 1).c_str());
+		if (in.empty() || out.empty() || channels < 1)
+			throw local_exception("Usage: file:<in>,<out>[,<channels>]");
+		return new FileBackend(in, out, channels);
+	}
+	if (type == "alsa" && !args.empty())
+		return new AlsaBackend(args);
+
+	throw local_exception("Unknown audio backend: " + spec);
+}
+
+// EOF
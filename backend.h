@@ -0,0 +1,163 @@
+/*
+ *
+ *
+ *    backend.h
+ *
+ *    Audio backends for SoundCard: null, file/pipe, and ALSA mmap.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_BACKEND_H
+#define __FDVCORE_BACKEND_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "sc.h"
+
+// ALSA PCM handle
+typedef struct _snd_pcm snd_pcm_t;
+
+
+//
+//  NullBackend - no device; a clock calls the card once per window,
+//                with silent input, and the output is discarded
+//
+class NullBackend : public AudioBackend {
+	private:
+		std::vector<float> m_In;
+		std::vector<float> m_Out;
+		std::thread m_Clock;
+		std::atomic<bool> m_Running;
+
+	private:
+		// the clock thread body
+		void run(unsigned rate, unsigned win);
+
+	public:
+		NullBackend(uint16_t in = 2, uint16_t out = 2);
+		~NullBackend() { stop(); }
+
+	public:
+		std::string name() const { return "null"; }
+		bool start(SoundCard *card, unsigned rate, unsigned &win);
+		void stop();
+		bool independentClocks() const { return false; }
+};
+
+
+//
+//  FileBackend - raw interleaved S16 (native byte order) from one file
+//                or pipe, and to another; "-" is stdin or stdout
+//
+//  The stream runs as fast as the input can be read, so a pipe from a
+//  live source (e.g., an SDR) sets the pace, and a file is processed
+//  faster than real time.  The last window is padded with silence, and
+//  the stream stops at the end of the input.
+//
+class FileBackend : public AudioBackend {
+	private:
+		std::string m_InPath;
+		std::string m_OutPath;
+		int m_InFd;
+		int m_OutFd;
+		std::thread m_Reader;
+		std::atomic<bool> m_Running;
+		std::atomic<bool> m_Finished;
+
+	private:
+		FileBackend(const FileBackend&);
+		FileBackend &operator=(const FileBackend&);
+
+		// the stream thread body
+		void run(unsigned win);
+
+	public:
+		// opens both ends; throws local_exception on failure
+		FileBackend(const std::string &in, const std::string &out, uint16_t channels = 1);
+		~FileBackend();
+
+	public:
+		std::string name() const { return "file"; }
+		bool start(SoundCard *card, unsigned rate, unsigned &win);
+		void stop();
+		bool finished() const { return m_Finished.load(); }
+		bool suspendable() const { return false; }
+		bool independentClocks() const { return false; }
+
+		// true if either end is stdin or stdout
+		bool stdio() const { return m_InPath == "-" || m_OutPath == "-"; }
+};
+
+
+//
+//  AlsaBackend - direct ALSA access, in mmap mode
+//
+//  Capture and playback are linked, and each buffer is passed to the card
+//  in place, in the driver's own ring; with a FLOAT_LE device there is no
+//  copy at all, and with S16_LE only the format conversion.
+//
+class AlsaBackend : public AudioBackend {
+	private:
+		std::string m_Device;
+		snd_pcm_t *m_Capture;
+		snd_pcm_t *m_Playback;
+		bool m_FloatIn;
+		bool m_FloatOut;
+		bool m_Linked;
+		unsigned m_Period;
+		std::vector<float> m_In;
+		std::vector<float> m_Out;
+		std::thread m_Worker;
+		std::atomic<bool> m_Running;
+
+	private:
+		AlsaBackend(const AlsaBackend&);
+		AlsaBackend &operator=(const AlsaBackend&);
+
+		// set the hardware and software parameters of one stream
+		bool configure(snd_pcm_t *pcm, unsigned channels, unsigned rate, unsigned &period, bool &isFloat);
+
+		// (re)start both streams, with the playback buffer primed
+		bool restart();
+
+		// write 'frames' of silence to the playback buffer
+		void silence(unsigned frames);
+
+		// the stream thread body
+		void run();
+
+	public:
+		// opens the PCM device (e.g., "hw:0,0"); throws local_exception on failure
+		AlsaBackend(const std::string &device);
+		~AlsaBackend();
+
+	public:
+		std::string name() const { return "alsa:" + m_Device; }
+		bool start(SoundCard *card, unsigned rate, unsigned &win);
+		void stop();
+};
+
+
+//
+//  createBackend(...) - build a backend from a command-line spec:
+//
+//     <n>                     - RtAudio device number
+//     null[:<in>,<out>]       - NullBackend, with the given channel counts
+//     file:<in>,<out>[,<ch>]  - FileBackend
+//     alsa:<device>           - AlsaBackend
+//
+//  Throws local_exception (or RtAudioError) on failure.
+//
+AudioBackend *createBackend(const std::string &spec);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ *
+ *
+ *    binproto.h
+ *
+ *    Binary framing for the fdvcore control channel.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_BINPROTO_H
+#define __FDVCORE_BINPROTO_H
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+
+//
+//  A client switches a control channel from text to binary by sending
+//  the text command PROTO=BIN, and waiting for OK:PROTO=BIN; from then
+//  on, until the channel closes, every message is a frame:
+//
+//     request: <len:u16> <id:u8> <payload>
+//     reply:   <len:u16> <id:u8> <status:u8> <payload>
+//
+//  where 'len' counts the bytes after itself, and all integers are
+//  little-endian.  Requests may be sent back-to-back without waiting;
+//  the replies to everything read at once are written at once, in order.
+//
+
+// the largest frame, after the length
+#define BIN_MAX_FRAME 4096
+
+//
+//  command IDs
+//
+enum BinCommands {
+	BinText = 0,   // payload: a text command; reply: its text reply, less the newline
+	BinQuit = 1,   // end the session
+	BinPing = 2,   // reply: the payload, unchanged
+	BinStat = 3,   // reply: <sync:u8> <snr:f32>
+	BinMode = 4,   // payload: empty, or <mode:u8> to set it; reply: <mode:u8>
+	BinStatus = 5, // reply: <frames:u64> <modem frames:u64> <mode:u8> <sync:u8>
+	               //        <snr:f32> <df:f32> <in peak:f32> <in rms:f32>
+	               //        <out peak:f32> <out rms:f32> <clips:u64>
+	BinModemStats = 6, // payload: empty, or <since:u64>; reply: empty if
+	                   //        no frame is newer than 'since', otherwise
+	                   //        <frame:u64> <sync:u8> <snr:f32> <foff:f32>
+	                   //        <timing:f32> <clock:f32> <metric:f32>
+	                   //        <f_est:4 x f32> <nc:u8> <nr:u8>
+	                   //        <carrier magnitude:nc x f32>
+	                   //        <scatter:nc*nr x (i:f32 q:f32)>
+	BinCommandCount
+};
+
+//
+//  reply status
+//
+enum BinStatus {
+	BinOK = 0,
+	BinErr = 1
+};
+
+
+//
+//  binPut...(...) - append little-endian values
+//
+inline void binPutU8(std::string &out, uint8_t v) {
+	out += static_cast<char>(v);
+}
+
+inline void binPutU16(std::string &out, uint16_t v) {
+	out += static_cast<char>(v & 0xFF);
+	out += static_cast<char>(v >> 8);
+}
+
+inline void binPutU32(std::string &out, uint32_t v) {
+	for (int i = 0; i != 4; ++i, v >>= 8)
+		out += static_cast<char>(v & 0xFF);
+}
+
+inline void binPutU64(std::string &out, uint64_t v) {
+	for (int i = 0; i != 8; ++i, v >>= 8)
+		out += static_cast<char>(v & 0xFF);
+}
+
+inline void binPutFloat(std::string &out, float f) {
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	binPutU32(out, v);
+}
+
+
+//
+//  binGet...(...) - read little-endian values at 'pos', advancing it;
+//                   the caller checks the length first
+//
+inline uint8_t binGetU8(const std::string &in, size_t &pos) {
+	return static_cast<uint8_t>(in[pos++]);
+}
+
+inline uint16_t binGetU16(const std::string &in, size_t &pos) {
+	const uint16_t lo = binGetU8(in, pos);
+	return lo | (static_cast<uint16_t>(binGetU8(in, pos)) << 8);
+}
+
+inline uint32_t binGetU32(const std::string &in, size_t &pos) {
+	uint32_t v = 0;
+	for (int i = 0; i != 4; ++i)
+		v |= static_cast<uint32_t>(binGetU8(in, pos)) << (8 * i);
+	return v;
+}
+
+inline uint64_t binGetU64(const std::string &in, size_t &pos) {
+	uint64_t v = 0;
+	for (int i = 0; i != 8; ++i)
+		v |= static_cast<uint64_t>(binGetU8(in, pos)) << (8 * i);
+	return v;
+}
+
+inline float binGetFloat(const std::string &in, size_t &pos) {
+	const uint32_t v = binGetU32(in, pos);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+
+//
+//  binRequest(...) - append one request frame
+//
+inline void binRequest(std::string &out, uint8_t id, const std::string &payload = std::string()) {
+	binPutU16(out, 1 + payload.size());
+	binPutU8(out, id);
+	out += payload;
+}
+
+
+//
+//  binReply(...) - append one reply frame
+//
+inline void binReply(std::string &out, uint8_t id, uint8_t status, const std::string &payload = std::string()) {
+	binPutU16(out, 2 + payload.size());
+	binPutU8(out, id);
+	binPutU8(out, status);
+	out += payload;
+}
+
+
+//
+//  binNext(...) - take the next whole frame in 'in' at 'pos'; returns
+//                 false if it hasn't all arrived, or 'bad' if it can't
+//                 be a frame; the body is the bytes after the length
+//
+inline bool binNext(const std::string &in, size_t &pos, std::string &body, bool &bad) {
+	bad = false;
+	if (in.size() - pos < 2)
+		return false;
+	size_t p = pos;
+	const size_t len = binGetU16(in, p);
+	if (len == 0 || len > BIN_MAX_FRAME) {
+		bad = true;
+		return false;
+	}
+	if (in.size() - p < len)
+		return false;
+	body.assign(in, p, len);
+	pos = p + len;
+	return true;
+}
+
+
+//
+//  binWriteAll(...) - write a whole buffer, across short writes
+//
+inline bool binWriteAll(int fd, const std::string &data) {
+	const char *p = data.data();
+	size_t bytes = data.size();
+	while (bytes) {
+		const ssize_t n = write(fd, p, bytes);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+#endif
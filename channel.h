@@ -0,0 +1,201 @@
+/*
+ *
+ *
+ *    channel.h
+ *
+ *    HF channel model for the modem simulator: frequency offset,
+ *    two-path Rayleigh fading, and AWGN, applied at the sound card rate.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_CHANNEL_H
+#define __FDVCORE_CHANNEL_H
+
+#include <cmath>
+#include <complex>
+#include <random>
+#include <vector>
+
+#include "FirFilter.h"
+
+// Hilbert transformer length (odd)
+#define CHANNEL_HILBERT_LEN 127
+
+// the number of sinusoids summed by each fading generator
+#define CHANNEL_FADING_TONES 8
+
+
+//
+//  FadingPath - sum-of-sinusoids Rayleigh fading coefficient generator
+//
+class FadingPath {
+	private:
+		std::vector<double> m_Freq;   // per-tone Doppler shift (cycles/sample)
+		std::vector<double> m_Phase;  // per-tone phase (cycles)
+
+	public:
+		FadingPath(double doppler, double fs, std::mt19937 &rng)
+			: m_Freq(CHANNEL_FADING_TONES),
+			  m_Phase(CHANNEL_FADING_TONES) {
+			std::uniform_real_distribution<double> u(0.0, 1.0);
+			for (size_t m = 0; m != CHANNEL_FADING_TONES; ++m) {
+				m_Freq[m] = doppler * cos(2.0 * M_PI * u(rng)) / fs;
+				m_Phase[m] = u(rng);
+			}
+		}
+
+		// the complex gain at sample 'n'; unit mean power
+		std::complex<float> gain(uint64_t n) const {
+			double re = 0, im = 0;
+			for (size_t m = 0; m != CHANNEL_FADING_TONES; ++m) {
+				const double arg = 2.0 * M_PI * fmod(m_Phase[m] + m_Freq[m] * n, 1.0);
+				re += cos(arg);
+				im += sin(arg);
+			}
+			const double scale = 1.0 / sqrt(static_cast<double>(CHANNEL_FADING_TONES));
+			return std::complex<float>(re * scale, im * scale);
+		}
+};
+
+
+//
+//  ChannelModel - applies the channel to a real signal, block by block
+//
+//  The signal is made analytic with a Hilbert transformer, so that the
+//  frequency offset and fading can be applied as complex gains, and the
+//  real part is taken before noise is added.  SNR is measured in a 3 kHz
+//  noise bandwidth, as is usual for FreeDV.
+//
+class ChannelModel {
+	private:
+		double m_Fs;
+		double m_Offset;      // frequency offset (cycles/sample)
+		bool m_Fading;
+		size_t m_Delay;       // second path delay (samples)
+		float m_NoiseSigma;
+
+		// Hilbert transformer
+		std::vector<float> m_HilbertCoefs;
+		std::vector<float> m_HilbertHistory;
+		int m_HilbertPos;
+		std::vector<float> m_RealDelay;
+		size_t m_RealPos;
+
+		// second path delay line
+		std::vector<std::complex<float> > m_PathDelay;
+		size_t m_PathPos;
+
+		// fading and noise generators
+		std::mt19937 m_Rng;
+		std::normal_distribution<float> m_Normal;
+		FadingPath *m_Path1;
+		FadingPath *m_Path2;
+
+		uint64_t m_Sample;
+
+	private:
+		ChannelModel(const ChannelModel&);
+		ChannelModel &operator=(const ChannelModel&);
+
+		// ideal Hilbert transformer, 2/(pi*n) for odd n; negated, because
+		//    FirFilterUtils::Filter(...) applies coefs[0] to the oldest sample
+		static double IdealHilbert(double omega_c, int n, int N) {
+			return (n % 2) ? (-2.0 / (M_PI * n)) : 0.0;
+		}
+
+	public:
+		//
+		//  fs       - sample rate (Hz)
+		//  offset   - frequency offset (Hz)
+		//  fading   - enable two-path fading
+		//  doppler  - Doppler spread of each path (Hz)
+		//  delay    - delay of the second path (seconds)
+		//  seed     - random seed, for repeatable runs
+		//
+		ChannelModel(double fs, double offset, bool fading, double doppler, double delay, unsigned seed)
+			: m_Fs(fs),
+			  m_Offset(offset / fs),
+			  m_Fading(fading),
+			  m_Delay(static_cast<size_t>(delay * fs)),
+			  m_NoiseSigma(0),
+			  m_HilbertCoefs(CHANNEL_HILBERT_LEN),
+			  m_HilbertHistory(CHANNEL_HILBERT_LEN, 0.0f),
+			  m_HilbertPos(0),
+			  m_RealDelay(CHANNEL_HILBERT_LEN / 2 + 1, 0.0f),
+			  m_RealPos(0),
+			  m_PathDelay(m_Delay + 1),
+			  m_PathPos(0),
+			  m_Rng(seed),
+			  m_Normal(0.0f, 1.0f),
+			  m_Path1(0),
+			  m_Path2(0),
+			  m_Sample(0) {
+			const int limit = CHANNEL_HILBERT_LEN / 2;
+			for (int i = -limit; i <= limit; ++i) {
+				m_HilbertCoefs[i + limit] =
+					KK5JY::DSP::FirFilterUtils::BlackmanWindow(i, CHANNEL_HILBERT_LEN) *
+					IdealHilbert(0, i, CHANNEL_HILBERT_LEN);
+			}
+			if (m_Fading) {
+				m_Path1 = new FadingPath(doppler, fs, m_Rng);
+				m_Path2 = new FadingPath(doppler, fs, m_Rng);
+			}
+		}
+
+		~ChannelModel() {
+			delete m_Path1;
+			delete m_Path2;
+		}
+
+	public:
+		//
+		//  noise(...) - set the noise level for a given signal power and SNR
+		//
+		void noise(double signalPower, double snrDb) {
+			// noise power in 3 kHz is 'signalPower / snr'; spread it
+			//    over the whole Nyquist band
+			const double n3k = signalPower / pow(10.0, snrDb / 10.0);
+			m_NoiseSigma = sqrt(n3k * (m_Fs / 2.0) / 3000.0);
+		}
+
+		//
+		//  apply(...) - run 'count' samples through the channel, in place
+		//
+		void apply(float *samples, size_t count) {
+			for (size_t i = 0; i != count; ++i) {
+				// analytic signal: delayed real part, Hilbert imaginary part
+				const float x = samples[i];
+				const float im = KK5JY::DSP::FirFilterUtils::Filter(
+					x, m_HilbertPos, &m_HilbertHistory[0], CHANNEL_HILBERT_LEN,
+					&m_HilbertCoefs[0], CHANNEL_HILBERT_LEN);
+				m_RealDelay[m_RealPos] = x;
+				m_RealPos = (m_RealPos + 1) % m_RealDelay.size();
+				std::complex<float> z(m_RealDelay[m_RealPos], im);
+
+				// two equal-power fading paths
+				if (m_Fading) {
+					m_PathDelay[m_PathPos] = z;
+					m_PathPos = (m_PathPos + 1) % m_PathDelay.size();
+					const std::complex<float> late = m_PathDelay[m_PathPos];
+					z = (m_Path1->gain(m_Sample) * z + m_Path2->gain(m_Sample) * late) * static_cast<float>(M_SQRT1_2);
+				}
+
+				// frequency offset
+				if (m_Offset != 0) {
+					const double arg = 2.0 * M_PI * fmod(m_Offset * m_Sample, 1.0);
+					z *= std::complex<float>(cos(arg), sin(arg));
+				}
+
+				samples[i] = z.real() + (m_NoiseSigma * m_Normal(m_Rng));
+				++m_Sample;
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ *
+ *
+ *    codecsource.cc
+ *
+ *    CodecSource class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "codecsource.h"
+#include "localtypes.h"
+
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// the number of modem frames read ahead of the modulator
+#define CODEC_SOURCE_QUEUE_LEN 8
+
+
+//
+//  CodecSource::ctor
+//
+CodecSource::CodecSource(const std::string &source, size_t bytesPerFrame, int modem)
+	: m_Source(source),
+	  m_Bytes(bytesPerFrame),
+	  m_Modem(modem),
+	  m_File(0),
+	  m_Loop(false),
+	  m_Socket(-1),
+	  m_Ring(CODEC_SOURCE_QUEUE_LEN),
+	  m_Received(0),
+	  m_Rejected(0),
+	  m_Running(false),
+	  m_Finished(false) {
+	if (m_Bytes == 0 || m_Bytes > CODEC_TAP_MAX_BYTES)
+		throw local_exception("Codec frames are not supported for this modem");
+
+	if (source.compare(0, 5, "file:") == 0 || source.compare(0, 5, "loop:") == 0) {
+		m_Loop = (source.compare(0, 5, "loop:") == 0);
+		m_File = fopen(source.substr(5).c_str(), "rb");
+		if (!m_File)
+			throw local_exception("Could not open " + source.substr(5));
+		m_Running = true;
+		m_Reader = std::thread(&CodecSource::readFile, this);
+	} else {
+		m_Socket = codecTapListen(source);
+		if (m_Socket < 0)
+			throw local_exception("Could not listen on " + source);
+		m_Running = true;
+		m_Reader = std::thread(&CodecSource::readSocket, this);
+	}
+}
+
+
+//
+//  CodecSource::dtor
+//
+CodecSource::~CodecSource() {
+	m_Running = false;
+	if (m_Reader.joinable())
+		m_Reader.join();
+	if (m_File) {
+		fclose(m_File);
+		m_File = 0;
+	}
+	if (m_Socket >= 0) {
+		close(m_Socket);
+		m_Socket = -1;
+	}
+}
+
+
+//
+//  CodecSource::readFile() - reader thread body for files
+//
+void CodecSource::readFile() {
+	codec_tap_packet p;
+	memset(&p, 0, sizeof(p));
+	while (m_Running) {
+		// wait for room, so the file is paced by the modulator
+		if (m_Ring.size() == m_Ring.capacity()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+		if (fread(p.bits, 1, m_Bytes, m_File) != m_Bytes) {
+			// a partial frame at the end is discarded
+			if (m_Loop && feof(m_File) && m_Received.load() != 0) {
+				rewind(m_File);
+				continue;
+			}
+			break;
+		}
+		p.bytes = m_Bytes;
+		m_Ring.push(p);
+		m_Received.fetch_add(1, std::memory_order_relaxed);
+	}
+	m_Finished = true;
+}
+
+
+//
+//  CodecSource::readSocket() - reader thread body for sockets
+//
+void CodecSource::readSocket() {
+	codec_tap_packet p;
+	const size_t header = sizeof(p) - CODEC_TAP_MAX_BYTES;
+	while (m_Running) {
+		// wake periodically to check for shutdown
+		struct pollfd pfd;
+		pfd.fd = m_Socket;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		const ssize_t len = recv(m_Socket, &p, sizeof(p), 0);
+		if (len < 0)
+			break;
+
+		if (static_cast<size_t>(len) == m_Bytes) {
+			// raw frame; move it into place
+			memmove(p.bits, &p, m_Bytes);
+		} else {
+			// otherwise, only a NETTAP datagram from the same modem
+			if (static_cast<size_t>(len) >= header)
+				codecTapFromWire(p);
+			if (static_cast<size_t>(len) < header || p.magic != CODEC_TAP_MAGIC ||
+			    p.version != CODEC_TAP_VERSION || p.modem != m_Modem ||
+			    p.bytes != m_Bytes || static_cast<size_t>(len) != header + p.bytes) {
+				m_Rejected.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+		}
+
+		// if the modulator has fallen behind, the ring is full, and this
+		//    (the newest) frame is dropped; only the audio thread may pop,
+		//    so the oldest can't be made room for here
+		if (m_Ring.push(p))
+			m_Received.fetch_add(1, std::memory_order_relaxed);
+		else
+			m_Rejected.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// EOF
@@ -0,0 +1,107 @@
+/*
+ *
+ *
+ *    codecsource.h
+ *
+ *    CodecSource class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_CODECSOURCE_H
+#define __FDVCORE_CODECSOURCE_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include "LockFreeRing.h"
+#include "codectap.h"
+
+
+//
+//  CodecSource - pre-encoded codec2 frames for the TX modulator
+//
+//  A reader thread fills a short lock-free queue, one modem frame of
+//  packed codec2 bits per entry, and the audio thread takes them with
+//  read(), which never blocks.  Sources are:
+//
+//     file:<path>   - raw packed frames (as written by 'c2enc'), sent once
+//     loop:<path>   - the same, repeated
+//     udp:<port>    - datagrams from a NETTAP, or raw frames
+//     unix:<path>   - the same, on a local datagram socket
+//
+//  Files are paced by the modulator: the reader only reads ahead as far
+//  as the queue allows.
+//
+class CodecSource {
+	private:
+		std::string m_Source;
+		size_t m_Bytes;     // bytes per modem frame
+		int m_Modem;
+		FILE *m_File;
+		bool m_Loop;
+		int m_Socket;
+
+		LockFreeRing<codec_tap_packet> m_Ring;
+		std::atomic<uint64_t> m_Received;
+		std::atomic<uint64_t> m_Rejected;
+
+		std::thread m_Reader;
+		std::atomic<bool> m_Running;
+		std::atomic<bool> m_Finished;
+
+	private:
+		CodecSource(const CodecSource&);
+		CodecSource &operator=(const CodecSource&);
+
+		// the reader thread bodies
+		void readFile();
+		void readSocket();
+
+	public:
+		// opens the source; throws local_exception on failure
+		CodecSource(const std::string &source, size_t bytesPerFrame, int modem);
+		~CodecSource();
+
+	public: // audio thread
+		// take one modem frame of bits; false if none is ready
+		bool read(unsigned char *bits) {
+			codec_tap_packet p;
+			if (!m_Ring.pop(p))
+				return false;
+			memcpy(bits, p.bits, m_Bytes);
+			return true;
+		}
+
+	public: // control thread
+		const std::string &source() const {
+			return m_Source;
+		}
+
+		// true once a file source has been completely read and sent
+		bool finished() const {
+			return m_Finished.load() && m_Ring.empty();
+		}
+
+		// frames accepted from the source
+		uint64_t received() const {
+			return m_Received.load();
+		}
+
+		// datagrams ignored because they didn't match this modem, or
+		//    arrived while the queue was full
+		uint64_t rejected() const {
+			return m_Rejected.load();
+		}
+};
+
+#endif
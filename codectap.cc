@@ -0,0 +1,254 @@
+/*
+ *
+ *
+ *    codectap.cc
+ *
+ *    CodecTap class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "codectap.h"
+#include "localtypes.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// the number of frames that may wait for the sender
+#define CODEC_TAP_QUEUE_LEN 64
+
+
+//
+//  codecTapBind(...) - bind a datagram socket to any local address of
+//                      'family', on 'port'; 'shared' lets several
+//                      listeners on this host bind the same port
+//
+static int codecTapBind(int family, const std::string &port, bool shared) {
+	struct addrinfo hints, *res = 0;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(0, port.c_str(), &hints, &res) != 0 || !res)
+		return -1;
+	int s = socket(res->ai_family, SOCK_DGRAM, 0);
+	if (s >= 0) {
+		// accept IPv4 on an IPv6 socket as well
+		int off = 0, on = 1;
+		if (family == AF_INET6)
+			setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+		if (shared)
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(s, res->ai_addr, res->ai_addrlen) != 0) {
+			close(s);
+			s = -1;
+		}
+	}
+	freeaddrinfo(res);
+	return s;
+}
+
+
+//
+//  codecTapListen(...) - bind a listening datagram socket
+//
+int codecTapListen(const std::string &target) {
+	int s = -1;
+	if (target.compare(0, 5, "unix:") == 0) {
+		const std::string path = target.substr(5);
+		struct sockaddr_un sun;
+		memset(&sun, 0, sizeof(sun));
+		if (path.empty() || path.size() >= sizeof(sun.sun_path))
+			return -1;
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, path.c_str());
+		unlink(path.c_str());
+		s = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (s >= 0 && bind(s, reinterpret_cast<struct sockaddr*>(&sun), sizeof(sun)) != 0) {
+			close(s);
+			s = -1;
+		}
+	} else if (target.compare(0, 4, "udp:") == 0) {
+		// an optional group before the port
+		std::string group, port = target.substr(4);
+		const size_t colon = port.rfind(':');
+		if (colon != std::string::npos) {
+			group = port.substr(0, colon);
+			port = port.substr(colon + 1);
+			if (group.size() > 2 && group[0] == '[' && group[group.size() - 1] == ']')
+				group = group.substr(1, group.size() - 2);
+		}
+		if (group.empty())
+			return codecTapBind(AF_INET6, port, false);
+
+		struct addrinfo hints, *res = 0;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_NUMERICHOST;
+		if (getaddrinfo(group.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+			return -1;
+		s = codecTapBind(res->ai_family, port, true);
+		if (s >= 0) {
+			int result = -1;
+			if (res->ai_family == AF_INET) {
+				const struct sockaddr_in *sin = reinterpret_cast<const struct sockaddr_in*>(res->ai_addr);
+				if (IN_MULTICAST(ntohl(sin->sin_addr.s_addr))) {
+					struct ip_mreq mreq;
+					memset(&mreq, 0, sizeof(mreq));
+					mreq.imr_multiaddr = sin->sin_addr;
+					mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+					result = setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+				}
+			} else if (res->ai_family == AF_INET6) {
+				const struct sockaddr_in6 *sin6 = reinterpret_cast<const struct sockaddr_in6*>(res->ai_addr);
+				if (IN6_IS_ADDR_MULTICAST(&sin6->sin6_addr)) {
+					struct ipv6_mreq mreq;
+					memset(&mreq, 0, sizeof(mreq));
+					mreq.ipv6mr_multiaddr = sin6->sin6_addr;
+					mreq.ipv6mr_interface = sin6->sin6_scope_id;
+					result = setsockopt(s, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq));
+				}
+			}
+
+			// only a multicast group makes sense here
+			if (result != 0) {
+				close(s);
+				s = -1;
+			}
+		}
+		freeaddrinfo(res);
+	}
+	return s;
+}
+
+
+//
+//  CodecTap::ctor
+//
+CodecTap::CodecTap(const std::string &target, int modem)
+	: m_Target(target),
+	  m_Socket(-1),
+	  m_AddrLen(0),
+	  m_Modem(modem),
+	  m_Ring(CODEC_TAP_QUEUE_LEN),
+	  m_Seq(0),
+	  m_Sent(0),
+	  m_Dropped(0),
+	  m_Running(false) {
+	memset(&m_Addr, 0, sizeof(m_Addr));
+
+	if (target.compare(0, 5, "unix:") == 0) {
+		const std::string path = target.substr(5);
+		struct sockaddr_un *sun = reinterpret_cast<struct sockaddr_un*>(&m_Addr);
+		if (path.empty() || path.size() >= sizeof(sun->sun_path))
+			throw local_exception("Bad socket path: " + path);
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, path.c_str());
+		m_AddrLen = sizeof(struct sockaddr_un);
+		m_Socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+	} else if (target.compare(0, 4, "udp:") == 0) {
+		const std::string hostport = target.substr(4);
+		const size_t colon = hostport.rfind(':');
+		if (colon == std::string::npos)
+			throw local_exception("Expected udp:<host>:<port>");
+		const std::string host = hostport.substr(0, colon);
+		const std::string port = hostport.substr(colon + 1);
+
+		struct addrinfo hints, *res = 0;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+			throw local_exception("Could not resolve " + hostport);
+		memcpy(&m_Addr, res->ai_addr, res->ai_addrlen);
+		m_AddrLen = res->ai_addrlen;
+		m_Socket = socket(res->ai_family, SOCK_DGRAM, 0);
+		freeaddrinfo(res);
+
+		// allow broadcast addresses
+		if (m_Socket >= 0) {
+			int on = 1;
+			setsockopt(m_Socket, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+		}
+	} else {
+		throw local_exception("Expected udp:<host>:<port> or unix:<path>");
+	}
+	if (m_Socket < 0)
+		throw local_exception("Could not open socket for " + target);
+
+	m_Running = true;
+	m_Sender = std::thread(&CodecTap::run, this);
+}
+
+
+//
+//  CodecTap::dtor
+//
+CodecTap::~CodecTap() {
+	m_Running = false;
+	if (m_Sender.joinable())
+		m_Sender.join();
+	if (m_Socket >= 0) {
+		close(m_Socket);
+		m_Socket = -1;
+	}
+}
+
+
+//
+//  CodecTap::write(...) - queue one frame (audio thread)
+//
+void CodecTap::write(const unsigned char *bits, size_t bytes, size_t frames, bool sync, float snr) {
+	codec_tap_packet p;
+	if (bytes > CODEC_TAP_MAX_BYTES)
+		bytes = CODEC_TAP_MAX_BYTES;
+	p.magic = CODEC_TAP_MAGIC;
+	p.version = CODEC_TAP_VERSION;
+	p.modem = m_Modem;
+	p.sync = sync ? 1 : 0;
+	p.snr = static_cast<int8_t>(std::max(-128.0f, std::min(127.0f, roundf(snr))));
+	p.seq = m_Seq++;
+	p.usec = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	p.frames = frames;
+	p.bytes = bytes;
+	memcpy(p.bits, bits, bytes);
+	if (!m_Ring.push(p))
+		m_Dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+//
+//  CodecTap::run() - sender thread body
+//
+void CodecTap::run() {
+	codec_tap_packet p;
+	while (m_Running) {
+		if (!m_Ring.pop(p)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		const size_t len = sizeof(p) - CODEC_TAP_MAX_BYTES + p.bytes;
+		codecTapToWire(p);
+		if (sendto(m_Socket, &p, len, MSG_DONTWAIT, reinterpret_cast<struct sockaddr*>(&m_Addr), m_AddrLen) == static_cast<ssize_t>(len))
+			m_Sent.fetch_add(1, std::memory_order_relaxed);
+		else
+			m_Dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// EOF
@@ -0,0 +1,145 @@
+/*
+ *
+ *
+ *    codectap.h
+ *
+ *    CodecTap class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_CODECTAP_H
+#define __FDVCORE_CODECTAP_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <endian.h>
+#include <sys/socket.h>
+
+#include "LockFreeRing.h"
+
+// identifies a codec tap datagram ("FDVB")
+#define CODEC_TAP_MAGIC 0x42564446
+
+// bump this whenever the datagram layout changes
+#define CODEC_TAP_VERSION 1
+
+// the most codec bytes carried by one datagram
+#define CODEC_TAP_MAX_BYTES 64
+
+
+//
+//  codec_tap_packet - one modem frame's worth of codec2 bits
+//
+//  This is also the datagram layout, with no padding; only the first
+//  'bytes' entries of 'bits' are sent.  The multi-byte fields are
+//  little-endian on the wire (see codecTapToWire), and in host order
+//  everywhere else.
+//
+#pragma pack(push, 1)
+struct codec_tap_packet {
+	uint32_t magic;
+	uint8_t  version;
+	uint8_t  modem;      // FREEDV_MODE_* of the sender
+	uint8_t  sync;       // modem sync state
+	int8_t   snr;        // modem SNR estimate (dB, rounded)
+	uint32_t seq;        // datagram sequence number
+	uint64_t usec;       // receive time, microseconds since the epoch
+	uint16_t frames;     // codec2 frames in 'bits'
+	uint16_t bytes;      // bytes of 'bits' that follow
+	uint8_t  bits[CODEC_TAP_MAX_BYTES];
+};
+#pragma pack(pop)
+
+
+//
+//  codecTapToWire(...), codecTapFromWire(...) - convert the header
+//                       fields of 'p' between host and wire order
+//
+inline void codecTapToWire(codec_tap_packet &p) {
+	p.magic = htole32(p.magic);
+	p.seq = htole32(p.seq);
+	p.usec = htole64(p.usec);
+	p.frames = htole16(p.frames);
+	p.bytes = htole16(p.bytes);
+}
+
+inline void codecTapFromWire(codec_tap_packet &p) {
+	p.magic = le32toh(p.magic);
+	p.seq = le32toh(p.seq);
+	p.usec = le64toh(p.usec);
+	p.frames = le16toh(p.frames);
+	p.bytes = le16toh(p.bytes);
+}
+
+
+//
+//  codecTapListen(...) - bind a datagram socket for 'udp:<port>',
+//                        'udp:<group>:<port>' (joining a multicast
+//                        group), or 'unix:<path>'; returns -1 on failure
+//
+int codecTapListen(const std::string &target);
+
+
+//
+//  CodecTap - forwards received codec2 frames to network listeners
+//
+//  The audio thread queues frames with write(), which never blocks; a
+//  sender thread transmits them.  Targets are 'udp:<host>:<port>' (which
+//  may be a broadcast or multicast address, for many listeners) or
+//  'unix:<path>' for a local datagram socket.
+//
+class CodecTap {
+	private:
+		std::string m_Target;
+		int m_Socket;
+		struct sockaddr_storage m_Addr;
+		socklen_t m_AddrLen;
+		uint8_t m_Modem;
+
+		LockFreeRing<codec_tap_packet> m_Ring;
+		uint32_t m_Seq;
+		std::atomic<uint64_t> m_Sent;
+		std::atomic<uint64_t> m_Dropped;
+
+		std::thread m_Sender;
+		std::atomic<bool> m_Running;
+
+	private:
+		CodecTap(const CodecTap&);
+		CodecTap &operator=(const CodecTap&);
+
+		// the sender thread body
+		void run();
+
+	public:
+		// opens the socket; throws local_exception on a bad target
+		CodecTap(const std::string &target, int modem);
+		~CodecTap();
+
+	public: // audio thread
+		// queue one modem frame of packed codec bits
+		void write(const unsigned char *bits, size_t bytes, size_t frames, bool sync, float snr);
+
+	public: // control thread
+		const std::string &target() const {
+			return m_Target;
+		}
+
+		uint64_t sent() const {
+			return m_Sent.load();
+		}
+
+		uint64_t dropped() const {
+			return m_Dropped.load();
+		}
+};
+
+#endif
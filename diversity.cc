@@ -0,0 +1,262 @@
+/*
+ *
+ *
+ *    diversity.cc
+ *
+ *    DiversityRx class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "diversity.h"
+#include "localtypes.h"
+#include "spectrum.h"
+#include "codectap.h"
+#include <climits>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include <codec2/codec2.h>
+
+// decimated input each branch may hold, in modem frames, before the
+//    oldest is discarded
+#define DIVERSITY_MAX_FRAMES 4
+
+
+//
+//  DiversityRx::Branch::ctor
+//
+DiversityRx::Branch::Branch(unsigned rate, float pass, float atten, KK5JY::DSP::WindowFunction window)
+	: fdv(0),
+	  decimator(rate / MODEM_FS, rate, pass, atten, window),
+	  fill(0),
+	  nout(0),
+	  ready(false),
+	  sync(0),
+	  snr(0),
+	  codec2(0),
+	  bytes(0),
+	  frames(0),
+	  ntext(0) {
+	// nop
+}
+
+
+//
+//  DiversityRx::ctor
+//
+DiversityRx::DiversityRx(int modem, unsigned rate, bool squelch, float threshold,
+	float pass, float atten, KK5JY::DSP::WindowFunction window)
+	: m_Branch { Branch(rate, pass, atten, window), Branch(rate, pass, atten, window) },
+	  m_Ratio(rate / MODEM_FS),
+	  m_Drops(0),
+	  m_Sync(0),
+	  m_Snr(0),
+	  m_Text(0),
+	  m_TextState(0),
+	  m_Winner(0),
+	  m_Go(false),
+	  m_Codec(false),
+	  m_Running(true),
+	  m_Done(false) {
+	m_Wins[0].store(0);
+	m_Wins[1].store(0);
+	for (int i = 0; i != 2; ++i) {
+		Branch &b = m_Branch[i];
+		b.fdv = freedv_open(modem);
+		if (!b.fdv) {
+			if (i)
+				freedv_close(m_Branch[0].fdv);
+			throw local_exception("Could not start the diversity modem");
+		}
+		freedv_set_snr_squelch_thresh(b.fdv, threshold);
+		freedv_set_squelch_en(b.fdv, squelch);
+		b.in.resize(DIVERSITY_MAX_FRAMES * freedv_get_n_max_modem_samples(b.fdv));
+		b.speech.resize(freedv_get_n_speech_samples(b.fdv));
+		b.codec2 = freedv_get_codec2(b.fdv);
+		b.bits.resize(std::max(freedv_get_n_codec_bits(b.fdv), CODEC_TAP_MAX_BYTES));
+
+		// each branch keeps its text until the frame is chosen
+		freedv_set_callback_txt(b.fdv, &DiversityRx::putText, 0, &b);
+	}
+	m_Helper = std::thread(&DiversityRx::run, this);
+}
+
+
+//
+//  DiversityRx::dtor
+//
+DiversityRx::~DiversityRx() {
+	{
+		std::lock_guard<std::mutex> l(m_Lock);
+		m_Running = false;
+	}
+	m_Wake.notify_one();
+	m_Helper.join();
+	for (int i = 0; i != 2; ++i)
+		freedv_close(m_Branch[i].fdv);
+}
+
+
+//
+//  DiversityRx::decode(...) - run one frame through a branch's receiver
+//
+void DiversityRx::decode(Branch &b, bool codec) {
+	const size_t nin = freedv_nin(b.fdv);
+	if (b.ready || b.fill < nin)
+		return;
+	b.bytes = b.frames = 0;
+	if (codec && b.codec2) {
+		// as SoundCardDV::rxCodec(...) does for the single receiver
+		b.bytes = freedv_codecrx(b.fdv, &b.bits[0], &b.in[0]);
+		if (b.bytes <= 0) {
+			std::fill(b.speech.begin(), b.speech.end(), 0);
+			b.nout = b.speech.size();
+		} else {
+			const int bpf = (codec2_bits_per_frame(b.codec2) + 7) / 8;
+			const int spf = codec2_samples_per_frame(b.codec2);
+			b.frames = std::min(b.bytes / bpf, static_cast<int>(b.speech.size()) / spf);
+			for (int i = 0; i != b.frames; ++i)
+				codec2_decode(b.codec2, &b.speech[i * spf], &b.bits[i * bpf]);
+			b.nout = b.frames * spf;
+		}
+	} else {
+		b.nout = freedv_rx(b.fdv, &b.speech[0], &b.in[0]);
+	}
+	freedv_get_modem_stats(b.fdv, &b.sync, &b.snr);
+	memmove(&b.in[0], &b.in[nin], (b.fill - nin) * sizeof(short));
+	b.fill -= nin;
+	b.ready = true;
+}
+
+
+//
+//  DiversityRx::putText(...) - hold one received character
+//
+void DiversityRx::putText(void *branch, char c) {
+	Branch *b = static_cast<Branch*>(branch);
+	if (b->ntext != DIVERSITY_MAX_TEXT)
+		b->text[b->ntext++] = c;
+}
+
+
+//
+//  DiversityRx::run() - helper thread body
+//
+void DiversityRx::run() {
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> l(m_Lock);
+			m_Wake.wait(l, [this]() { return m_Go || !m_Running; });
+			if (!m_Running)
+				return;
+			m_Go = false;
+		}
+		decode(m_Branch[1], m_Codec);
+		m_Done.store(true, std::memory_order_release);
+	}
+}
+
+
+//
+//  DiversityRx::write(...) - decimate both input channels
+//
+size_t DiversityRx::write(const float *in, unsigned ci, size_t count, SpectrumMonitor *spectrum,
+		IFilter<float> *left, IFilter<float> *right) {
+	size_t clips = 0;
+	for (int i = 0; i != 2; ++i) {
+		Branch &b = m_Branch[i];
+		IFilter<float> *f = i ? right : left;
+		const float *p = in + ((ci > 1) ? i : 0);
+
+		// if this branch is far behind, make room by dropping the oldest
+		const size_t room = b.in.size() - b.fill;
+		const size_t need = (count + m_Ratio - 1) / m_Ratio;
+		if (need > room) {
+			const size_t drop = std::min(b.fill, need - room);
+			memmove(&b.in[0], &b.in[drop], (b.fill - drop) * sizeof(short));
+			b.fill -= drop;
+			m_Drops.fetch_add(drop, std::memory_order_relaxed);
+		}
+
+		for (size_t n = 0; n != count; ++n, p += ci) {
+			float sample = *p;
+			if (b.decimator.write(sample, sample)) {
+				if (i == 0 && spectrum)
+					spectrum->write(sample);
+				float v = f ? f->filter(sample) : sample;
+				if (fabs(v) >= CLIP_LIMIT) {
+					++clips;
+					v = std::max(-1.0f, std::min(1.0f, v));
+				}
+				if (b.fill != b.in.size())
+					b.in[b.fill++] = SHRT_MAX * v;
+			}
+		}
+	}
+	return clips;
+}
+
+
+//
+//  DiversityRx::read(...) - decode, and choose the better frame
+//
+size_t DiversityRx::read(short *speech, CodecTap *tap) {
+	Branch &l = m_Branch[0];
+	Branch &r = m_Branch[1];
+
+	// both receivers at once, when both have the input for a frame
+	const bool codec = (tap != 0);
+	const bool helper = !r.ready && r.fill >= static_cast<size_t>(freedv_nin(r.fdv));
+	if (helper) {
+		{
+			std::lock_guard<std::mutex> lk(m_Lock);
+			m_Go = true;
+			m_Codec = codec;
+		}
+		m_Wake.notify_one();
+	}
+	decode(l, codec);
+	if (helper) {
+		while (!m_Done.load(std::memory_order_acquire))
+			std::this_thread::yield();
+		m_Done.store(false, std::memory_order_relaxed);
+	}
+
+	// freedv_nin() drifts a little differently on each branch, so one
+	//    may hold its frame until the other has the input to match it
+	if (!l.ready || !r.ready)
+		return 0;
+
+	// sync first, then SNR
+	int w = 0;
+	if (r.sync != l.sync)
+		w = r.sync ? 1 : 0;
+	else
+		w = (r.snr > l.snr) ? 1 : 0;
+
+	const Branch &best = m_Branch[w];
+	m_Winner = w;
+	m_Wins[w].fetch_add(1, std::memory_order_relaxed);
+	m_Sync.store(best.sync, std::memory_order_relaxed);
+	m_Snr.store(best.snr, std::memory_order_relaxed);
+	memcpy(speech, &best.speech[0], best.nout * sizeof(short));
+
+	// the winner's text and codec bits go on; the other's are dropped
+	if (m_Text)
+		for (size_t i = 0; i != best.ntext; ++i)
+			m_Text(m_TextState, best.text[i]);
+	if (tap && best.bytes > 0)
+		tap->write(&best.bits[0], best.bytes, best.frames, best.sync, best.snr);
+	l.ntext = r.ntext = 0;
+	l.ready = r.ready = false;
+	return best.nout;
+}
+
+// EOF
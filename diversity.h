@@ -0,0 +1,175 @@
+/*
+ *
+ *
+ *    diversity.h
+ *
+ *    DiversityRx class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_DIVERSITY_H
+#define __FDVCORE_DIVERSITY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "Resampler.h"
+#include "localtypes.h"
+
+// import 'freedv' type
+#include <codec2/freedv_api.h>
+
+// received text characters held per branch, per frame
+#define DIVERSITY_MAX_TEXT 16
+
+class SpectrumMonitor;
+class CodecTap;
+struct CODEC2;
+
+
+//
+//  DiversityRx - two receivers, one per input channel, best frame wins
+//
+//  The audio thread decimates the left and right inputs into one branch
+//  each with write(), and collects decoded speech with read().  Each
+//  branch has its own freedv instance; when both have a frame's worth of
+//  input, the right branch is decoded on a helper thread while the left
+//  is decoded on the caller's, and the frame with sync (and then the
+//  better SNR) is returned.
+//
+//  Everything else the single receiver does follows the winning frame:
+//  its received text goes to the text callback, and, with a codec tap,
+//  its codec bits are forwarded.  The left input feeds the spectrum.
+//
+class DiversityRx {
+	public:
+		// one decimation chain and receiver
+		struct Branch {
+			freedv *fdv;
+			KK5JY::DSP::Decimator<float> decimator;
+			std::vector<short> in;     // decimated input
+			size_t fill;
+			std::vector<short> speech; // the pending decoded frame
+			size_t nout;
+			bool ready;
+			int sync;
+			float snr;
+
+			// the pending frame's codec bits, when decoded for a tap
+			CODEC2 *codec2;
+			std::vector<unsigned char> bits;
+			int bytes;
+			int frames;
+
+			// the text received while decoding the pending frame
+			char text[DIVERSITY_MAX_TEXT];
+			size_t ntext;
+
+			Branch(unsigned rate, float pass, float atten, KK5JY::DSP::WindowFunction window);
+		};
+
+	private:
+		Branch m_Branch[2];
+		const unsigned m_Ratio;
+
+		// written by the audio thread, read by any
+		std::atomic<uint64_t> m_Wins[2];
+		std::atomic<uint64_t> m_Drops;
+		std::atomic<int> m_Sync;
+		std::atomic<float> m_Snr;
+
+		// where the winning frame's text goes
+		freedv_callback_rx m_Text;
+		void *m_TextState;
+
+		// the winning branch of the last frame
+		int m_Winner;
+
+		// helper thread for the right branch
+		std::thread m_Helper;
+		std::mutex m_Lock;
+		std::condition_variable m_Wake;
+		bool m_Go;
+		bool m_Codec;          // decode to codec bits, for a tap
+		bool m_Running;
+		std::atomic<bool> m_Done;
+
+	private:
+		DiversityRx(const DiversityRx&);
+		DiversityRx &operator=(const DiversityRx&);
+
+		// decode one frame on a branch, if it has the input for one;
+		//    'codec' keeps the codec bits as well
+		static void decode(Branch &b, bool codec);
+
+		// the branches' text callback
+		static void putText(void *branch, char c);
+
+		// the helper thread body
+		void run();
+
+	public:
+		// opens both receivers, decimating with the given filter design
+		//    (see KK5JY::DSP::Decimator); throws local_exception on failure
+		DiversityRx(int modem, unsigned rate, bool squelch, float threshold,
+			float pass = FILTER_PASS, float atten = FILTER_ATTEN, KK5JY::DSP::WindowFunction window = 0);
+		~DiversityRx();
+
+		// send the winning frames' received text to 'rx' (e.g., the
+		//    callback given to freedv_set_callback_txt); call before
+		//    the audio thread has the receiver
+		void textCallback(freedv_callback_rx rx, void *state) {
+			m_Text = rx;
+			m_TextState = state;
+		}
+
+	public: // audio thread
+		// decimate one sound card buffer; channel 0 and 1 of 'ci', and
+		//    the decimated left channel to 'spectrum', if any; each
+		//    channel then goes through its RX filter, if any; returns
+		//    the samples that reached CLIP_LIMIT
+		size_t write(const float *in, unsigned ci, size_t count, SpectrumMonitor *spectrum = 0,
+			IFilter<float> *left = 0, IFilter<float> *right = 0);
+
+		// returns the next chosen frame of speech, or zero samples if
+		//    neither branch has one ready yet; with a 'tap', the frame's
+		//    codec bits are forwarded to it
+		size_t read(short *speech, CodecTap *tap = 0);
+
+		// the receiver of the last chosen frame; between calls to read()
+		//    it is idle, so its stats may be taken
+		freedv *winner() const {
+			return m_Branch[m_Winner].fdv;
+		}
+
+	public: // any thread
+		// frames taken from each branch
+		uint64_t wins(int branch) const {
+			return m_Wins[branch ? 1 : 0].load(std::memory_order_relaxed);
+		}
+
+		// the sync and SNR of the last chosen frame
+		int sync() const {
+			return m_Sync.load(std::memory_order_relaxed);
+		}
+		float snr() const {
+			return m_Snr.load(std::memory_order_relaxed);
+		}
+
+		// input samples lost because one branch fell behind
+		uint64_t drops() const {
+			return m_Drops.load(std::memory_order_relaxed);
+		}
+};
+
+#endif
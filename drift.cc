@@ -0,0 +1,101 @@
+/*
+ *
+ *
+ *    drift.cc
+ *
+ *    DriftTracker class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "drift.h"
+#include <algorithm>
+
+
+//
+//  DriftTracker::ctor
+//
+DriftTracker::DriftTracker(unsigned rate)
+	: m_Rate(rate),
+	  m_Drift(0),
+	  m_Estimates(0) {
+	reset();
+}
+
+
+//
+//  DriftTracker::reset() - drop the trend and the target
+//
+void DriftTracker::reset() {
+	m_Locked = false;
+	m_Target = 0;
+	m_Depth = -1;
+	restart();
+}
+
+
+//
+//  DriftTracker::restart() - drop the trend
+//
+void DriftTracker::restart() {
+	m_Played = m_Held = 0;
+	m_N = m_SumX = m_SumY = m_SumU = 0;
+	m_Points = 0;
+	m_Step = 1.0 + m_Drift;
+}
+
+
+//
+//  DriftTracker::update(...) - add one callback's depth
+//
+double DriftTracker::update(size_t depth, size_t count) {
+	const double y = depth;
+
+	// a step above one writes (step - 1) fewer samples per sample
+	m_Played += count;
+	m_Held += (m_Step - 1.0) * count;
+	m_N += 1;
+	m_SumX += m_Played;
+	m_SumY += y;
+	m_SumU += y + m_Held;
+	m_Depth = (m_Depth < 0) ? y : m_Depth + (y - m_Depth) * std::min(1.0, count / (DRIFT_DEPTH_TAU_SEC * m_Rate));
+
+	if (m_N * count >= DRIFT_WINDOW_SEC * m_Rate) {
+		if (!m_Locked) {
+			m_Target = m_SumY / m_N;
+			m_Locked = true;
+		}
+
+		// add this window to the trend, dropping the oldest
+		if (m_Points == DRIFT_HISTORY) {
+			std::copy(m_X + 1, m_X + DRIFT_HISTORY, m_X);
+			std::copy(m_U + 1, m_U + DRIFT_HISTORY, m_U);
+			--m_Points;
+		}
+		m_X[m_Points] = m_SumX / m_N;
+		m_U[m_Points] = m_SumU / m_N;
+		++m_Points;
+		m_N = m_SumX = m_SumY = m_SumU = 0;
+
+		if (m_Points > 1) {
+			const double drift = (m_U[m_Points - 1] - m_U[0]) / (m_X[m_Points - 1] - m_X[0]);
+			m_Drift = std::max(-DRIFT_MAX_PPM * 1e-6, std::min(DRIFT_MAX_PPM * 1e-6, drift));
+			++m_Estimates;
+		}
+	}
+
+	// the estimate, and a pull toward the target depth; the pull sees
+	//    the smoothed depth, so the step does not follow each frame
+	double step = 1.0 + m_Drift;
+	if (m_Locked)
+		step += (m_Depth - m_Target) / (DRIFT_RECOVERY_SEC * m_Rate);
+	m_Step = std::max(1.0 - DRIFT_MAX_PPM * 1e-6, std::min(1.0 + DRIFT_MAX_PPM * 1e-6, step));
+	return m_Step;
+}
+
+// EOF
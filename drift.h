@@ -0,0 +1,124 @@
+/*
+ *
+ *
+ *    drift.h
+ *
+ *    DriftTracker class: sample clock drift, from the output buffer depth.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_DRIFT_H
+#define __FDVCORE_DRIFT_H
+
+#include <stdint.h>
+#include <cstddef>
+
+// seconds of buffer depth averaged into each point of the trend
+#define DRIFT_WINDOW_SEC 30
+
+// the number of points kept; the trend spans up to this many windows
+#define DRIFT_HISTORY 10
+
+// the time over which a depth error is pulled back to the target
+#define DRIFT_RECOVERY_SEC 60
+
+// the time constant of the depth that the pull toward the target
+//    sees, long enough to smooth over whole modem frames
+#define DRIFT_DEPTH_TAU_SEC 2
+
+// the largest correction, in ppm
+#define DRIFT_MAX_PPM 1000
+
+
+//
+//  DriftTracker - estimates the rate at which audio arrives for the
+//                 output buffer, relative to the rate the card plays it,
+//                 and the resampling step that holds the buffer depth
+//
+//  The audio thread calls update() once per callback, with the depth
+//  left after the card took its samples.  Adding back the samples that
+//  the resampler has held back (or taking out those it added) gives the
+//  depth as it would have been uncorrected, which grows by the drift.
+//  That depth is averaged over each DRIFT_WINDOW_SEC, and the drift is
+//  its rise from the oldest window kept to the newest.  The modem fills
+//  the buffer a frame at a time, so the depth is only a coarse measure
+//  at any moment; a long baseline is what makes it fine.
+//
+//  The first window also sets the target depth, and the step adds a
+//  small term to return the smoothed depth to it.
+//
+//  All members are for the audio thread.
+//
+class DriftTracker {
+	private:
+		const double m_Rate;
+
+		// samples played, and held back by the resampler, since restart
+		double m_Played;
+		double m_Held;
+
+		// the current window: played, depth, and uncorrected depth
+		double m_N;
+		double m_SumX;
+		double m_SumY;
+		double m_SumU;
+
+		// the mean played (x) and uncorrected depth (u) of past windows
+		double m_X[DRIFT_HISTORY];
+		double m_U[DRIFT_HISTORY];
+		size_t m_Points;
+
+		// the depth, averaged over DRIFT_DEPTH_TAU_SEC
+		double m_Depth;
+
+		// the result
+		bool m_Locked;
+		double m_Target;
+		double m_Drift;
+		uint64_t m_Estimates;
+		double m_Step;
+
+	public:
+		DriftTracker(unsigned rate);
+
+	public:
+		// drop the trend and the target, keeping the estimate, e.g.,
+		//    when the buffer is refilled from scratch
+		void reset();
+
+		// drop the trend only, e.g., after samples were lost
+		void restart();
+
+		// add one callback's depth, after 'count' samples were played;
+		//    returns the new resampling step, in samples in per sample
+		//    written to the buffer
+		double update(size_t depth, size_t count);
+
+		// the estimate, in ppm: positive when audio arrives faster than
+		//    the card plays it
+		double ppm() const {
+			return 1e6 * m_Drift;
+		}
+
+		// the depth held, in samples, or zero before the first window
+		double target() const {
+			return m_Locked ? m_Target : 0;
+		}
+
+		// the number of estimates made
+		uint64_t estimates() const {
+			return m_Estimates;
+		}
+
+		double step() const {
+			return m_Step;
+		}
+};
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ *
+ *
+ *    fdvband.cc
+ *
+ *    Band monitor: splits one wideband input into 8kHz channels with a
+ *    polyphase channelizer, and runs a FreeDV receiver on every channel,
+ *    in parallel, reporting decoded audio, text, and stats per channel.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <complex>
+#include <string>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <codec2/freedv_api.h>
+#include "stype.h"
+#include "localtypes.h"
+#include "modems.h"
+#include "Channelizer.h"
+#include "WorkStealingPool.h"
+
+// input read per pass, in seconds; each channel is decoded in one task
+#define BAND_BLOCK_SECONDS 0.1
+
+// the most received text kept per channel
+#define BAND_TEXT_LEN 64
+
+
+//
+//  one narrow channel, and its receiver
+//
+struct band_channel {
+	size_t index;
+	double center;                // Hz, relative to the input center
+	freedv *fdv;
+	FILE *audio;
+
+	// USB demodulator: shifts the channel center up to the audio center
+	std::complex<double> nco;
+	std::complex<double> step;
+
+	// modem input and output
+	std::vector<short> demod;
+	size_t fill;
+	std::vector<short> speech;
+
+	// stats
+	uint64_t frames;
+	uint64_t syncFrames;
+	double snrSum;
+	std::string text;
+};
+
+
+//
+//  the channelized samples for one block, one vector per channel
+//
+typedef std::vector<std::vector<std::complex<float> > > band_block;
+
+
+//
+//  receive text callback
+//
+static void rxText(void *state, char c) {
+	band_channel *ch = static_cast<band_channel*>(state);
+	if (c == '\r' || c == '\n')
+		c = ' ';
+	if (c < ' ' || c > '~')
+		return;
+	ch->text += c;
+	if (ch->text.size() > BAND_TEXT_LEN)
+		ch->text.erase(0, ch->text.size() - BAND_TEXT_LEN);
+}
+
+
+/*
+ *
+ *   decode(...) - demodulate and decode one block of one channel
+ *
+ */
+static void decode(band_channel &ch, const std::vector<std::complex<float> > &samples) {
+	for (size_t i = 0; i != samples.size(); ++i) {
+		// complex baseband to real audio, centered on the modem
+		const std::complex<double> z = std::complex<double>(samples[i]) * ch.nco;
+		ch.nco *= ch.step;
+		double s = SHRT_MAX * z.real();
+		if (s > SHRT_MAX) s = SHRT_MAX;
+		if (s < -SHRT_MAX) s = -SHRT_MAX;
+		ch.demod[ch.fill++] = static_cast<short>(s);
+
+		const size_t nin = freedv_nin(ch.fdv);
+		if (ch.fill < nin)
+			continue;
+		const int nout = freedv_rx(ch.fdv, &ch.speech[0], &ch.demod[0]);
+		memmove(&ch.demod[0], &ch.demod[nin], (ch.fill - nin) * sizeof(short));
+		ch.fill -= nin;
+
+		int sync = 0;
+		float snr = 0;
+		freedv_get_modem_stats(ch.fdv, &sync, &snr);
+		++ch.frames;
+		if (sync) {
+			++ch.syncFrames;
+			ch.snrSum += snr;
+		}
+		if (ch.audio && nout > 0)
+			fwrite(&ch.speech[0], sizeof(short), nout, ch.audio);
+	}
+
+	// keep the oscillator on the unit circle
+	ch.nco /= std::abs(ch.nco);
+}
+
+
+/*
+ *
+ *   report(...) - print the per-channel table
+ *
+ */
+static void report(std::ostream &os, const std::vector<band_channel*> &channels, double seconds) {
+	os << "after " << std::fixed << std::setprecision(1) << seconds << " s:" << std::endl;
+	os << std::right << std::setw(4) << "CH" << std::setw(10) << "OFFSET" << std::setw(8) << "FRAMES"
+	   << std::setw(7) << "SYNC%" << std::setw(7) << "SNR" << "  TEXT" << std::endl;
+	for (size_t i = 0; i != channels.size(); ++i) {
+		const band_channel &ch = *channels[i];
+		os << std::setw(4) << ch.index
+		   << std::setw(10) << std::setprecision(0) << ch.center
+		   << std::setw(8) << ch.frames
+		   << std::setw(7) << std::setprecision(1) << (ch.frames ? (100.0 * ch.syncFrames / ch.frames) : 0.0)
+		   << std::setw(7) << (ch.syncFrames ? (ch.snrSum / ch.syncFrames) : 0.0)
+		   << "  " << ch.text << std::endl;
+	}
+}
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvband [options] <modem> <rate>" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       <modem>     - the Codec2 modem { " FDV_MODES  " }" << std::endl;
+	std::cerr <<  "       <rate>      - input rate; " << MODEM_FS << " times a power of two, giving" << std::endl;
+	std::cerr <<  "                     that many channels, " << MODEM_FS << " Hz apart" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -i <file>   - raw S16 input (default stdin)" << std::endl;
+	std::cerr <<  "       -q          - input is interleaved I/Q; otherwise real" << std::endl;
+	std::cerr <<  "       -c <list>   - comma-separated channel numbers (default: all)" << std::endl;
+	std::cerr <<  "       -a <Hz>     - modem center in the decoded audio (default 1500)" << std::endl;
+	std::cerr <<  "       -o <dir>    - write decoded 8kHz S16 speech to <dir>/ch<n>.raw" << std::endl;
+	std::cerr <<  "       -s <sec>    - print the channel table every <sec> seconds of input" << std::endl;
+	std::cerr <<  "       -j <n>      - worker threads (default: all cores)" << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	std::string inPath, outDir, list;
+	bool iq = false;
+	double audioCenter = 1500;
+	double interval = 0;
+	unsigned threads = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "i:qc:a:o:s:j:")) != -1) {
+		switch (opt) {
+			case 'i': inPath = optarg; break;
+			case 'q': iq = true; break;
+			case 'c': list = optarg; break;
+			case 'a': audioCenter = atof(optarg); break;
+			case 'o': outDir = optarg; break;
+			case 's': interval = atof(optarg); break;
+			case 'j': threads = atoi(optarg); break;
+			default: usage(); return 1;
+		}
+	}
+	if (argc - optind != 2) {
+		usage();
+		return 1;
+	}
+
+	const int modem = parseModem(argv[optind]);
+	const unsigned rate = atoi(argv[optind + 1]);
+	const size_t M = rate / MODEM_FS;
+	if (modem == -1 || M < 2 || rate % MODEM_FS || (M & (M - 1))) {
+		usage();
+		return 1;
+	}
+
+	// the input
+	int fd = STDIN_FILENO;
+	if (!inPath.empty() && inPath != "-") {
+		fd = open(inPath.c_str(), O_RDONLY);
+		if (fd < 0) {
+			std::cerr << "Could not open " << inPath << std::endl;
+			return 1;
+		}
+	}
+
+	// the channels
+	std::vector<size_t> wanted;
+	if (list.empty()) {
+		for (size_t k = 0; k != M; ++k)
+			wanted.push_back(k);
+	} else {
+		std::stringstream ss(list);
+		std::string item;
+		while (std::getline(ss, item, ',')) {
+			const int k = atoi(my::strip(item).c_str());
+			if (k < 0 || static_cast<size_t>(k) >= M) {
+				std::cerr << "No channel " << item << std::endl;
+				return 1;
+			}
+			wanted.push_back(k);
+		}
+	}
+
+	KK5JY::DSP::Channelizer<float> bank(M);
+	std::vector<band_channel*> channels;
+	for (size_t i = 0; i != wanted.size(); ++i) {
+		band_channel *ch = new band_channel;
+		ch->index = wanted[i];
+		ch->center = bank.center(wanted[i]) * rate;
+		ch->fdv = freedv_open(modem);
+		if (!ch->fdv) {
+			std::cerr << "Could not start the modem" << std::endl;
+			return 1;
+		}
+		freedv_set_callback_txt(ch->fdv, &rxText, 0, ch);
+		ch->audio = 0;
+		if (!outDir.empty()) {
+			std::stringstream path;
+			path << outDir << "/ch" << ch->index << ".raw";
+			ch->audio = fopen(path.str().c_str(), "wb");
+			if (!ch->audio) {
+				std::cerr << "Could not open " << path.str() << std::endl;
+				return 1;
+			}
+		}
+		ch->nco = 1.0;
+		ch->step = std::polar(1.0, 2.0 * M_PI * audioCenter / MODEM_FS);
+		ch->demod.resize(freedv_get_n_max_modem_samples(ch->fdv));
+		ch->fill = 0;
+		ch->speech.resize(freedv_get_n_speech_samples(ch->fdv));
+		ch->frames = ch->syncFrames = 0;
+		ch->snrSum = 0;
+		channels.push_back(ch);
+	}
+
+	// channelize one block while the pool decodes the one before it
+	const size_t outputs = static_cast<size_t>(BAND_BLOCK_SECONDS * MODEM_FS);
+	const size_t inputs = outputs * M;
+	const size_t width = iq ? 2 : 1;
+	std::vector<int16_t> raw(inputs * width);
+	band_block blocks[2];
+	for (int b = 0; b != 2; ++b) {
+		blocks[b].resize(channels.size());
+		for (size_t i = 0; i != channels.size(); ++i)
+			blocks[b][i].reserve(outputs);
+	}
+
+	WorkStealingPool pool(threads);
+	int current = 0;
+	bool busy = false;
+	uint64_t samples = 0;
+	double nextReport = interval;
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	for (;;) {
+		// read one block, or whatever is left of the input
+		size_t got = 0;
+		const size_t want = raw.size() * sizeof(int16_t);
+		while (got < want) {
+			const ssize_t n = read(fd, reinterpret_cast<char*>(&raw[0]) + got, want - got);
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		const size_t count = got / (width * sizeof(int16_t));
+		if (count == 0)
+			break;
+
+		band_block &block = blocks[current];
+		for (size_t i = 0; i != block.size(); ++i)
+			block[i].clear();
+		for (size_t n = 0; n != count; ++n) {
+			const std::complex<float> x(
+				static_cast<float>(raw[n * width]) / SHRT_MAX,
+				iq ? static_cast<float>(raw[n * width + 1]) / SHRT_MAX : 0.0f);
+			if (!bank.write(x))
+				continue;
+			const std::complex<float> *y = bank.output();
+			for (size_t i = 0; i != channels.size(); ++i)
+				block[i].push_back(y[channels[i]->index]);
+		}
+		samples += count;
+
+		// hand the block to the pool, once it has finished the last one
+		if (busy)
+			pool.wait();
+		for (size_t i = 0; i != channels.size(); ++i) {
+			band_channel *ch = channels[i];
+			const std::vector<std::complex<float> > *s = &block[i];
+			pool.submit([ch, s]() { decode(*ch, *s); });
+		}
+		busy = true;
+		current ^= 1;
+
+		if (interval > 0 && static_cast<double>(samples) / rate >= nextReport) {
+			pool.wait();
+			busy = false;
+			report(std::cerr, channels, static_cast<double>(samples) / rate);
+			nextReport += interval;
+		}
+		if (got < want)
+			break;
+	}
+	pool.wait();
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	report(std::cout, channels, static_cast<double>(samples) / rate);
+	std::cout << "channels: " << channels.size() << ", threads: " << pool.threads()
+	          << ", steals: " << pool.steals() << ", speed: "
+	          << std::setprecision(1) << (wall > 0 ? (samples / static_cast<double>(rate)) / wall : 0) << "x real time" << std::endl;
+
+	for (size_t i = 0; i != channels.size(); ++i) {
+		freedv_close(channels[i]->fdv);
+		if (channels[i]->audio)
+			fclose(channels[i]->audio);
+		delete channels[i];
+	}
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return 0;
+}
+
+// EOF
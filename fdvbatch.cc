@@ -0,0 +1,392 @@
+/*
+ *
+ *
+ *    fdvbatch.cc
+ *
+ *    Batch decoder: runs a directory (or list) of WAV recordings through
+ *    the SoundCardDV receive chain on every core, writing the decoded
+ *    audio, received text, and a per-frame modem log for each file.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+#include "stype.h"
+#include "localtypes.h"
+#include "scdv.h"
+#include "modems.h"
+
+// frames per callback at CARD_FS, same as fdvcore; scaled for other rates
+#define BATCH_WINDOW_SIZE (512)
+
+// files waiting for a worker, per worker
+#define BATCH_QUEUE_DEPTH 2
+
+
+//
+//  batch_queue - bounded queue of input paths
+//
+//  The producer blocks when the queue is full, so that a large archive
+//  is listed only as fast as it is decoded.
+//
+class batch_queue {
+	private:
+		std::deque<std::string> m_Items;
+		const size_t m_Limit;
+		std::mutex m_Lock;
+		std::condition_variable m_NotFull;
+		std::condition_variable m_NotEmpty;
+		bool m_Closed;
+
+	public:
+		batch_queue(size_t limit) : m_Limit(limit), m_Closed(false) { }
+
+		// add a path, waiting for room
+		void push(const std::string &path) {
+			std::unique_lock<std::mutex> l(m_Lock);
+			m_NotFull.wait(l, [this]() { return m_Items.size() < m_Limit; });
+			m_Items.push_back(path);
+			m_NotEmpty.notify_one();
+		}
+
+		// take a path; false once closed and empty
+		bool pop(std::string &path) {
+			std::unique_lock<std::mutex> l(m_Lock);
+			m_NotEmpty.wait(l, [this]() { return !m_Items.empty() || m_Closed; });
+			if (m_Items.empty())
+				return false;
+			path = m_Items.front();
+			m_Items.pop_front();
+			m_NotFull.notify_one();
+			return true;
+		}
+
+		// no more paths
+		void close() {
+			std::lock_guard<std::mutex> l(m_Lock);
+			m_Closed = true;
+			m_NotEmpty.notify_all();
+		}
+};
+
+
+//
+//  the results of one file
+//
+struct batch_result {
+	double audio;        // seconds
+	uint64_t frames;
+	uint64_t syncFrames;
+	double snrSum;
+	size_t textLength;
+};
+
+
+//
+//  shared state
+//
+static int s_Modem;
+static std::string s_OutDir;
+static std::mutex s_Report;
+static double s_Audio = 0;
+static size_t s_Files = 0;
+static size_t s_Failed = 0;
+
+
+/*
+ *
+ *   outputBase(...) - the output path, less extension, for an input
+ *
+ */
+static std::string outputBase(const std::string &path) {
+	std::string name = path;
+	const size_t dot = name.rfind('.');
+	if (dot != std::string::npos && name.find('/', dot) == std::string::npos)
+		name.erase(dot);
+	if (s_OutDir.empty())
+		return name;
+	const size_t slash = name.rfind('/');
+	return s_OutDir + "/" + ((slash == std::string::npos) ? name : name.substr(slash + 1));
+}
+
+
+/*
+ *
+ *   decodeFile(...) - run one recording through the receive chain;
+ *                     throws local_exception on failure
+ *
+ */
+static batch_result decodeFile(const std::string &path) {
+	batch_result result;
+	memset(&result, 0, sizeof(result));
+
+	SF_INFO info;
+	memset(&info, 0, sizeof(info));
+	SNDFILE *input = sf_open(path.c_str(), SFM_READ, &info);
+	if (!input)
+		throw local_exception(std::string("Could not open: ") + sf_strerror(0));
+	if (info.samplerate < MODEM_FS || info.samplerate % MODEM_FS) {
+		sf_close(input);
+		throw local_exception("The sample rate must be a multiple of the modem rate");
+	}
+	const unsigned rate = info.samplerate;
+	const int chFile = info.channels;
+	const size_t win = (BATCH_WINDOW_SIZE * rate) / CARD_FS;
+
+	// the outputs
+	const std::string base = outputBase(path);
+	SF_INFO oinfo;
+	memset(&oinfo, 0, sizeof(oinfo));
+	oinfo.samplerate = rate;
+	oinfo.channels = 1;
+	oinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+	SNDFILE *output = sf_open((base + ".dec.wav").c_str(), SFM_WRITE, &oinfo);
+	if (!output) {
+		sf_close(input);
+		throw local_exception("Could not open " + base + ".dec.wav");
+	}
+	std::ofstream text((base + ".txt").c_str());
+	std::ofstream log((base + ".csv").c_str());
+	if (!text || !log) {
+		sf_close(input);
+		sf_close(output);
+		throw local_exception("Could not open " + base + ".txt or .csv");
+	}
+	log << "frame,seconds,sync,snr,df" << std::endl;
+
+	// the chain, on a virtual card with the file's layout
+	SoundCardDV *dv = 0;
+	try {
+		VirtualCard vc(chFile, 1);
+		dv = new SoundCardDV(s_Modem, 0, win, &vc, rate);
+		dv->mode(ModesDV::RX);
+	} catch (const local_exception &) {
+		sf_close(input);
+		sf_close(output);
+		throw;
+	}
+
+	// stream the file one window at a time
+	std::vector<float> inBuf(win * chFile);
+	std::vector<float> outBuf(win);
+	uint64_t samples = 0, lastModemFrames = 0;
+	for (;;) {
+		const sf_count_t got = sf_readf_float(input, &inBuf[0], win);
+		if (got <= 0)
+			break;
+		std::fill(inBuf.begin() + got * chFile, inBuf.end(), 0.0f);
+
+		dv->drive(&inBuf[0], &outBuf[0], win);
+		sf_writef_float(output, &outBuf[0], got);
+		samples += got;
+
+		// the modem stats only change when a modem frame runs
+		if (dv->modemFrames() != lastModemFrames) {
+			lastModemFrames = dv->modemFrames();
+			const basic_stats bs = dv->stats();
+			log << lastModemFrames << ','
+			    << std::fixed << std::setprecision(3) << static_cast<double>(samples) / rate << ','
+			    << (bs.sync ? 1 : 0) << ',' << std::setprecision(1) << bs.snr << ','
+			    << dv->df() << '\n';
+			if (bs.sync) {
+				++result.syncFrames;
+				result.snrSum += bs.snr;
+			}
+		}
+
+		const std::string rx = dv->receivedText();
+		text << rx;
+		result.textLength += rx.size();
+	}
+	result.frames = dv->modemFrames();
+	result.audio = static_cast<double>(samples) / rate;
+
+	delete dv;
+	sf_close(input);
+	sf_close(output);
+	return result;
+}
+
+
+/*
+ *
+ *   worker(...) - decode files from the queue until it closes
+ *
+ */
+static void worker(batch_queue *queue) {
+	std::string path;
+	while (queue->pop(path)) {
+		try {
+			const batch_result r = decodeFile(path);
+			std::lock_guard<std::mutex> l(s_Report);
+			++s_Files;
+			s_Audio += r.audio;
+			std::cout << path << ": " << std::fixed << std::setprecision(1) << r.audio << " s, "
+			          << r.frames << " frames, "
+			          << (r.frames ? (100.0 * r.syncFrames / r.frames) : 0.0) << "% sync, SNR "
+			          << (r.syncFrames ? (r.snrSum / r.syncFrames) : 0.0) << " dB, "
+			          << r.textLength << " chars" << std::endl;
+		} catch (const local_exception &e) {
+			std::lock_guard<std::mutex> l(s_Report);
+			++s_Failed;
+			std::cerr << path << ": " << e.what() << std::endl;
+		}
+	}
+}
+
+
+/*
+ *
+ *   isWav(...) - true if 'name' ends in .wav, any case
+ *
+ */
+static bool isWav(const std::string &name) {
+	return name.size() > 4 && my::toUpper(name.substr(name.size() - 4)) == ".WAV";
+}
+
+
+/*
+ *
+ *   enqueue(...) - queue a file, or the WAV files in a directory
+ *
+ */
+static void enqueue(batch_queue &queue, const std::string &path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		std::lock_guard<std::mutex> l(s_Report);
+		++s_Failed;
+		std::cerr << path << ": not found" << std::endl;
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		queue.push(path);
+		return;
+	}
+
+	DIR *dir = opendir(path.c_str());
+	if (!dir) {
+		std::lock_guard<std::mutex> l(s_Report);
+		++s_Failed;
+		std::cerr << path << ": could not read directory" << std::endl;
+		return;
+	}
+	std::vector<std::string> names;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != 0) {
+		const std::string name = entry->d_name;
+		if (isWav(name) && name.find(".dec.") == std::string::npos)
+			names.push_back(name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	for (size_t i = 0; i != names.size(); ++i)
+		queue.push(path + "/" + names[i]);
+}
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvbatch [options] <modem> <path> [<path> ...]" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       <modem>     - the Codec2 modem { " FDV_MODES  " }" << std::endl;
+	std::cerr <<  "       <path>      - a WAV recording, or a directory of them; '-' reads" << std::endl;
+	std::cerr <<  "                     more paths from stdin, one per line" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -o <dir>    - write the outputs to <dir> (default: beside each input)" << std::endl;
+	std::cerr <<  "       -j <n>      - files decoded at once (default: all cores)" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       For each <name>.wav, writes <name>.dec.wav (decoded speech)," << std::endl;
+	std::cerr <<  "       <name>.txt (received text), and <name>.csv (per-frame sync/SNR)." << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	unsigned jobs = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:j:")) != -1) {
+		switch (opt) {
+			case 'o': s_OutDir = optarg; break;
+			case 'j': jobs = atoi(optarg); break;
+			default: usage(); return 1;
+		}
+	}
+	if (argc - optind < 2) {
+		usage();
+		return 1;
+	}
+	s_Modem = parseModem(argv[optind]);
+	if (s_Modem == -1) {
+		usage();
+		return 1;
+	}
+	if (jobs == 0)
+		jobs = std::thread::hardware_concurrency();
+	if (jobs == 0)
+		jobs = 1;
+
+	batch_queue queue(BATCH_QUEUE_DEPTH * jobs);
+	std::vector<std::thread> workers;
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i != jobs; ++i)
+		workers.push_back(std::thread(worker, &queue));
+
+	// list the inputs as the workers take them
+	for (int i = optind + 1; i != argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "-") {
+			std::string line;
+			while (std::getline(std::cin, line)) {
+				line = my::strip(line);
+				if (!line.empty())
+					enqueue(queue, line);
+			}
+		} else {
+			enqueue(queue, arg);
+		}
+	}
+	queue.close();
+	for (size_t i = 0; i != workers.size(); ++i)
+		workers[i].join();
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	// summary
+	std::cout << "files:        " << s_Files << " decoded, " << s_Failed << " failed" << std::endl;
+	std::cout << "audio time:   " << std::setprecision(2) << s_Audio / 3600 << " h" << std::endl;
+	std::cout << "wall time:    " << std::setprecision(1) << wall << " s, " << jobs << " jobs" << std::endl;
+	std::cout << "throughput:   " << std::setprecision(2) << (wall > 0 ? (s_Audio / 3600) / (wall / 60) : 0)
+	          << " audio-hours per minute" << std::endl;
+	return s_Failed ? 1 : 0;
+}
+
+// EOF
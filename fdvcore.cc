@@ -17,24 +17,840 @@
 
 
 #include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
 #include <cstring>
+#include <cerrno>
 #include <string>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
 #include "stype.h"
 #include "localtypes.h"
 #include "SplitCommand.h"
+#include "binproto.h"
 #include "scdv.h"
-
-#ifdef FREEDV_MODE_700D
-#define FDV_MODES "1600, 800XA, 700, 700B, 700C, 700D"
-#else
-#define FDV_MODES "1600, 800XA, 700, 700B, 700C"
-#endif
+#include "backend.h"
+#include "modems.h"
 
 // this determines the number of frames that will be processed
 //   per sound card event cycle
 #define SCDV_WINDOW_SIZE (512)
 
 
+/*
+ *
+ *   toHex(...)
+ *
+ */
+static std::string toHex(const std::vector<uint8_t> &data) {
+	static const char digits[] = "0123456789ABCDEF";
+	std::string result;
+	result.reserve(2 * data.size());
+	for (size_t i = 0; i != data.size(); ++i) {
+		result += digits[data[i] >> 4];
+		result += digits[data[i] & 0x0F];
+	}
+	return result;
+}
+
+
+/*
+ *
+ *   waitInput(...) - wait for 'fd' to be readable; returns false instead
+ *                    if the card's (finite) audio source runs out first
+ *
+ */
+static bool waitInput(int fd, const SoundCard *card) {
+	for (;;) {
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		const int rc = poll(&pfd, 1, 200);
+		if (rc > 0 || (rc < 0 && errno != EINTR))
+			return true; // ready, or an error for the reader to find
+		if (card->backend() && card->backend()->finished())
+			return false;
+	}
+}
+
+
+/*
+ *
+ *   openControl(...) - open the command channel:
+ *
+ *      fd:<n>       - an inherited descriptor, e.g., '3<>control.fifo'
+ *      unix:<path>  - a local stream socket; waits for one client
+ *
+ *   Returns the descriptor, or -1 on failure.
+ *
+ */
+static int openControl(const std::string &spec, const SoundCard *card) {
+	if (spec.compare(0, 3, "fd:") == 0) {
+		const int fd = atoi(spec.c_str() + 3);
+		return (fd > STDERR_FILENO) ? fd : -1;
+	}
+	if (spec.compare(0, 5, "unix:") != 0)
+		return -1;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	const std::string path = spec.substr(5);
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path.c_str());
+
+	const int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+	unlink(path.c_str());
+	if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(s, 1) < 0) {
+		close(s);
+		return -1;
+	}
+	Logger::message(LogInfo, "waiting for a controller on " + path);
+	int result = -1;
+	if (waitInput(s, card))
+		result = accept(s, 0, 0);
+	close(s);
+	unlink(path.c_str());
+	return result;
+}
+
+
+//
+//  control_state - the state of one control session
+//
+struct control_state {
+	// the last POWER sample: process CPU time, context switches, callbacks
+	std::chrono::steady_clock::time_point powerTime;
+	double powerCpu;
+	uint64_t powerSwitches;
+	uint64_t powerFrames;
+
+	// true once the client has switched to binary framing
+	bool binary;
+
+	// true once a binary client has asked to quit
+	bool quit;
+};
+
+
+/*
+ *
+ *   command(...) - run one text command, writing the reply to 'os';
+ *                  returns false if the command ends the session
+ *
+ */
+static bool command(SoundCardDV *adc, std::string line, std::ostream &os, control_state &st) {
+	std::string cmd, arg;
+
+	// trim off whitespace
+	line = my::strip(line);
+
+	// split the command (in upper case) from the argument (if any)
+	SplitCommand(line, cmd, arg);
+
+	// COMMAND: QUIT
+	if (cmd == "QUIT") {
+		return false;
+	} else 
+
+	// COMMAND: PROTO - switch this channel to binary framing (see binproto.h)
+	if (cmd == "PROTO") {
+		if (arg.empty()) {
+			os << "OK:PROTO=" << (st.binary ? "BIN" : "TEXT") << std::endl;
+			return true;
+		}
+		if (st.binary || my::toUpper(arg) != "BIN") goto no_good;
+		st.binary = true;
+		os << "OK:PROTO=BIN" << std::endl;
+		return true;
+	} else 
+
+	// COMMAND: QUIT
+	if (cmd == "VERSION") {
+		os << "OK:VERSION=" << VERSION_TEXT << std::endl;
+		return true;
+	} else 
+
+	// COMMAND: TEXT
+	if (cmd == "TEXT") {
+		if (arg.empty()) {
+			os << "OK:TEXT=" << adc->text() << std::endl;
+			return true;
+		} else {
+			adc->text(arg);
+			os << "OK:TEXT=" << arg << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: TEXTQ - queue a one-shot text message
+	if (cmd == "TEXTQ") {
+		if (arg.empty()) {
+			os << "OK:TEXTQ=" << adc->queuedText() << std::endl;
+			return true;
+		} else {
+			if (!adc->queueText(arg)) goto no_good;
+			os << "OK:TEXTQ=" << arg << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: RXTEXT - text received since the last RXTEXT
+	if (cmd == "RXTEXT" && arg.empty()) {
+		std::string rx = adc->receivedText();
+		std::replace(rx.begin(), rx.end(), '\r', ' ');
+		std::replace(rx.begin(), rx.end(), '\n', ' ');
+		os << "OK:RXTEXT=" << rx << std::endl;
+		return true;
+	} else 
+
+	// COMMAND: CLIP CHECK
+	if (cmd == "CLIP") {
+		if (arg.empty()) {
+			os << "OK:CLIP=" << static_cast<int>(adc->clipped()) << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: LEVELS - input and output peak/RMS (dBFS) and clip counts
+	if (cmd == "LEVELS") {
+		if (arg.empty()) {
+			const KK5JY::DSP::LevelMeter &li = adc->inputLevel();
+			const KK5JY::DSP::LevelMeter &lo = adc->outputLevel();
+			os << "OK:LEVELS="
+			          << li.peakDb() << ':' << li.rmsDb() << ':' << li.clips() << ':'
+			          << lo.peakDb() << ':' << lo.rmsDb() << ':' << lo.clips() << ':'
+			          << adc->modemClips() << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: FRAME COUNT
+	if (cmd == "FRAMES") {
+		if (arg.empty()) {
+			os << "OK:FRAMES=" << adc->frames() << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: SQUELCH ENABLE
+	if (cmd == "SQEN") {
+		if (arg.empty()) {
+			os << "OK:SQEN=" << static_cast<int>(adc->squelch()) << std::endl;
+			return true;
+		} else {
+			int value = atoi(arg.c_str()) ? 1 : 0;
+			adc->squelch(value);
+			os << "OK:SQEN=" << value << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: SQUELCH THRESHOLD
+	if (cmd == "SQTH") {
+		if (arg.empty()) {
+			os << "OK:SQTH=" << adc->threshold() << std::endl;
+			return true;
+		} else {
+			float value = atof(arg.c_str());
+			adc->threshold(value);
+			os << "OK:SQTH=" << value << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: GATE - skip the demodulator below a level (dBFS)
+	if (cmd == "GATE") {
+		if (arg.empty()) {
+			float level = 0;
+			if (adc->gateLevel(level))
+				os << "OK:GATE=" << level << std::endl;
+			else
+				os << "OK:GATE=OFF" << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "OFF") {
+			adc->gateOff();
+			os << "OK:GATE=OFF" << std::endl;
+			return true;
+		} else {
+			float value = atof(arg.c_str());
+			if (value > 0) goto no_good;
+			if (!adc->gateOn(value)) goto no_good;
+			os << "OK:GATE=" << value << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: FILTER - the decimation and interpolation filter design
+	if (cmd == "FILTER") {
+		float pass = 0, atten = 0;
+		std::string window;
+		double macs = 0;
+		adc->filterDesign(pass, atten, window, macs);
+		if (!arg.empty()) {
+			// <pass>[,<atten>[,<window>]]; what is left out is kept
+			const size_t c1 = arg.find(',');
+			const size_t c2 = (c1 == std::string::npos) ? c1 : arg.find(',', c1 + 1);
+			pass = atof(arg.substr(0, c1).c_str());
+			if (c1 != std::string::npos)
+				atten = atof(arg.substr(c1 + 1, c2 - c1 - 1).c_str());
+			if (c2 != std::string::npos)
+				window = my::toUpper(arg.substr(c2 + 1));
+			if (!adc->filter(pass, atten, window)) goto no_good;
+			adc->filterDesign(pass, atten, window, macs);
+		}
+		os << "OK:FILTER=" << pass << ',' << atten << ',' << window << ',' << macs << std::endl;
+		return true;
+	}
+
+	// COMMAND: RXFILTER - band-pass ahead of the demodulator
+	if (cmd == "RXFILTER") {
+		float low = 0, high = 0;
+		size_t taps = RXFILTER_TAPS;
+		bool fast = false;
+		if (arg.empty()) {
+			if (adc->rxFilter(low, high, taps, fast))
+				os << "OK:RXFILTER=" << low << ',' << high << ',' << taps << ',' << (fast ? "FFT" : "DIRECT") << std::endl;
+			else
+				os << "OK:RXFILTER=OFF" << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "OFF") {
+			adc->rxFilterOff();
+			os << "OK:RXFILTER=OFF" << std::endl;
+			return true;
+		} else {
+			// <low>,<high>[,<taps>]
+			const size_t c1 = arg.find(',');
+			if (c1 == std::string::npos) goto no_good;
+			const size_t c2 = arg.find(',', c1 + 1);
+			low = atof(arg.substr(0, c1).c_str());
+			high = atof(arg.substr(c1 + 1, c2 - c1 - 1).c_str());
+			if (c2 != std::string::npos)
+				taps = atoi(arg.substr(c2 + 1).c_str());
+			if (!adc->rxFilterOn(low, high, taps)) goto no_good;
+			adc->rxFilter(low, high, taps, fast);
+			os << "OK:RXFILTER=" << low << ',' << high << ',' << taps << ',' << (fast ? "FFT" : "DIRECT") << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: MEASURE_LATENCY - the round trip through a loopback
+	//          cable, by chirp, as <ms>:<correlation>; or, with
+	//          =PIPELINE, the latency of each internal stage, in ms
+	if (cmd == "MEASURE_LATENCY") {
+		if (arg.empty()) {
+			double ms = 0, quality = 0;
+			if (!adc->measureLatency(ms, quality)) goto no_good;
+			os << "OK:MEASURE_LATENCY=" << ms << ':' << quality << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "PIPELINE") {
+			pipeline_latency p;
+			adc->pipelineLatency(p);
+			os << "OK:MEASURE_LATENCY=PIPELINE:" << p.total << ':' << p.card << ':'
+			          << p.decimator << ':' << p.rx_filter << ':' << p.in_buffer << ':'
+			          << p.frame << ':' << p.out_buffer << ':' << p.interpolator << std::endl;
+			return true;
+		}
+		goto no_good;
+	}
+
+	// COMMAND: LOG - the log level; the reply is
+	//          <level>:<target>:<lost>:<suppressed>
+	if (cmd == "LOG") {
+		if (!arg.empty()) {
+			LogLevels l;
+			if (!Logger::parse(my::toUpper(arg), l)) goto no_good;
+			Logger::level(l);
+		}
+		os << "OK:LOG=" << Logger::name(Logger::level()) << ':' << Logger::target() << ':'
+		          << Logger::lost() << ':' << Logger::suppressed() << std::endl;
+		return true;
+	}
+
+	// COMMAND: DRIFT - sample clock drift correction; the reply is
+	//          <ON|OFF>:<rx ppm>:<tx ppm>:<depth>:<target depth>
+	if (cmd == "DRIFT") {
+		if (arg.empty()) {
+			os << "OK:DRIFT=" << (adc->drift() ? "ON" : "OFF") << ':'
+			          << adc->driftPpm(ModesDV::RX) << ':' << adc->driftPpm(ModesDV::TX) << ':'
+			          << adc->driftDepth() << ':' << adc->driftTarget() << std::endl;
+			return true;
+		} else {
+			arg = my::toUpper(arg);
+			if (arg != "ON" && arg != "OFF") goto no_good;
+			adc->drift(arg == "ON");
+			os << "OK:DRIFT=" << arg << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: GATESTAT - frames demodulated and skipped, and the
+	//          percentage of demodulator time saved
+	if (cmd == "GATESTAT" && arg.empty()) {
+		const uint64_t run = adc->gateRun();
+		const uint64_t skipped = adc->gateSkipped();
+		const uint64_t total = run + skipped;
+		os << "OK:GATESTAT=" << run << ':' << skipped << ':'
+		          << (total ? (100 * skipped / total) : 0) << std::endl;
+		return true;
+	} else 
+
+	// COMMAND: IDLE - stop the audio stream while muted
+	if (cmd == "IDLE") {
+		if (arg.empty()) {
+			os << "OK:IDLE=" << (adc->idle() ? "ON" : "OFF") << std::endl;
+			return true;
+		} else {
+			arg = my::toUpper(arg);
+			if (arg != "ON" && arg != "OFF") goto no_good;
+			adc->idle(arg == "ON");
+			os << "OK:IDLE=" << arg << std::endl;
+			return true;
+		}
+	} else 
+
+	// COMMAND: POWER - since the last POWER: CPU %, wakeups and
+	//          callbacks per second; then the stream state, and the
+	//          last and slowest resume from idle, in microseconds
+	if (cmd == "POWER" && arg.empty()) {
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		const double cpu =
+			ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+			ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+		const uint64_t switches = ru.ru_nvcsw + ru.ru_nivcsw;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const double elapsed = std::chrono::duration<double>(now - st.powerTime).count();
+		if (elapsed <= 0) goto no_good;
+
+		os << "OK:POWER="
+		          << static_cast<int>(100 * (cpu - st.powerCpu) / elapsed) << ':'
+		          << static_cast<int>((switches - st.powerSwitches) / elapsed) << ':'
+		          << static_cast<int>((adc->frames() - st.powerFrames) / elapsed) << ':'
+		          << (adc->suspended() ? "IDLE" : "ACTIVE") << ':'
+		          << static_cast<int>(adc->resumeLatency()) << ':'
+		          << static_cast<int>(adc->resumeLatencyMax()) << std::endl;
+		st.powerTime = now;
+		st.powerCpu = cpu;
+		st.powerSwitches = switches;
+		st.powerFrames = adc->frames();
+		return true;
+	} else 
+
+	// COMMAND: DF - frequency offset estimate
+	if (cmd == "DF" && arg.empty()) {
+		float value = adc->df();
+		os << "OK:DF=" << value << std::endl;
+		return true;
+	}
+
+	// COMMAND: MODEMSTATS - extended stats of the last RX frame
+	if (cmd == "MODEMSTATS" && arg.empty()) {
+		modem_snapshot m;
+		adc->modemStats(m);
+		os << "OK:MODEMSTATS="
+		          << m.frame << ':' << m.sync << ':' << m.snr << ':' << m.foff << ':'
+		          << m.rx_timing << ':' << m.clock_offset << ':' << m.sync_metric << ':'
+		          << m.nc << ':' << m.nr << std::endl;
+		return true;
+	}
+
+	// COMMAND: SPECRATE - spectrum frame rate
+	if (cmd == "SPECRATE") {
+		if (arg.empty()) {
+			os << "OK:SPECRATE=" << adc->spectrum().rate() << std::endl;
+			return true;
+		} else {
+			int value = atoi(arg.c_str());
+			if (value < 0) goto no_good;
+			adc->spectrum().rate(value);
+			os << "OK:SPECRATE=" << adc->spectrum().rate() << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: SPECTRUM - return the latest spectrum frame, in hex
+	if (cmd == "SPECTRUM" && arg.empty()) {
+		std::vector<uint8_t> frame;
+		if (!adc->spectrum().frame(frame)) goto no_good;
+		os << "OK:SPECTRUM=" << toHex(frame) << std::endl;
+		return true;
+	}
+
+	// COMMAND: TRACE - record <seconds> of audio events, then write them
+	//          as Chrome/Perfetto trace JSON: TRACE=<seconds>[,<path>]
+	if (cmd == "TRACE" && !arg.empty()) {
+		const size_t comma = arg.find(',');
+		const double seconds = atof(arg.substr(0, comma).c_str());
+		const std::string path = (comma == std::string::npos) ? std::string(TRACE_DEFAULT_PATH) : arg.substr(comma + 1);
+		if (seconds <= 0 || seconds > TRACE_MAX_SECONDS || path.empty()) goto no_good;
+
+		Trace::start();
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		Trace::stop();
+
+		// let the callback in progress finish its events
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		const long events = Trace::dump(path);
+		if (events < 0) goto no_good;
+		os << "OK:TRACE=" << path << ':' << events << std::endl;
+		return true;
+	}
+
+	// COMMAND: TELEMETRY - publish stats to shared memory
+	if (cmd == "TELEMETRY") {
+		if (arg.empty()) {
+			std::string path = adc->telemetry();
+			os << "OK:TELEMETRY=" << (path.empty() ? "OFF" : path) << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "OFF") {
+			adc->telemetry(std::string());
+			os << "OK:TELEMETRY=OFF" << std::endl;
+			return true;
+		} else {
+			if (my::toUpper(arg) == "ON")
+				arg = TELEMETRY_DEFAULT_PATH;
+			if (!adc->telemetry(arg)) goto no_good;
+			os << "OK:TELEMETRY=" << arg << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: RECORD - record audio to a WAV file
+	if (cmd == "RECORD") {
+		if (arg.empty()) {
+			std::string path = adc->recording();
+			os << "OK:RECORD=" << (path.empty() ? "OFF" : path) << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "OFF") {
+			adc->record(std::string());
+			os << "OK:RECORD=OFF" << std::endl;
+			return true;
+		} else {
+			// optional source prefix: IN:, OUT:, or BOTH: (the default)
+			AudioRecorder::Sources src = AudioRecorder::Both;
+			std::string path = arg;
+			size_t colon = arg.find(':');
+			if (colon != std::string::npos) {
+				std::string prefix = my::toUpper(arg.substr(0, colon));
+				if (prefix == "IN") {
+					src = AudioRecorder::Input;
+					path = arg.substr(colon + 1);
+				} else if (prefix == "OUT") {
+					src = AudioRecorder::Output;
+					path = arg.substr(colon + 1);
+				} else if (prefix == "BOTH") {
+					path = arg.substr(colon + 1);
+				}
+			}
+			if (path.empty() || !adc->record(path, src)) goto no_good;
+			os << "OK:RECORD=" << path << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: RECDROP - recorded frames lost to overflow
+	if (cmd == "RECDROP" && arg.empty()) {
+		os << "OK:RECDROP=" << adc->recordDrops() << std::endl;
+		return true;
+	}
+
+	// COMMAND: NETTAP - forward received codec2 frames
+	if (cmd == "NETTAP") {
+		if (arg.empty()) {
+			std::string target = adc->codecTap();
+			os << "OK:NETTAP=" << (target.empty() ? "OFF" : target) << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "OFF") {
+			adc->codecTap(std::string());
+			os << "OK:NETTAP=OFF" << std::endl;
+			return true;
+		} else {
+			if (!adc->codecTap(arg)) goto no_good;
+			os << "OK:NETTAP=" << arg << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: NETTAPSTAT - codec2 frames sent and dropped
+	if (cmd == "NETTAPSTAT" && arg.empty()) {
+		os << "OK:NETTAPSTAT=" << adc->codecTapSent() << ':' << adc->codecTapDropped() << std::endl;
+		return true;
+	}
+
+	// COMMAND: TXCODEC - transmit pre-encoded codec2 frames
+	if (cmd == "TXCODEC") {
+		if (arg.empty()) {
+			std::string source = adc->codecSource();
+			os << "OK:TXCODEC=" << (source.empty() ? "OFF" : source) << std::endl;
+			return true;
+		} else if (my::toUpper(arg) == "OFF") {
+			adc->codecSource(std::string());
+			os << "OK:TXCODEC=OFF" << std::endl;
+			return true;
+		} else {
+			if (!adc->codecSource(arg)) goto no_good;
+			os << "OK:TXCODEC=" << arg << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: TXCODECSTAT - codec2 frames sent, and silent frames
+	if (cmd == "TXCODECSTAT" && arg.empty()) {
+		os << "OK:TXCODECSTAT=" << adc->codecSourceSent() << ':' << adc->codecSourceUnderruns() << std::endl;
+		return true;
+	}
+
+	// COMMAND: DIVERSITY - decode left and right with two receivers
+	if (cmd == "DIVERSITY") {
+		if (arg.empty()) {
+			os << "OK:DIVERSITY=" << (adc->diversity() ? "ON" : "OFF") << std::endl;
+			return true;
+		} else {
+			arg = my::toUpper(arg);
+			if (arg != "ON" && arg != "OFF") goto no_good;
+			if (!adc->diversity(arg == "ON")) goto no_good;
+			os << "OK:DIVERSITY=" << arg << std::endl;
+			return true;
+		}
+	}
+
+	// COMMAND: DIVSTAT - frames taken from the left and right receivers
+	if (cmd == "DIVSTAT" && arg.empty()) {
+		os << "OK:DIVSTAT=" << adc->diversityWins(0) << ':' << adc->diversityWins(1) << std::endl;
+		return true;
+	}
+
+	// COMMAND: SNR - return S/N value
+	if (cmd == "STAT" && arg.empty()) {
+		basic_stats bs = adc->stats();
+		os << "OK:STAT=" << bs.snr << ':' << (bs.sync ? "SYNC" : "NO_SYNC") << std::endl;
+		return true;
+	}
+
+	// COMMAND: SNR - return S/N value
+	if (cmd == "SNR" && arg.empty()) {
+		float value = adc->snr();
+		os << "OK:SNR=" << value << std::endl;
+		return true;
+	}
+
+	// COMMAND: SYNC - returns modem RX sync state
+	if (cmd == "SYNC" && arg.empty()) {
+		bool value = adc->sync();
+		os << "OK:SYNC=" << (value ? "1" : "0") << std::endl;
+		return true;
+	}
+
+	// COMMAND: MODE
+	if (cmd == "MODE") {
+		if (arg.empty()) {
+			switch (adc->mode()) {
+				case ModesDV::Mute:
+					os << "OK:MODE=MUTE" << std::endl;
+					break;
+				case ModesDV::Pass:
+					os << "OK:MODE=PASS" << std::endl;
+					break;
+				case ModesDV::RX:
+					os << "OK:MODE=RX" << std::endl;
+					break;
+				case ModesDV::TX:
+					os << "OK:MODE=TX" << std::endl;
+					break;
+				default:
+					goto no_good;
+			}
+			return true;
+		} else {
+			arg = my::toUpper(arg);
+			if (arg == "MUTE") {
+				if (!adc->mode(ModesDV::Mute)) goto no_good;
+				os << "OK:MODE=MUTE" << std::endl;
+			} else if (arg == "PASS") {
+				if (!adc->mode(ModesDV::Pass)) goto no_good;
+				os << "OK:MODE=PASS" << std::endl;
+			} else if (arg == "RX") {
+				if (!adc->mode(ModesDV::RX)) goto no_good;
+				os << "OK:MODE=RX" << std::endl;
+			} else if (arg == "TX") {
+				if (!adc->mode(ModesDV::TX)) goto no_good;
+				os << "OK:MODE=TX" << std::endl;
+			} else {
+				goto no_good;
+			}
+		}
+	} else {
+		goto no_good;
+	}
+
+	return true;
+
+no_good:
+	os << "ERR" << std::endl;
+	return true;
+}
+
+
+/*
+ *
+ *   binary command handlers; each fills in the reply payload, and
+ *   returns false for an error reply
+ *
+ */
+typedef bool (*bin_handler)(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st);
+
+static bool binText(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	std::ostringstream os;
+	if (!command(adc, payload, os, st))
+		st.quit = true;
+	reply = os.str();
+	if (!reply.empty() && reply[reply.size() - 1] == '\n')
+		reply.erase(reply.size() - 1);
+	return reply != "ERR";
+}
+
+static bool binQuit(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	st.quit = true;
+	return true;
+}
+
+static bool binPing(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	reply = payload;
+	return true;
+}
+
+static bool binStat(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	const basic_stats bs = adc->stats();
+	binPutU8(reply, bs.sync ? 1 : 0);
+	binPutFloat(reply, bs.snr);
+	return payload.empty();
+}
+
+static bool binMode(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	if (payload.size() > 1)
+		return false;
+	if (payload.size() == 1 && !adc->mode(static_cast<ModesDV>(payload[0])))
+		return false;
+	binPutU8(reply, adc->mode());
+	return true;
+}
+
+static bool binStatus(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	const basic_stats bs = adc->stats();
+	const KK5JY::DSP::LevelMeter &li = adc->inputLevel();
+	const KK5JY::DSP::LevelMeter &lo = adc->outputLevel();
+	binPutU64(reply, adc->frames());
+	binPutU64(reply, adc->modemFrames());
+	binPutU8(reply, adc->mode());
+	binPutU8(reply, bs.sync ? 1 : 0);
+	binPutFloat(reply, bs.snr);
+	binPutFloat(reply, adc->df());
+	binPutFloat(reply, li.peakDb());
+	binPutFloat(reply, li.rmsDb());
+	binPutFloat(reply, lo.peakDb());
+	binPutFloat(reply, lo.rmsDb());
+	binPutU64(reply, li.clips());
+	return payload.empty();
+}
+
+static bool binModemStats(SoundCardDV *adc, const std::string &payload, std::string &reply, control_state &st) {
+	size_t pos = 0;
+	uint64_t since = 0;
+	if (payload.size() == 8)
+		since = binGetU64(payload, pos);
+	else if (!payload.empty())
+		return false;
+
+	modem_snapshot m;
+	adc->modemStats(m);
+	if (m.frame <= since)
+		return true;
+	binPutU64(reply, m.frame);
+	binPutU8(reply, m.sync ? 1 : 0);
+	binPutFloat(reply, m.snr);
+	binPutFloat(reply, m.foff);
+	binPutFloat(reply, m.rx_timing);
+	binPutFloat(reply, m.clock_offset);
+	binPutFloat(reply, m.sync_metric);
+	for (size_t i = 0; i != 4; ++i)
+		binPutFloat(reply, m.f_est[i]);
+	binPutU8(reply, m.nc);
+	binPutU8(reply, m.nr);
+	for (size_t c = 0; c != m.nc; ++c)
+		binPutFloat(reply, m.carrier[c]);
+	for (size_t i = 0; i != 2 * m.points; ++i)
+		binPutFloat(reply, m.scatter[i]);
+	return true;
+}
+
+// indexed by BinCommands
+static const bin_handler s_BinHandlers[BinCommandCount] = {
+	binText,
+	binQuit,
+	binPing,
+	binStat,
+	binMode,
+	binStatus,
+	binModemStats
+};
+
+
+/*
+ *
+ *   binarySession(...) - serve binary frames on stdin/stdout until the
+ *                        channel closes; returns false on a QUIT
+ *
+ */
+static bool binarySession(SoundCardDV *adc, control_state &st, bool finite) {
+	std::string in, out, body, reply;
+	char buffer[BIN_MAX_FRAME];
+	for (;;) {
+		if (finite && !waitInput(STDIN_FILENO, adc))
+			return true;
+		const ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return true;
+		in.append(buffer, n);
+
+		// run every whole frame that has arrived, batching the replies
+		size_t pos = 0;
+		bool bad = false;
+		while (!st.quit && binNext(in, pos, body, bad)) {
+			const uint8_t id = static_cast<uint8_t>(body[0]);
+			reply.clear();
+			const bool ok = (id < BinCommandCount) && s_BinHandlers[id](adc, body.substr(1), reply, st);
+			binReply(out, id, ok ? BinOK : BinErr, reply);
+		}
+		in.erase(0, pos);
+
+		if (!out.empty()) {
+			if (!binWriteAll(STDOUT_FILENO, out))
+				return true;
+			out.clear();
+		}
+		if (st.quit)
+			return false;
+		if (bad) {
+			Logger::write(LogError, "bad frame on the binary control channel");
+			return true;
+		}
+	}
+}
+
+
 /*
  *
  *   usage()
@@ -42,12 +858,27 @@
  */
 void usage() {
 	std::cerr << std::endl;
-	std::cerr <<  "Usage: fdvcore <dev> <modem>" << std::endl;
+	std::cerr <<  "Usage: fdvcore [options] <dev> <modem>" << std::endl;
 	std::cerr <<  "       fdvcore -l" << std::endl;
 	std::cerr << std::endl;
-	std::cerr <<  "       <dev>   - device ID" << std::endl;
+	std::cerr <<  "       -r <rate>    - audio sample rate (default " << CARD_FS << "), a multiple of " << MODEM_FS << std::endl;
+	std::cerr <<  "       -m <mode>    - initial mode: MUTE (default), PASS, RX, or TX" << std::endl;
+	std::cerr <<  "       -c <control> - read commands from fd:<n> or unix:<path> instead of stdin;" << std::endl;
+	std::cerr <<  "                      without it, stdin/stdout audio runs to the end with none" << std::endl;
+	std::cerr <<  "       -i           - low-power idle: stop the audio stream while muted" << std::endl;
+	std::cerr <<  "       -L <target>  - write the log to stderr (default), syslog, or a file" << std::endl;
+	std::cerr <<  "       -V <level>   - log level: ERROR, WARNING, INFO (default), or DEBUG" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       <dev>   - audio device:" << std::endl;
+	std::cerr <<  "                    <n>                    - RtAudio device ID (see -l)" << std::endl;
+	std::cerr <<  "                    alsa:<pcm>             - ALSA device, in mmap mode, e.g., alsa:hw:0,0" << std::endl;
+	std::cerr <<  "                    file:<in>,<out>[,<ch>] - raw S16 files or FIFOs; '-' for stdin/stdout" << std::endl;
+	std::cerr <<  "                    null[:<in>,<out>]      - no device; silent input, clocked" << std::endl;
 	std::cerr <<  "       <modem> - the Codec2 modem { " FDV_MODES  " }" << std::endl;
 	std::cerr << std::endl;
+	std::cerr <<  "       e.g., decode an SDR: rtl_fm -M usb -s 8000 ... | fdvcore -r 8000 -m RX \\" << std::endl;
+	std::cerr <<  "                 file:-,- 1600 | aplay -f S16_LE -r 8000" << std::endl;
+	std::cerr << std::endl;
 }
 
 
@@ -57,26 +888,46 @@ void usage() {
  *
  */
 int main(int argc, char **argv) {
-	// must have at least one argument
-	if (argc < 2) {
-		usage();
-		return 1;
-	}
+	bool list = false;
+	bool idle = false;
+	unsigned rate = CARD_FS;
+	std::string control, initialMode;
+	std::string logTarget = "stderr";
+	LogLevels logLevel = LogInfo;
 
-	// if no cards, bail
-	if ( SoundCard::deviceCount() < 1 ) {
-		std::cerr << "\nNo audio devices found!\n";
-		return 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "lr:c:m:iL:V:")) != -1) {
+		switch (opt) {
+			case 'l': list = true; break;
+			case 'r': rate = atoi(optarg); break;
+			case 'c': control = optarg; break;
+			case 'm': initialMode = my::toUpper(optarg); break;
+			case 'i': idle = true; break;
+			case 'L': logTarget = optarg; break;
+			case 'V':
+				if (!Logger::parse(my::toUpper(optarg), logLevel)) {
+					usage();
+					return 1;
+				}
+				break;
+			default: usage(); return 1;
+		}
 	}
 
 	// List (-l) option
-	if (argc == 2 && strcmp(argv[1], "-l") == 0) {
+	if (list) {
 		RtAudio adc(RtAudio::LINUX_ALSA);
 
+		// if no cards, say so; the other backends need none
+		unsigned int devices = adc.getDeviceCount();
+		if (devices < 1) {
+			std::cerr << "\nNo audio devices found!\n";
+			return 1;
+		}
+
 		// Scan through devices for various capabilities
 		RtAudio::DeviceInfo info;
 		std::cout << "Valid devices:" << std::endl;
-		unsigned int devices = adc.getDeviceCount();
 		for (unsigned int i = 0; i < devices; i++) {
 			info = adc.getDeviceInfo(i);
 			if (info.probed == true) {
@@ -90,226 +941,151 @@ int main(int argc, char **argv) {
 	}
 
 	// from this point forward, there must be two args
-	if (argc < 3) {
+	if (argc - optind != 2) {
 		usage();
 		return 1;
 	}
 
-	// read the device name
-	size_t id = atoi(argv[1]);
-
 	// parse the modem type
-	int modem = -1;
-	const int modemIndex = 2;
-	if (!strcmp(argv[modemIndex],"1600"))
-		modem = FREEDV_MODE_1600;
-/*	if (!strcmp(argv[modemIndex],"700"))
-		modem = FREEDV_MODE_700;
-	if (!strcmp(argv[modemIndex],"700B"))
-		modem = FREEDV_MODE_700B; */
-	if (!strcmp(argv[modemIndex],"700C"))
-		modem = FREEDV_MODE_700C;
-	#ifdef FREEDV_MODE_700D
-	if (!strcmp(argv[modemIndex],"700D"))
-		modem = FREEDV_MODE_700D;
-	#endif
-	#if 0 // not supported yet
-	if (!strcmp(argv[modemIndex],"2400A"))
-		modem = FREEDV_MODE_2400A;
-	if (!strcmp(argv[modemIndex],"2400B"))
-		modem = FREEDV_MODE_2400B;
-	#endif
-	if (!strcmp(argv[modemIndex],"800XA"))
-		modem = FREEDV_MODE_800XA;
+	const int modemIndex = optind + 1;
+	int modem = parseModem(argv[modemIndex]);
 	if (modem == -1) {
 		usage();
 		return 1;
 	}
 
+	// the audio thread logs through the formatter, never to a stream
+	Logger::level(logLevel);
+	if (!Logger::start(logTarget)) {
+		std::cerr << "Could not open log " << logTarget << std::endl;
+		return 1;
+	}
+
 	// open the sound card
 	SoundCardDV *adc = 0;
+	bool finite = false;
+	bool commands = true;
 	try {
-		adc = new SoundCardDV(modem, id, SCDV_WINDOW_SIZE);
-		adc->start();
+		AudioBackend *backend = createBackend(argv[optind]);
+
+		// a file (or pipe) runs out; stdin/stdout audio leaves no room
+		//    for commands there, so without -c it runs with none
+		FileBackend *fb = dynamic_cast<FileBackend*>(backend);
+		finite = (fb != 0);
+		if (fb && fb->stdio() && control.empty())
+			commands = false;
+
+		adc = new SoundCardDV(modem, backend, (SCDV_WINDOW_SIZE * rate) / CARD_FS, 0, rate);
+
+		if (initialMode == "RX") adc->mode(ModesDV::RX);
+		else if (initialMode == "TX") adc->mode(ModesDV::TX);
+		else if (initialMode == "PASS") adc->mode(ModesDV::Pass);
+		else if (initialMode == "MUTE" || initialMode.empty()) adc->mode(ModesDV::Mute);
+		else {
+			delete adc;
+			usage();
+			return 1;
+		}
+
+		adc->idle(idle);
+
+		if (!adc->start()) {
+			Logger::write(LogError, "Could not start the audio stream");
+			delete adc;
+			return 1;
+		}
 	}
 	catch ( RtAudioError& e ) {
 		if (adc)
 			try { adc->stop(); } catch (const std::exception &e) { /* nop */ }
-		e.printMessage();
+		Logger::message(LogError, e.what());
+		return 1;
+	}
+	catch (const local_exception &e) {
+		Logger::message(LogError, e.what());
 		return 1;
 	}
 
+	// move the commands off stdin/stdout, which may now carry audio
+	if (!control.empty()) {
+		signal(SIGPIPE, SIG_IGN);
+		const int fd = openControl(control, adc);
+		if (fd >= 0) {
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		} else if (finite && adc->backend()->finished()) {
+			// the source ran out before anyone connected; that's a run
+			//    with no commands, not an error
+			commands = false;
+		} else {
+			Logger::message(LogError, "Could not open control channel " + control);
+			delete adc;
+			return 1;
+		}
+	}
+
+	// unbuffered, so that polling stdin sees every pending command
+	if (finite && commands)
+		setvbuf(stdin, 0, _IONBF, 0);
+
 	// DEBUG: output debugging info about the card
-	std::cerr << "DEBUG: using " << adc->channelsIn() << " input channels." << std::endl;
-	std::cerr << "DEBUG: using " << adc->channelsOut() << " output channels." << std::endl;
+	Logger::write(LogDebug, "using %u input channels.", adc->channelsIn());
+	Logger::write(LogDebug, "using %u output channels.", adc->channelsOut());
+
+	// the session state
+	control_state st;
+	st.powerTime = std::chrono::steady_clock::now();
+	st.powerCpu = 0;
+	st.powerSwitches = 0;
+	st.powerFrames = adc->frames();
+	st.binary = false;
+	st.quit = false;
 
 	// wait for commands
 	std::string line;
-	std::string cmd, arg;
+	bool quit = false;
 	try {
-		while (std::cin) {
+		while (commands && std::cin) {
+			// a finite audio source ends the session when it runs out
+			if (finite && !waitInput(STDIN_FILENO, adc))
+				break;
+
 			// read one line from std input
 			std::getline(std::cin, line);
 			if (!std::cin)
 				break;
 
-			// trim off whitespace
-			line = my::strip(line);
-
-			// split the command from the argument (if any)
-			SplitCommand(line, cmd, arg);
-			cmd = my::toUpper(cmd);
-
-			// COMMAND: QUIT
-			if (cmd == "QUIT") {
+			if (!command(adc, line, std::cout, st)) {
+				quit = true;
 				break;
-			} else 
-
-			// COMMAND: QUIT
-			if (cmd == "VERSION") {
-				std::cout << "OK:VERSION=" << VERSION_TEXT << std::endl;
-				continue;
-			} else 
-
-			// COMMAND: TEXT
-			if (cmd == "TEXT") {
-				if (arg.empty()) {
-					std::cout << "OK:TEXT=" << adc->text() << std::endl;
-					continue;
-				} else {
-					adc->text(arg);
-					std::cout << "OK:TEXT=" << arg << std::endl;
-					continue;
-				}
-			} else 
-
-			// COMMAND: CLIP CHECK
-			if (cmd == "CLIP") {
-				if (arg.empty()) {
-					std::cout << "OK:CLIP=" << static_cast<int>(adc->clipped()) << std::endl;
-					continue;
-				}
-			} else 
-
-			// COMMAND: FRAME COUNT
-			if (cmd == "FRAMES") {
-				if (arg.empty()) {
-					std::cout << "OK:FRAMES=" << adc->frames() << std::endl;
-					continue;
-				}
-			} else 
-
-			// COMMAND: SQUELCH ENABLE
-			if (cmd == "SQEN") {
-				if (arg.empty()) {
-					std::cout << "OK:SQEN=" << static_cast<int>(adc->squelch()) << std::endl;
-					continue;
-				} else {
-					int value = atoi(arg.c_str()) ? 1 : 0;
-					adc->squelch(value);
-					std::cout << "OK:SQEN=" << value << std::endl;
-					continue;
-				}
-			} else 
-
-			// COMMAND: SQUELCH THRESHOLD
-			if (cmd == "SQTH") {
-				if (arg.empty()) {
-					std::cout << "OK:SQTH=" << adc->threshold() << std::endl;
-					continue;
-				} else {
-					float value = atof(arg.c_str());
-					adc->threshold(value);
-					std::cout << "OK:SQTH=" << value << std::endl;
-					continue;
-				}
-			} else 
-
-			// COMMAND: DF - frequency offset estimate
-			if (cmd == "DF" && arg.empty()) {
-				float value = adc->df();
-				std::cout << "OK:DF=" << value << std::endl;
-				continue;
 			}
 
-			// COMMAND: SNR - return S/N value
-			if (cmd == "STAT" && arg.empty()) {
-				basic_stats bs = adc->stats();
-				std::cout << "OK:STAT=" << bs.snr << ':' << (bs.sync ? "SYNC" : "NO_SYNC") << std::endl;
-				continue;
-			}
-
-			// COMMAND: SNR - return S/N value
-			if (cmd == "SNR" && arg.empty()) {
-				float value = adc->snr();
-				std::cout << "OK:SNR=" << value << std::endl;
-				continue;
-			}
-
-			// COMMAND: SYNC - returns modem RX sync state
-			if (cmd == "SYNC" && arg.empty()) {
-				bool value = adc->sync();
-				std::cout << "OK:SYNC=" << (value ? "1" : "0") << std::endl;
-				continue;
-			}
-
-			// COMMAND: MODE
-			if (cmd == "MODE") {
-				if (arg.empty()) {
-					switch (adc->mode()) {
-						case ModesDV::Mute:
-							std::cout << "OK:MODE=MUTE" << std::endl;
-							break;
-						case ModesDV::Pass:
-							std::cout << "OK:MODE=PASS" << std::endl;
-							break;
-						case ModesDV::RX:
-							std::cout << "OK:MODE=RX" << std::endl;
-							break;
-						case ModesDV::TX:
-							std::cout << "OK:MODE=TX" << std::endl;
-							break;
-						default:
-							goto no_good;
-					}
-					continue;
-				} else {
-					arg = my::toUpper(arg);
-					if (arg == "MUTE") {
-						if (!adc->mode(ModesDV::Mute)) goto no_good;
-						std::cout << "OK:MODE=MUTE" << std::endl;
-					} else if (arg == "PASS") {
-						if (!adc->mode(ModesDV::Pass)) goto no_good;
-						std::cout << "OK:MODE=PASS" << std::endl;
-					} else if (arg == "RX") {
-						if (!adc->mode(ModesDV::RX)) goto no_good;
-						std::cout << "OK:MODE=RX" << std::endl;
-					} else if (arg == "TX") {
-						if (!adc->mode(ModesDV::TX)) goto no_good;
-						std::cout << "OK:MODE=TX" << std::endl;
-					} else {
-						goto no_good;
-					}
-				}
-			} else {
-				goto no_good;
+			// the rest of the session is binary
+			if (st.binary) {
+				quit = !binarySession(adc, st, finite);
+				break;
 			}
-
-			continue;
-			
-		no_good:
-			std::cout << "ERR" << std::endl;
 		} // ... while (cin)
 
+		// without a controller, a finite source runs to the end
+		while (finite && !quit && !adc->backend()->finished()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		}
+
 		// Stop the stream
 		adc->stop();
+		delete adc;
 		adc = 0;
+
+		// write what the audio thread left in the log
+		Logger::stop();
 	}
 	catch (RtAudioError& e) {
-		e.printMessage();
+		Logger::message(LogError, e.what());
 	}
 	catch (const std::exception& e) {
-		std::cerr << e.what() << std::endl;
+		Logger::message(LogError, e.what());
 	}
 	return 0;
 }
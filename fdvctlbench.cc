@@ -0,0 +1,244 @@
+/*
+ *
+ *
+ *    fdvctlbench.cc
+ *
+ *    Control channel benchmark: measures command round-trip latency to
+ *    a running fdvcore, over the text protocol and then binary framing.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "binproto.h"
+
+
+//
+//  the timing of one protocol run
+//
+struct bench_result {
+	std::vector<double> batches; // round trip per batch, usec
+	double wall;                 // seconds
+	size_t commands;
+};
+
+
+/*
+ *
+ *   readSome(...) - append what is available on 'fd'; false at EOF
+ *
+ */
+static bool readSome(int fd, std::string &in) {
+	char buffer[BIN_MAX_FRAME];
+	for (;;) {
+		const ssize_t n = read(fd, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		in.append(buffer, n);
+		return true;
+	}
+}
+
+
+/*
+ *
+ *   textLine(...) - read one reply line
+ *
+ */
+static bool textLine(int fd, std::string &in, std::string &line) {
+	size_t nl;
+	while ((nl = in.find('\n')) == std::string::npos) {
+		if (!readSome(fd, in))
+			return false;
+	}
+	line = in.substr(0, nl);
+	in.erase(0, nl + 1);
+	return true;
+}
+
+
+/*
+ *
+ *   runText(...) - 'rounds' batches of 'batch' text commands
+ *
+ */
+static bool runText(int fd, const std::string &cmd, size_t rounds, size_t batch, bench_result &r) {
+	std::string request, in, line;
+	for (size_t i = 0; i != batch; ++i)
+		request += cmd + "\n";
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (size_t k = 0; k != rounds; ++k) {
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (!binWriteAll(fd, request))
+			return false;
+		for (size_t i = 0; i != batch; ++i) {
+			if (!textLine(fd, in, line) || line.compare(0, 3, "OK:") != 0)
+				return false;
+		}
+		r.batches.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+	r.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	r.commands = rounds * batch;
+	return true;
+}
+
+
+/*
+ *
+ *   runBinary(...) - 'rounds' batches of 'batch' binary requests
+ *
+ */
+static bool runBinary(int fd, uint8_t id, size_t rounds, size_t batch, bench_result &r) {
+	std::string request, in, body;
+	for (size_t i = 0; i != batch; ++i)
+		binRequest(request, id);
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (size_t k = 0; k != rounds; ++k) {
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (!binWriteAll(fd, request))
+			return false;
+		size_t pos = 0, got = 0;
+		bool bad = false;
+		while (got != batch) {
+			if (binNext(in, pos, body, bad)) {
+				if (body.size() < 2 || static_cast<uint8_t>(body[0]) != id || body[1] != BinOK)
+					return false;
+				++got;
+				continue;
+			}
+			if (bad || !readSome(fd, in))
+				return false;
+		}
+		in.erase(0, pos);
+		r.batches.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+	r.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	r.commands = rounds * batch;
+	return true;
+}
+
+
+/*
+ *
+ *   report(...)
+ *
+ */
+static void report(const std::string &name, bench_result &r) {
+	std::sort(r.batches.begin(), r.batches.end());
+	const size_t n = r.batches.size();
+	std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(1)
+	          << std::setw(10) << (r.wall * 1e6 / r.commands)
+	          << std::setw(10) << r.batches[n / 2]
+	          << std::setw(10) << r.batches[(n * 99) / 100]
+	          << std::setw(12) << std::setprecision(0) << (r.commands / r.wall) << std::endl;
+}
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvctlbench [options] unix:<path>" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       unix:<path> - the control socket of an 'fdvcore -c unix:<path>'" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -n <n>      - round trips per protocol (default 1000)" << std::endl;
+	std::cerr <<  "       -b <n>      - commands per round trip (default 1)" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       Runs STAT over the text protocol, then switches the channel to" << std::endl;
+	std::cerr <<  "       binary framing and runs it again; fdvcore exits when this does." << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	size_t rounds = 1000;
+	size_t batch = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+		switch (opt) {
+			case 'n': rounds = atoi(optarg); break;
+			case 'b': batch = atoi(optarg); break;
+			default: usage(); return 1;
+		}
+	}
+	if (argc - optind != 1 || rounds == 0 || batch == 0) {
+		usage();
+		return 1;
+	}
+	const std::string target = argv[optind];
+	if (target.compare(0, 5, "unix:") != 0) {
+		usage();
+		return 1;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	const std::string path = target.substr(5);
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		usage();
+		return 1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		std::cerr << "Could not connect to " << path << std::endl;
+		return 1;
+	}
+
+	bench_result text, binary;
+	if (!runText(fd, "STAT", rounds, batch, text)) {
+		std::cerr << "Text protocol failed" << std::endl;
+		return 1;
+	}
+
+	// negotiate binary framing
+	std::string in, line;
+	if (!binWriteAll(fd, "PROTO=BIN\n") || !textLine(fd, in, line) || line != "OK:PROTO=BIN") {
+		std::cerr << "Binary framing refused" << std::endl;
+		return 1;
+	}
+	if (!runBinary(fd, BinStat, rounds, batch, binary)) {
+		std::cerr << "Binary protocol failed" << std::endl;
+		return 1;
+	}
+	close(fd);
+
+	std::cout << "STAT, " << rounds << " round trips of " << batch << " command(s):" << std::endl;
+	std::cout << std::left << std::setw(8) << "PROTO" << std::right
+	          << std::setw(10) << "us/cmd" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+	          << std::setw(12) << "cmds/s" << std::endl;
+	report("text", text);
+	report("binary", binary);
+	return 0;
+}
+
+// EOF
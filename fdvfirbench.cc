@@ -0,0 +1,154 @@
+/*
+ *
+ *
+ *    fdvfirbench.cc
+ *
+ *    Long FIR filter benchmark: times direct-form and FFT overlap-save
+ *    convolution in FastFirFilter.h over a range of filter lengths, to
+ *    find the crossover, and checks the choice that Auto mode makes.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include "FastFirFilter.h"
+
+typedef KK5JY::DSP::FastFirFilter<float> filter_t;
+
+// the samples passed per call, as the audio thread would
+#define CALL_BLOCK 256
+
+
+/*
+ *
+ *   speed(...) - nanoseconds per sample through 'f'
+ *
+ */
+static double speed(filter_t &f, const std::vector<float> &x) {
+	std::vector<float> y(CALL_BLOCK);
+	float sink = 0;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t n = 0; n + CALL_BLOCK <= x.size(); n += CALL_BLOCK) {
+		f.filter(&x[n], &y[0], CALL_BLOCK);
+		sink += y[0];
+	}
+	const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	if (sink == 12345.0f)
+		std::cerr << sink;
+	return ns / (x.size() - (x.size() % CALL_BLOCK));
+}
+
+
+/*
+ *
+ *   error(...) - the largest difference between the two paths, after
+ *                the FFT path's delay
+ *
+ */
+static double error(const std::vector<float> &h, const std::vector<float> &x) {
+	filter_t d(h, 0, filter_t::Direct);
+	filter_t f(h, 0, filter_t::Fast);
+	const size_t n = std::min(x.size(), static_cast<size_t>(8 * f.delay() + 8 * h.size()));
+	std::vector<float> yd(n), yf(n);
+	d.filter(&x[0], &yd[0], n);
+	f.filter(&x[0], &yf[0], n);
+	double worst = 0;
+	for (size_t i = f.delay(); i != n; ++i)
+		worst = std::max(worst, fabs(static_cast<double>(yd[i - f.delay()]) - yf[i]));
+	return worst;
+}
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvfirbench [options]" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -b <n>      - the most delay the FFT path may add (default none)" << std::endl;
+	std::cerr <<  "       -s <n>      - samples timed per filter (default 4000000)" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       Times each filter length from 8 to 2048 taps both ways, and" << std::endl;
+	std::cerr <<  "       reports the FFT size and the mode that Auto would choose.  Lengths" << std::endl;
+	std::cerr <<  "       with no FFT inside the delay limit are timed without it." << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	size_t block = 0;
+	size_t samples = 4000000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:s:h")) != -1) {
+		switch (opt) {
+			case 'b': block = atoi(optarg); break;
+			case 's': samples = atoi(optarg); break;
+			default: usage(); return 1;
+		}
+	}
+	if (argc != optind || samples < CALL_BLOCK) {
+		usage();
+		return 1;
+	}
+
+	std::vector<float> x(samples);
+	for (size_t n = 0; n != samples; ++n)
+		x[n] = (rand() / (float)RAND_MAX) - 0.5f;
+
+	std::cout << std::left << std::setw(8) << "TAPS" << std::right
+	          << std::setw(10) << "direct ns" << std::setw(10) << "fft ns"
+	          << std::setw(8) << "N" << std::setw(8) << "delay"
+	          << std::setw(8) << "auto" << std::setw(10) << "error" << std::endl;
+
+	size_t crossover = 0;
+	size_t wrong = 0;
+	for (size_t taps = 8; taps <= 2048; taps += (taps < 64) ? 8 : (taps < 512) ? 32 : 256) {
+		std::vector<float> h(taps);
+		for (size_t k = 0; k != taps; ++k)
+			h[k] = (rand() / (float)RAND_MAX) - 0.5f;
+
+		filter_t d(h, block, filter_t::Direct);
+		filter_t f(h, block, filter_t::Fast);
+		filter_t a(h, block, filter_t::Auto);
+		const double dns = speed(d, x);
+		const double fns = speed(f, x);
+
+		// past the delay limit, Auto has no choice but direct form
+		const bool fits = !block || f.delay() <= block;
+		if (fits && fns < dns && !crossover)
+			crossover = taps;
+		if (fits && (fns < dns) != a.fast())
+			++wrong;
+
+		std::cout << std::left << std::setw(8) << taps << std::right << std::fixed
+		          << std::setprecision(2) << std::setw(10) << dns << std::setw(10) << fns
+		          << std::setw(8) << f.fftLength() << std::setw(8) << f.delay()
+		          << std::setw(8) << (a.fast() ? "fft" : "direct")
+		          << std::scientific << std::setprecision(1) << std::setw(10) << error(h, x)
+		          << std::endl;
+	}
+	std::cout << "FFT is faster from " << crossover << " taps; Auto chose the slower path "
+	          << wrong << " time(s)" << std::endl;
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,131 @@
+/*
+ *
+ *
+ *    fdvlisten.cc
+ *
+ *    Remote listener for the fdvcore codec2 network tap (NETTAP): decodes
+ *    the received frames locally and writes 8kHz S16 speech to stdout,
+ *    e.g., for 'aplay -f S16_LE -r 8000'.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <codec2/freedv_api.h>
+#include <codec2/codec2.h>
+#include "codectap.h"
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvlisten udp:<port>" << std::endl;
+	std::cerr <<  "       fdvlisten udp:<group>:<port>" << std::endl;
+	std::cerr <<  "       fdvlisten unix:<path>" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       Writes decoded 8kHz S16 speech to stdout." << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		usage();
+		return 1;
+	}
+
+	int s = codecTapListen(argv[1]);
+	if (s < 0) {
+		std::cerr << "Could not listen on " << argv[1] << std::endl;
+		usage();
+		return 1;
+	}
+
+	// the decoder follows the sender's modem
+	int modem = -1;
+	freedv *fdv = 0;
+	CODEC2 *c2 = 0;
+	int bpf = 0, spf = 0;
+	std::vector<short> speech;
+
+	uint32_t expected = 0;
+	bool first = true;
+	codec_tap_packet p;
+	for (;;) {
+		const ssize_t len = recv(s, &p, sizeof(p), 0);
+		if (len < 0)
+			break;
+		const size_t header = sizeof(p) - CODEC_TAP_MAX_BYTES;
+		if (static_cast<size_t>(len) < header)
+			continue;
+		codecTapFromWire(p);
+		if (p.magic != CODEC_TAP_MAGIC || p.version != CODEC_TAP_VERSION)
+			continue;
+		if (p.bytes > CODEC_TAP_MAX_BYTES || static_cast<size_t>(len) != header + p.bytes)
+			continue;
+
+		// (re)open the decoder when the modem changes
+		if (p.modem != modem) {
+			if (fdv)
+				freedv_close(fdv);
+			modem = p.modem;
+			fdv = freedv_open(modem);
+			c2 = fdv ? freedv_get_codec2(fdv) : 0;
+			if (!c2) {
+				std::cerr << "Unsupported modem " << modem << std::endl;
+				return 1;
+			}
+			bpf = (codec2_bits_per_frame(c2) + 7) / 8;
+			spf = codec2_samples_per_frame(c2);
+			speech.resize(spf);
+			first = true;
+		}
+
+		// fill lost datagrams with silence, to keep the timing
+		if (!first && p.seq != expected) {
+			const uint32_t lost = p.seq - expected;
+			if (lost < 100) {
+				std::fill(speech.begin(), speech.end(), 0);
+				for (uint32_t i = 0; i != lost * p.frames; ++i)
+					fwrite(&speech[0], sizeof(short), spf, stdout);
+			}
+			std::cerr << "lost " << lost << " frame(s)" << std::endl;
+		}
+		expected = p.seq + 1;
+		first = false;
+
+		for (int f = 0; f != p.frames && (f + 1) * bpf <= p.bytes; ++f) {
+			codec2_decode(c2, &speech[0], p.bits + (f * bpf));
+			fwrite(&speech[0], sizeof(short), spf, stdout);
+		}
+		fflush(stdout);
+	}
+
+	if (fdv)
+		freedv_close(fdv);
+	close(s);
+	return 0;
+}
+
+// EOF
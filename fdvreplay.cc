@@ -0,0 +1,248 @@
+/*
+ *
+ *
+ *    fdvreplay.cc
+ *
+ *    Replays a recording through the SoundCardDV chain, exactly as the
+ *    sound card callback would, for profiling and regression runs.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sndfile.h>
+#include "stype.h"
+#include "localtypes.h"
+#include "scdv.h"
+#include "modems.h"
+#include "telemetry.h"
+
+// the default number of frames per callback, same as fdvcore
+#define REPLAY_WINDOW_SIZE (512)
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvreplay [options] <modem> <input.wav>" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       <modem>     - the Codec2 modem { " FDV_MODES  " }" << std::endl;
+	std::cerr <<  "       <input.wav> - 48kHz recording, e.g., from RECORD=IN:<path>" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -m <mode>   - RX (default), TX, PASS, or MUTE" << std::endl;
+	std::cerr <<  "       -w <frames> - frames per callback (default " << REPLAY_WINDOW_SIZE << ")" << std::endl;
+	std::cerr <<  "       -i <n>      - input channels (default: channels in the file)" << std::endl;
+	std::cerr <<  "       -o <n>      - output channels (default 2)" << std::endl;
+	std::cerr <<  "       -r          - pace callbacks in real time" << std::endl;
+	std::cerr <<  "       -a <file>   - write the first output channel to a WAV file" << std::endl;
+	std::cerr <<  "       -s <file>   - write per-callback stats to a CSV file" << std::endl;
+	std::cerr <<  "       -t <text>   - TX text" << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	ModesDV mode = ModesDV::RX;
+	size_t win = REPLAY_WINDOW_SIZE;
+	int chIn = 0;
+	int chOut = 2;
+	bool realtime = false;
+	std::string audioPath, statsPath, text;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:w:i:o:ra:s:t:")) != -1) {
+		switch (opt) {
+			case 'm': {
+				std::string m = my::toUpper(optarg);
+				if (m == "RX") mode = ModesDV::RX;
+				else if (m == "TX") mode = ModesDV::TX;
+				else if (m == "PASS") mode = ModesDV::Pass;
+				else if (m == "MUTE") mode = ModesDV::Mute;
+				else { usage(); return 1; }
+			} break;
+			case 'w': win = atoi(optarg); break;
+			case 'i': chIn = atoi(optarg); break;
+			case 'o': chOut = atoi(optarg); break;
+			case 'r': realtime = true; break;
+			case 'a': audioPath = optarg; break;
+			case 's': statsPath = optarg; break;
+			case 't': text = optarg; break;
+			default: usage(); return 1;
+		}
+	}
+	if (argc - optind != 2 || win == 0 || chIn < 0 || chOut < 1) {
+		usage();
+		return 1;
+	}
+
+	// parse the modem type
+	int modem = parseModem(argv[optind]);
+	if (modem == -1) {
+		usage();
+		return 1;
+	}
+
+	// open the recording
+	SF_INFO info;
+	memset(&info, 0, sizeof(info));
+	SNDFILE *input = sf_open(argv[optind + 1], SFM_READ, &info);
+	if (!input) {
+		std::cerr << "Could not open " << argv[optind + 1] << ": " << sf_strerror(0) << std::endl;
+		return 1;
+	}
+	if (info.samplerate != CARD_FS) {
+		std::cerr << "Recording must be sampled at " << CARD_FS << " Hz" << std::endl;
+		sf_close(input);
+		return 1;
+	}
+	const int chFile = info.channels;
+	if (chIn == 0)
+		chIn = chFile;
+
+	// open the outputs
+	SNDFILE *output = 0;
+	if (!audioPath.empty()) {
+		SF_INFO oinfo;
+		memset(&oinfo, 0, sizeof(oinfo));
+		oinfo.samplerate = CARD_FS;
+		oinfo.channels = 1;
+		oinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+		output = sf_open(audioPath.c_str(), SFM_WRITE, &oinfo);
+		if (!output) {
+			std::cerr << "Could not open " << audioPath << ": " << sf_strerror(0) << std::endl;
+			sf_close(input);
+			return 1;
+		}
+	}
+	std::ofstream stats;
+	if (!statsPath.empty()) {
+		stats.open(statsPath.c_str());
+		if (!stats) {
+			std::cerr << "Could not open " << statsPath << std::endl;
+			sf_close(input);
+			if (output) sf_close(output);
+			return 1;
+		}
+		stats << "callback,modem_frames,sync,snr,df,in_depth,out_depth,usec" << std::endl;
+	}
+
+	// build the chain on a virtual card
+	SoundCardDV *dv = 0;
+	try {
+		VirtualCard vc(chIn, chOut);
+		dv = new SoundCardDV(modem, 0, win, &vc);
+		if (!text.empty())
+			dv->text(text);
+		dv->mode(mode);
+	}
+	catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		sf_close(input);
+		if (output) sf_close(output);
+		return 1;
+	}
+
+	std::vector<float> fileBuf(win * chFile);
+	std::vector<float> inBuf(win * chIn);
+	std::vector<float> outBuf(win * chOut);
+	std::vector<float> monoBuf(win);
+
+	EventTimer timer;
+	uint64_t callbacks = 0, syncFrames = 0, lastModemFrames = 0;
+	basic_stats bs;
+	float df = 0;
+	double busy = 0;
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (;;) {
+		// read one window, zero-padding the last one
+		sf_count_t got = sf_readf_float(input, &fileBuf[0], win);
+		if (got <= 0)
+			break;
+		std::fill(fileBuf.begin() + got * chFile, fileBuf.end(), 0.0f);
+
+		// map file channels onto card channels
+		for (size_t i = 0; i != win; ++i) {
+			for (int c = 0; c != chIn; ++c) {
+				inBuf[i * chIn + c] = (c < chFile) ? fileBuf[i * chFile + c] : 0.0f;
+			}
+		}
+
+		// real-time pacing: wait for the buffer to be 'captured'
+		if (realtime) {
+			std::this_thread::sleep_until(begin + std::chrono::microseconds((callbacks * win * 1000000) / CARD_FS));
+		}
+
+		// run the callback
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		dv->drive(&inBuf[0], &outBuf[0], win);
+		const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		const float usec = std::chrono::duration<float, std::micro>(end - start).count();
+		timer.add(usec);
+		busy += usec;
+		++callbacks;
+
+		// the modem stats only change when a modem frame runs
+		if (dv->modemFrames() != lastModemFrames) {
+			lastModemFrames = dv->modemFrames();
+			if (mode == ModesDV::RX) {
+				bs = dv->stats();
+				df = dv->df();
+				if (bs.sync)
+					++syncFrames;
+			}
+		}
+
+		if (stats) {
+			stats << callbacks << ',' << dv->modemFrames() << ',' << (bs.sync ? 1 : 0) << ','
+			      << bs.snr << ',' << df << ',' << dv->inputDepth() << ',' << dv->outputDepth() << ','
+			      << usec << '\n';
+		}
+		if (output) {
+			for (size_t i = 0; i != win; ++i)
+				monoBuf[i] = outBuf[i * chOut];
+			sf_writef_float(output, &monoBuf[0], win);
+		}
+	}
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	// summary
+	const double audio = static_cast<double>(callbacks * win) / CARD_FS;
+	std::cout << "callbacks:    " << callbacks << std::endl;
+	std::cout << "modem frames: " << dv->modemFrames() << std::endl;
+	if (mode == ModesDV::RX)
+		std::cout << "sync frames:  " << syncFrames << std::endl;
+	std::cout << "audio time:   " << audio << " s" << std::endl;
+	std::cout << "wall time:    " << wall << " s" << std::endl;
+	std::cout << "DSP load:     " << (audio > 0 ? (100.0 * busy / 1e6 / audio) : 0) << " %" << std::endl;
+	std::cout << "callback us:  p50=" << timer.percentile(0.50) << " p99=" << timer.percentile(0.99)
+	          << " max=" << timer.max() << std::endl;
+
+	delete dv;
+	sf_close(input);
+	if (output)
+		sf_close(output);
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,305 @@
+/*
+ *
+ *
+ *    fdvresbench.cc
+ *
+ *    Rate converter benchmark: compares the single-stage FIR filter that
+ *    fdvcore used to use between the card and modem rates with the
+ *    half-band and polyphase cascade in Resampler.h, for speed, cost in
+ *    multiplies, and alias and image rejection.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include "localtypes.h"
+#include "FirFilter.h"
+#include "Resampler.h"
+
+// the filter that the cascade replaced
+#define OLD_FILTER_LEN 15
+#define OLD_FILTER_COF 2800
+
+// the reference tone, and the step of the stopband sweep (Hz)
+#define REF_TONE 1000.0
+#define SWEEP_STEP 100.0
+
+
+//
+//  the single-stage decimator and interpolator, as fdvcore had them
+//
+class OldDecimator {
+	private:
+		KK5JY::DSP::FirFilter<float> m_Filter;
+		size_t m_Ratio;
+		size_t m_Count;
+
+	public:
+		OldDecimator(size_t ratio, unsigned rate)
+			: m_Filter(KK5JY::DSP::FirFilter<float>::Types::LowPass, OLD_FILTER_LEN, OLD_FILTER_COF, rate),
+			  m_Ratio(ratio),
+			  m_Count(0) { }
+
+		bool write(float x, float &y) {
+			x = m_Filter.filter(x);
+			if (++m_Count != m_Ratio)
+				return false;
+			m_Count = 0;
+			y = x;
+			return true;
+		}
+
+		double macs() const {
+			return OLD_FILTER_LEN;
+		}
+};
+
+class OldInterpolator {
+	private:
+		KK5JY::DSP::FirFilter<float> m_Filter;
+		size_t m_Ratio;
+
+	public:
+		OldInterpolator(size_t ratio, unsigned rate)
+			: m_Filter(KK5JY::DSP::FirFilter<float>::Types::LowPass, OLD_FILTER_LEN, OLD_FILTER_COF, rate),
+			  m_Ratio(ratio) { }
+
+		void write(float x, float *y) {
+			for (size_t j = 0; j != m_Ratio; ++j)
+				y[j] = m_Filter.filter(x);
+		}
+
+		double macs() const {
+			return OLD_FILTER_LEN;
+		}
+};
+
+
+/*
+ *
+ *   level(...) - the amplitude of frequency 'f' in 'x', by correlation
+ *
+ */
+static double level(const std::vector<float> &x, size_t skip, double f, double rate) {
+	double re = 0, im = 0;
+	const double w = 2.0 * M_PI * f / rate;
+	for (size_t n = skip; n < x.size(); ++n) {
+		re += x[n] * cos(w * n);
+		im -= x[n] * sin(w * n);
+	}
+	return 2.0 * sqrt(re * re + im * im) / (x.size() - skip);
+}
+
+
+/*
+ *
+ *   decimate(...) - run a tone at 'f' through a decimator
+ *
+ */
+template <typename D>
+static std::vector<float> decimate(D &d, double f, double rate, size_t samples) {
+	std::vector<float> result;
+	for (size_t n = 0; n != samples; ++n) {
+		float y;
+		if (d.write(0.5 * sin(2.0 * M_PI * f * n / rate), y))
+			result.push_back(y);
+	}
+	return result;
+}
+
+
+/*
+ *
+ *   interpolate(...) - run a tone at 'f' through an interpolator
+ *
+ */
+template <typename I>
+static std::vector<float> interpolate(I &i, size_t ratio, double f, size_t samples) {
+	std::vector<float> result(samples * ratio);
+	for (size_t n = 0; n != samples; ++n)
+		i.write(0.5 * sin(2.0 * M_PI * f * n / MODEM_FS), &result[n * ratio]);
+	return result;
+}
+
+
+/*
+ *
+ *   aliasing(...) - the worst alias, relative to the passband, in dB, of
+ *                   stopband tones that fold into the modem passband
+ *
+ */
+template <typename D>
+static double aliasing(size_t ratio, unsigned rate) {
+	const size_t samples = ratio * MODEM_FS / 4;
+	D ref(ratio, rate);
+	const double gain = level(decimate(ref, REF_TONE, rate, samples), 200, REF_TONE, MODEM_FS);
+	double worst = 0;
+	for (double f = MODEM_FS - FILTER_PASS; f < rate / 2.0; f += SWEEP_STEP) {
+		const double alias = fabs(f - MODEM_FS * floor(f / MODEM_FS + 0.5));
+		if (alias > FILTER_PASS || alias < SWEEP_STEP)
+			continue;
+		D d(ratio, rate);
+		worst = std::max(worst, level(decimate(d, f, rate, samples), 200, alias, MODEM_FS) / gain);
+	}
+	return 20 * log10(worst + 1e-12);
+}
+
+
+/*
+ *
+ *   imaging(...) - the worst image, relative to the tone, in dB, of
+ *                  passband tones
+ *
+ */
+template <typename I>
+static double imaging(size_t ratio, unsigned rate) {
+	const size_t samples = MODEM_FS / 4;
+	double worst = 0;
+	for (double f = SWEEP_STEP; f <= FILTER_PASS; f += SWEEP_STEP) {
+		I i(ratio, rate);
+		const std::vector<float> y = interpolate(i, ratio, f, samples);
+		const double gain = level(y, 200 * ratio, f, rate);
+		for (size_t k = 1; k <= ratio / 2; ++k) {
+			worst = std::max(worst, level(y, 200 * ratio, k * MODEM_FS - f, rate) / gain);
+			if (k * MODEM_FS + f < rate / 2.0)
+				worst = std::max(worst, level(y, 200 * ratio, k * MODEM_FS + f, rate) / gain);
+		}
+	}
+	return 20 * log10(worst + 1e-12);
+}
+
+
+/*
+ *
+ *   speed...(...) - nanoseconds per card-rate sample
+ *
+ */
+template <typename D>
+static double speedDecimate(D &d, size_t samples) {
+	std::vector<float> x(samples);
+	for (size_t n = 0; n != samples; ++n)
+		x[n] = (rand() / (float)RAND_MAX) - 0.5f;
+	float sink = 0, y;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t n = 0; n != samples; ++n)
+		if (d.write(x[n], y))
+			sink += y;
+	const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	if (sink == 12345.0f)
+		std::cerr << sink;
+	return ns / samples;
+}
+
+template <typename I>
+static double speedInterpolate(I &i, size_t ratio, size_t samples) {
+	std::vector<float> y(ratio);
+	float sink = 0;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t n = 0; n != samples / ratio; ++n) {
+		i.write((rand() / (float)RAND_MAX) - 0.5f, &y[0]);
+		sink += y[0];
+	}
+	const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	if (sink == 12345.0f)
+		std::cerr << sink;
+	return ns / samples;
+}
+
+
+//
+//  the cascade, with the constructor signature of the old filter
+//
+struct NewDecimator : public KK5JY::DSP::Decimator<float> {
+	NewDecimator(size_t ratio, unsigned rate)
+		: KK5JY::DSP::Decimator<float>(ratio, rate, FILTER_PASS, FILTER_ATTEN) { }
+};
+
+struct NewInterpolator : public KK5JY::DSP::Interpolator<float> {
+	NewInterpolator(size_t ratio, unsigned rate)
+		: KK5JY::DSP::Interpolator<float>(ratio, rate, FILTER_PASS, FILTER_ATTEN) { }
+};
+
+
+/*
+ *
+ *   report(...)
+ *
+ */
+static void report(const std::string &name, double macs, double ns, double reject) {
+	std::cout << std::left << std::setw(14) << name << std::right << std::fixed
+	          << std::setprecision(1) << std::setw(10) << macs
+	          << std::setprecision(2) << std::setw(10) << ns
+	          << std::setprecision(1) << std::setw(12) << reject << std::endl;
+}
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvresbench [options]" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -r <rate>   - the card rate, a multiple of " << MODEM_FS << " (default " << CARD_FS << ")" << std::endl;
+	std::cerr <<  "       -s <secs>   - seconds of audio timed per converter (default 60)" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       Reports multiplies and nanoseconds per card-rate sample, and the" << std::endl;
+	std::cerr <<  "       worst alias (decimation) or image (interpolation) of a tone," << std::endl;
+	std::cerr <<  "       relative to the tone itself." << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	unsigned rate = CARD_FS;
+	size_t seconds = 60;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:s:h")) != -1) {
+		switch (opt) {
+			case 'r': rate = atoi(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			default: usage(); return 1;
+		}
+	}
+	if (rate < 2 * MODEM_FS || (rate % MODEM_FS) != 0 || seconds == 0) {
+		usage();
+		return 1;
+	}
+	const size_t ratio = rate / MODEM_FS;
+	const size_t samples = seconds * rate;
+
+	OldDecimator od(ratio, rate);
+	NewDecimator nd(ratio, rate);
+	OldInterpolator oi(ratio, rate);
+	NewInterpolator ni(ratio, rate);
+
+	std::cout << rate << " <-> " << MODEM_FS << ", passband " << FILTER_PASS << " Hz:" << std::endl;
+	std::cout << std::left << std::setw(14) << "CONVERTER" << std::right
+	          << std::setw(10) << "MAC/smp" << std::setw(10) << "ns/smp"
+	          << std::setw(12) << "worst dB" << std::endl;
+	report("old decimate", od.macs(), speedDecimate(od, samples), aliasing<OldDecimator>(ratio, rate));
+	report("new decimate", nd.macs(), speedDecimate(nd, samples), aliasing<NewDecimator>(ratio, rate));
+	report("old interp", oi.macs(), speedInterpolate(oi, ratio, samples), imaging<OldInterpolator>(ratio, rate));
+	report("new interp", ni.macs(), speedInterpolate(ni, ratio, samples), imaging<NewInterpolator>(ratio, rate));
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,350 @@
+/*
+ *
+ *
+ *    fdvsim.cc
+ *
+ *    Channel simulator: runs the SoundCardDV TX chain, an HF channel
+ *    model, and the SoundCardDV RX chain, sweeping modems and SNR points
+ *    in parallel, and reports sync time, frame error rate, and CPU cost.
+ *
+ *    Copyright (C) 2018 by Matt Roberts.
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <sndfile.h>
+#include "stype.h"
+#include "localtypes.h"
+#include "scdv.h"
+#include "modems.h"
+#include "channel.h"
+
+// the number of frames per callback, same as fdvcore
+#define SIM_WINDOW_SIZE (512)
+
+// CCIR 'poor' channel: two paths, 2 ms apart, 1 Hz Doppler spread
+#define SIM_FADING_DELAY 0.002
+#define SIM_FADING_DOPPLER 1.0
+
+
+//
+//  one point in the sweep
+//
+struct sim_job {
+	std::string name;
+	int modem;
+	float snr;
+
+	// results
+	bool ok;
+	float sync_time;      // seconds to first sync; negative if never
+	uint64_t frames;      // RX modem frames after first sync
+	uint64_t errors;      // ...of which were in error
+	int bits;             // test frame bits (no speech file)
+	int bit_errors;
+	double tx_cpu;        // CPU seconds per audio second
+	double rx_cpu;
+};
+
+
+//
+//  thread CPU time, in seconds
+//
+static double cpuTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+//
+//  sim_config - settings shared by every job
+//
+struct sim_config {
+	double seconds;
+	float offset;
+	bool fading;
+	const std::vector<float> *speech;
+};
+
+
+/*
+ *
+ *   runJob(...) - TX, channel, and RX for one modem and SNR
+ *
+ */
+static void runJob(sim_job &job, const sim_config &cfg, unsigned seed) {
+	job.ok = false;
+	job.sync_time = -1;
+	job.frames = job.errors = 0;
+	job.bits = job.bit_errors = 0;
+
+	const size_t win = SIM_WINDOW_SIZE;
+	const size_t blocks = static_cast<size_t>(cfg.seconds * CARD_FS) / win;
+	const bool testFrames = cfg.speech->empty();
+	std::vector<float> signal(blocks * win);
+	std::vector<float> in(win), out(win);
+
+	try {
+		VirtualCard vc(1, 1);
+
+		//
+		//  TX: speech (or test frames) to modem audio
+		//
+		{
+			SoundCardDV tx(job.modem, 0, win, &vc);
+			tx.testFrames(testFrames);
+			tx.mode(ModesDV::TX);
+			size_t pos = 0;
+			const double start = cpuTime();
+			for (size_t b = 0; b != blocks; ++b) {
+				for (size_t i = 0; i != win; ++i) {
+					if (testFrames) {
+						in[i] = 0;
+					} else {
+						in[i] = (*cfg.speech)[pos];
+						pos = (pos + 1) % cfg.speech->size();
+					}
+				}
+				tx.drive(&in[0], &signal[b * win], win);
+			}
+			job.tx_cpu = (cpuTime() - start) / cfg.seconds;
+		}
+
+		//
+		//  CHANNEL: measure the signal power once the modem is running
+		//
+		size_t first = 0;
+		while (first != signal.size() && signal[first] == 0)
+			++first;
+		double power = 0;
+		for (size_t i = first; i < signal.size(); ++i)
+			power += signal[i] * signal[i];
+		if (first != signal.size())
+			power /= (signal.size() - first);
+
+		ChannelModel channel(CARD_FS, cfg.offset, cfg.fading, SIM_FADING_DOPPLER, SIM_FADING_DELAY, seed);
+		channel.noise(power, job.snr);
+		channel.apply(&signal[0], signal.size());
+
+		//
+		//  RX: modem audio back to speech
+		//
+		SoundCardDV rx(job.modem, 0, win, &vc);
+		rx.testFrames(testFrames);
+		rx.mode(ModesDV::RX);
+		uint64_t lastFrames = 0;
+		int lastErrors = 0;
+		double busy = 0;
+		for (size_t b = 0; b != blocks; ++b) {
+			const double start = cpuTime();
+			rx.drive(&signal[b * win], &out[0], win);
+			busy += cpuTime() - start;
+
+			if (rx.modemFrames() == lastFrames)
+				continue;
+			lastFrames = rx.modemFrames();
+
+			const bool sync = rx.sync();
+			if (sync && job.sync_time < 0)
+				job.sync_time = static_cast<float>((b + 1) * win) / CARD_FS;
+			if (job.sync_time < 0)
+				continue;
+
+			// count frames from first sync onward
+			++job.frames;
+			bool bad = !sync;
+			if (testFrames) {
+				const int errors = rx.testBitErrors();
+				if (errors != lastErrors)
+					bad = true;
+				lastErrors = errors;
+			}
+			if (bad)
+				++job.errors;
+		}
+		job.rx_cpu = busy / cfg.seconds;
+		if (testFrames) {
+			job.bits = rx.testBits();
+			job.bit_errors = rx.testBitErrors();
+		}
+		job.ok = true;
+	}
+	catch (const std::exception &e) {
+		std::cerr << job.name << " @ " << job.snr << " dB: " << e.what() << std::endl;
+	}
+}
+
+
+/*
+ *
+ *   usage()
+ *
+ */
+void usage() {
+	std::cerr << std::endl;
+	std::cerr <<  "Usage: fdvsim [options]" << std::endl;
+	std::cerr << std::endl;
+	std::cerr <<  "       -m <list>   - comma-separated modems (default: all) { " FDV_MODES " }" << std::endl;
+	std::cerr <<  "       -s <a:b:c>  - SNR sweep in dB, from a to b in steps of c (default 0:10:2)" << std::endl;
+	std::cerr <<  "       -d <sec>    - seconds of audio per point (default 30)" << std::endl;
+	std::cerr <<  "       -f <Hz>     - frequency offset (default 0)" << std::endl;
+	std::cerr <<  "       -F          - two-path Rayleigh fading (CCIR poor)" << std::endl;
+	std::cerr <<  "       -S <file>   - 48kHz speech WAV; default sends modem test frames" << std::endl;
+	std::cerr <<  "       -j <n>      - worker threads (default: all cores)" << std::endl;
+	std::cerr <<  "       -c <file>   - also write the results as CSV" << std::endl;
+	std::cerr << std::endl;
+}
+
+
+/*
+ *
+ *   main()
+ *
+ */
+int main(int argc, char **argv) {
+	std::string modems = "1600,700C,800XA";
+	#ifdef FREEDV_MODE_700D
+	modems += ",700D";
+	#endif
+	float snrFrom = 0, snrTo = 10, snrStep = 2;
+	sim_config cfg;
+	cfg.seconds = 30;
+	cfg.offset = 0;
+	cfg.fading = false;
+	std::string speechPath, csvPath;
+	unsigned threads = std::thread::hardware_concurrency();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:s:d:f:FS:j:c:")) != -1) {
+		switch (opt) {
+			case 'm': modems = my::toUpper(optarg); break;
+			case 's':
+				if (sscanf(optarg, "%f:%f:%f", &snrFrom, &snrTo, &snrStep) != 3 || snrStep <= 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 'd': cfg.seconds = atof(optarg); break;
+			case 'f': cfg.offset = atof(optarg); break;
+			case 'F': cfg.fading = true; break;
+			case 'S': speechPath = optarg; break;
+			case 'j': threads = atoi(optarg); break;
+			case 'c': csvPath = optarg; break;
+			default: usage(); return 1;
+		}
+	}
+	if (cfg.seconds <= 0) {
+		usage();
+		return 1;
+	}
+	if (threads == 0)
+		threads = 1;
+
+	// load the speech, first channel only
+	std::vector<float> speech;
+	if (!speechPath.empty()) {
+		SF_INFO info;
+		memset(&info, 0, sizeof(info));
+		SNDFILE *f = sf_open(speechPath.c_str(), SFM_READ, &info);
+		if (!f) {
+			std::cerr << "Could not open " << speechPath << ": " << sf_strerror(0) << std::endl;
+			return 1;
+		}
+		if (info.samplerate != CARD_FS) {
+			std::cerr << "Speech must be sampled at " << CARD_FS << " Hz" << std::endl;
+			sf_close(f);
+			return 1;
+		}
+		std::vector<float> frame(info.channels);
+		while (sf_readf_float(f, &frame[0], 1) == 1)
+			speech.push_back(frame[0]);
+		sf_close(f);
+		if (speech.empty()) {
+			std::cerr << "No audio in " << speechPath << std::endl;
+			return 1;
+		}
+	}
+	cfg.speech = &speech;
+
+	// build the job list
+	std::vector<sim_job> jobs;
+	std::stringstream list(modems);
+	std::string name;
+	while (std::getline(list, name, ',')) {
+		name = my::strip(name);
+		const int modem = parseModem(name.c_str());
+		if (modem == -1) {
+			std::cerr << "Unknown modem: " << name << std::endl;
+			return 1;
+		}
+		for (float snr = snrFrom; snr <= snrTo + (snrStep / 2); snr += snrStep) {
+			sim_job job;
+			job.name = name;
+			job.modem = modem;
+			job.snr = snr;
+			jobs.push_back(job);
+		}
+	}
+
+	// run the jobs on a pool of threads
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+	for (unsigned t = 0; t != threads; ++t) {
+		pool.push_back(std::thread([&]() {
+			for (size_t j = next++; j < jobs.size(); j = next++) {
+				runJob(jobs[j], cfg, j + 1);
+			}
+		}));
+	}
+	for (size_t t = 0; t != pool.size(); ++t)
+		pool[t].join();
+
+	// report
+	std::ofstream csv;
+	if (!csvPath.empty()) {
+		csv.open(csvPath.c_str());
+		csv << "modem,snr_db,offset_hz,fading,sync_s,frames,fer,ber,tx_cpu,rx_cpu" << std::endl;
+	}
+	std::cout << std::left << std::setw(7) << "MODEM" << std::right
+	          << std::setw(7) << "SNR" << std::setw(9) << "SYNC_S" << std::setw(8) << "FRAMES"
+	          << std::setw(8) << "FER" << std::setw(10) << "BER"
+	          << std::setw(8) << "TX_CPU" << std::setw(8) << "RX_CPU" << std::endl;
+	for (size_t j = 0; j != jobs.size(); ++j) {
+		const sim_job &r = jobs[j];
+		if (!r.ok)
+			continue;
+		const double fer = r.frames ? static_cast<double>(r.errors) / r.frames : 1.0;
+		const double ber = r.bits ? static_cast<double>(r.bit_errors) / r.bits : -1.0;
+		std::cout << std::left << std::setw(7) << r.name << std::right << std::fixed
+		          << std::setw(7) << std::setprecision(1) << r.snr
+		          << std::setw(9) << std::setprecision(2) << r.sync_time
+		          << std::setw(8) << r.frames
+		          << std::setw(8) << std::setprecision(3) << fer
+		          << std::setw(10) << std::setprecision(5) << ber
+		          << std::setw(7) << std::setprecision(1) << (100.0 * r.tx_cpu) << '%'
+		          << std::setw(7) << std::setprecision(1) << (100.0 * r.rx_cpu) << '%' << std::endl;
+		if (csv) {
+			csv << r.name << ',' << r.snr << ',' << cfg.offset << ',' << (cfg.fading ? 1 : 0) << ','
+			    << r.sync_time << ',' << r.frames << ',' << fer << ',' << ber << ','
+			    << r.tx_cpu << ',' << r.rx_cpu << std::endl;
+		}
+	}
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,130 @@
+/*
+ *
+ *
+ *    latency.cc
+ *
+ *    LatencyProbe class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "latency.h"
+#include "FFT.h"
+#include <algorithm>
+#include <complex>
+#include <cmath>
+
+
+//
+//  LatencyProbe::ctor
+//
+LatencyProbe::LatencyProbe(unsigned rate)
+	: m_Rate(rate),
+	  m_Chirp(static_cast<size_t>(rate) * LATENCY_CHIRP_MS / 1000),
+	  m_Capture(static_cast<size_t>(rate) * (LATENCY_CHIRP_MS + LATENCY_MAX_MS) / 1000),
+	  m_Pos(0),
+	  m_Done(false) {
+	// a linear sweep, as wide as the rate allows, for a narrow peak
+	const double f0 = LATENCY_CHIRP_LOW;
+	const double f1 = std::min(LATENCY_CHIRP_HIGH, 0.4 * rate);
+	const double t1 = static_cast<double>(m_Chirp.size()) / rate;
+	const size_t taper = static_cast<size_t>(rate) * LATENCY_TAPER_MS / 1000;
+	for (size_t n = 0; n != m_Chirp.size(); ++n) {
+		const double t = static_cast<double>(n) / rate;
+		double gain = LATENCY_LEVEL;
+
+		// raised-cosine ends, so the card hears no clicks
+		const size_t edge = std::min(n, m_Chirp.size() - 1 - n);
+		if (edge < taper)
+			gain *= 0.5 - 0.5 * cos(M_PI * edge / taper);
+		m_Chirp[n] = gain * sin(2.0 * M_PI * (f0 * t + 0.5 * (f1 - f0) * t * t / t1));
+	}
+}
+
+
+//
+//  LatencyProbe::process(...) - play and record one callback's worth
+//
+void LatencyProbe::process(const float *in, uint16_t ci, float *out, uint16_t co, size_t count) {
+	if (m_Done.load(std::memory_order_relaxed))
+		return;
+	for (size_t i = 0; i != count; ++i) {
+		const float sample = (m_Pos < m_Chirp.size()) ? m_Chirp[m_Pos] : 0;
+		for (size_t j = 0; j != co; ++j)
+			*out++ = sample;
+		if (m_Pos != m_Capture.size())
+			m_Capture[m_Pos++] = *in;
+		in += ci;
+	}
+	if (m_Pos == m_Capture.size())
+		m_Done.store(true);
+}
+
+
+//
+//  LatencyProbe::result(...) - find the chirp in the recording
+//
+bool LatencyProbe::result(double &ms, double &quality) const {
+	typedef std::complex<double> complex_t;
+	ms = 0;
+	quality = 0;
+	if (!done())
+		return false;
+
+	// correlate by FFT: X * conj(C), long enough not to wrap
+	const size_t nc = m_Chirp.size();
+	const size_t nx = m_Capture.size();
+	size_t n = 2;
+	while (n < nx + nc)
+		n <<= 1;
+	KK5JY::DSP::FFT<double> fft(n);
+	std::vector<complex_t> x(n, complex_t(0, 0));
+	std::vector<complex_t> c(n, complex_t(0, 0));
+	for (size_t i = 0; i != nx; ++i)
+		x[i] = complex_t(m_Capture[i], 0);
+	for (size_t i = 0; i != nc; ++i)
+		c[i] = complex_t(m_Chirp[i], 0);
+	fft.forward(&x[0]);
+	fft.forward(&c[0]);
+	for (size_t i = 0; i != n; ++i)
+		x[i] *= std::conj(c[i]);
+	fft.inverse(&x[0]);
+
+	// the strongest lag, of either polarity
+	const size_t lags = nx - nc + 1;
+	size_t peak = 0;
+	for (size_t k = 1; k != lags; ++k)
+		if (fabs(x[k].real()) > fabs(x[peak].real()))
+			peak = k;
+	const double sign = (x[peak].real() < 0) ? -1.0 : 1.0;
+
+	// normalize by the energy of the chirp, and of the recording under it
+	double ec = 0, ex = 0;
+	for (size_t i = 0; i != nc; ++i) {
+		ec += static_cast<double>(m_Chirp[i]) * m_Chirp[i];
+		ex += static_cast<double>(m_Capture[peak + i]) * m_Capture[peak + i];
+	}
+	if (ec <= 0 || ex <= 0)
+		return false;
+	quality = fabs(x[peak].real()) / sqrt(ec * ex);
+
+	// refine the peak between samples
+	double offset = 0;
+	if (peak != 0 && peak + 1 != lags) {
+		const double a = sign * x[peak - 1].real();
+		const double b = sign * x[peak].real();
+		const double d = sign * x[peak + 1].real();
+		const double den = a - 2 * b + d;
+		if (den < 0)
+			offset = std::max(-0.5, std::min(0.5, 0.5 * (a - d) / den));
+	}
+	ms = 1000.0 * (peak + offset) / m_Rate;
+	return quality >= LATENCY_MIN_QUALITY;
+}
+
+// EOF
@@ -0,0 +1,99 @@
+/*
+ *
+ *
+ *    latency.h
+ *
+ *    LatencyProbe class: round-trip audio latency, by loopback.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_LATENCY_H
+#define __FDVCORE_LATENCY_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+// the test chirp: its length, sweep, taper, and level
+#define LATENCY_CHIRP_MS 250
+#define LATENCY_CHIRP_LOW 200.0
+#define LATENCY_CHIRP_HIGH 8000.0
+#define LATENCY_TAPER_MS 5
+#define LATENCY_LEVEL 0.5
+
+// the longest round trip searched for
+#define LATENCY_MAX_MS 1000
+
+// the normalized correlation below which no echo was found
+#define LATENCY_MIN_QUALITY 0.2
+
+
+//
+//  the analytic latency of each pipeline stage, in milliseconds
+//
+struct pipeline_latency {
+	double card;          // one callback window, in and out
+	double decimator;     // group delay of the decimation cascade
+	double rx_filter;     // RX channel filter, group and FFT delay
+	double in_buffer;     // samples waiting for the modem
+	double frame;         // one modem (RX) or speech (TX) frame
+	double out_buffer;    // samples waiting for the sound card
+	double interpolator;  // group delay of the interpolation cascade
+	double total;
+};
+
+
+//
+//  LatencyProbe - plays a chirp on every output channel, records the
+//                 left input, and finds the chirp in the recording
+//
+//  The audio thread calls process() from each callback, replacing the
+//  output, until the recording is full; the control thread then calls
+//  result(), which cross-correlates the two by FFT.  The lag of the
+//  correlation peak, refined by a parabola through its neighbors, is the
+//  round trip from the output buffer, through the card and a loopback
+//  cable, to the input buffer.
+//
+class LatencyProbe {
+	private:
+		const unsigned m_Rate;
+		std::vector<float> m_Chirp;
+		std::vector<float> m_Capture;
+		size_t m_Pos;
+		std::atomic<bool> m_Done;
+
+	private:
+		LatencyProbe(const LatencyProbe&);
+		LatencyProbe &operator=(const LatencyProbe&);
+
+	public:
+		LatencyProbe(unsigned rate);
+
+	public:
+		// play and record one callback's worth (audio thread)
+		void process(const float *in, uint16_t ci, float *out, uint16_t co, size_t count);
+
+		// returns true once the recording is full
+		bool done() const {
+			return m_Done.load();
+		}
+
+		// the length of the measurement, in seconds
+		double seconds() const {
+			return static_cast<double>(m_Capture.size()) / m_Rate;
+		}
+
+		// find the chirp in the recording (control thread, after done());
+		//    sets the round trip in milliseconds and the normalized peak
+		//    correlation, and returns false if no echo was found
+		bool result(double &ms, double &quality) const;
+};
+
+#endif
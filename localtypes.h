@@ -32,11 +32,34 @@
 #define CARD_FS 48000
 #define MODEM_FS 8000
 
-// the length of the FIR decimation and interpolation filters
-#define FILTER_LEN 15
-
-// the filter cutoff (in Hz)
-#define FILTER_COF 2800
+// the decimation and interpolation passband edge (in Hz), and stopband
+//    attenuation (in dB); the stopband starts where aliases would fall
+//    back into the passband, at MODEM_FS - FILTER_PASS
+#define FILTER_PASS 3000
+#define FILTER_ATTEN 60
+
+// the range of designs that the FILTER command accepts
+#define FILTER_MIN_PASS 500
+#define FILTER_MIN_TRANSITION 250
+#define FILTER_MIN_ATTEN 20
+#define FILTER_MAX_ATTEN 120
+
+// the RX channel filter: default length, longest length, and the most
+//    delay that its FFT convolution may add
+#define RXFILTER_TAPS 255
+#define RXFILTER_MAX_TAPS 2047
+#define RXFILTER_MAX_DELAY_MS 100
+
+// the FFT length used by the spectrum monitor
+#define SPECTRUM_FFT_LEN 512
+
+// received text held for the reader, in characters
+#define RX_TEXT_LEN 256
+
+// RX energy gate: input kept for the demodulator when it wakes, and how
+//    long it stays awake after the channel goes quiet
+#define GATE_LOOKBACK_MS 200
+#define GATE_HANG_MS 2000
 
 //
 //  Device Modes
@@ -66,6 +89,7 @@ struct basic_stats {
 
 
 #include <exception>
+#include "TxText.h"
 
 //
 //  local_exception
@@ -87,14 +111,15 @@ class local_exception : public std::exception {
 //
 //  callback state
 //
-//  Used to track the TX string state and the number of protocol calls made
-//  by the modem.
+//  Used to track the TX string state, the received text, and the number
+//  of protocol calls made by the modem.
 //
 struct local_callback_state {
-    // the string data
-	char  tx_str[128];
-	// the next character to transmit
-	char *ptx_str;
+	// the TX text messages
+	TxTextQueue text;
+
+	// received text, from the modem thread to the reader
+	LockFreeRing<char> received;
 
 	// the number of times called
 	size_t calls;
@@ -102,10 +127,8 @@ struct local_callback_state {
 	//
 	//  ctor
 	//
-	local_callback_state() {
-		 strcpy(tx_str, "fdvcore...");
-		 ptx_str = tx_str;
-		 calls = 0;
+	local_callback_state() : text(DEFAULT_TEXT), received(RX_TEXT_LEN), calls(0) {
+		// nop
 	}
 };
 
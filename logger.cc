@@ -0,0 +1,482 @@
+/*
+ *
+ *
+ *    logger.cc
+ *
+ *    Logger class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "logger.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <syslog.h>
+
+
+//
+//  one thread's ring; written by that thread, read by the formatter
+//
+struct log_ring {
+	log_record records[LOG_RING_LEN];
+	std::atomic<uint64_t> head;   // records ever written
+	std::atomic<uint64_t> tail;   // records ever read
+	std::atomic<uint64_t> lost;
+	std::atomic<bool> used;       // claimed by a thread
+
+	log_ring() : head(0), tail(0), lost(0), used(false) { }
+};
+
+
+//
+//  one message(), as queued
+//
+struct log_text {
+	uint64_t ns;
+	LogLevels level;
+	std::string text;
+};
+
+
+//
+//  the rate limit of one call site, in the formatter
+//
+struct log_site {
+	time_t second;
+	unsigned count;
+	uint64_t held;
+	LogLevels level;
+
+	log_site() : second(0), count(0), held(0), level(LogInfo) { }
+};
+
+
+// the call sites seen, by format string
+typedef std::map<const char*, log_site> log_sites;
+
+
+// the rings, allocated by start(); never freed, since a thread may log
+//    at any time until exit
+static log_ring *s_Rings[LOG_MAX_THREADS];
+static std::atomic<size_t> s_Ready(0);
+static std::atomic<uint64_t> s_Unowned(0);   // records with no ring
+
+// the queued messages, and stderr before the formatter starts
+static std::mutex s_Lock;
+static std::vector<log_text> s_Texts;
+
+// the formatter and its target
+static std::thread s_Formatter;
+static std::atomic<bool> s_Running(false);
+static std::string s_Target;
+static FILE *s_File = 0;
+static bool s_Syslog = false;
+static std::atomic<uint64_t> s_Lost(0);
+static std::atomic<uint64_t> s_Suppressed(0);
+
+std::atomic<int> Logger::s_Level(LogInfo);
+
+
+//
+//  log_owner - this thread's ring, returned when the thread exits
+//
+struct log_owner {
+	log_ring *ring;
+
+	log_owner() : ring(0) { }
+	~log_owner() {
+		if (ring)
+			ring->used.store(false, std::memory_order_release);
+	}
+};
+
+static thread_local log_owner t_Owner;
+
+
+//
+//  claim() - take a free ring for this thread, or none if all are in
+//            use; never blocks
+//
+static log_ring *claim() {
+	const size_t ready = s_Ready.load(std::memory_order_acquire);
+	for (size_t i = 0; i != ready; ++i) {
+		log_ring *r = s_Rings[i];
+		bool expected = false;
+		if (!r->used.load(std::memory_order_relaxed) &&
+		    r->used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			t_Owner.ring = r;
+			return r;
+		}
+	}
+	return 0;
+}
+
+
+//
+//  now() - wall clock nanoseconds
+//
+static inline uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//
+//  format(...) - expand one record into 'buf'
+//
+//  Each conversion is rebuilt for the type the argument was stored with,
+//  so that snprintf() always gets what it expects.
+//
+static void format(const log_record &r, char *buf, size_t len) {
+	const char *f = r.format;
+	size_t n = 0;
+	size_t next = 0;
+	while (*f && n + 1 < len) {
+		if (*f != '%') {
+			buf[n++] = *f++;
+			continue;
+		}
+		if (f[1] == '%') {
+			buf[n++] = '%';
+			f += 2;
+			continue;
+		}
+
+		// flags, width, and precision are kept; length modifiers are not
+		char spec[32];
+		size_t s = 0;
+		spec[s++] = *f++;
+		while (*f && strchr("-+ #0123456789.", *f) && s < sizeof(spec) - 4)
+			spec[s++] = *f++;
+		while (*f && strchr("hlLqjzt", *f))
+			++f;
+		const char conv = *f;
+		if (!conv)
+			break;
+		++f;
+
+		const log_arg *a = (next < r.count) ? &r.args[next++] : 0;
+		int w = 0;
+		if (!a) {
+			w = snprintf(buf + n, len - n, "?");
+		} else if (strchr("diouxXc", conv)) {
+			const long long v = (a->type == 'd') ? static_cast<long long>(a->d) : a->i;
+			if (conv != 'c') {
+				spec[s++] = 'l';
+				spec[s++] = 'l';
+			}
+			spec[s++] = conv;
+			spec[s] = 0;
+			w = (conv == 'c') ? snprintf(buf + n, len - n, spec, static_cast<int>(v)) : snprintf(buf + n, len - n, spec, v);
+		} else if (strchr("eEfgGaA", conv)) {
+			const double v = (a->type == 'd') ? a->d : (a->type == 'u') ? static_cast<double>(a->u) : static_cast<double>(a->i);
+			spec[s++] = conv;
+			spec[s] = 0;
+			w = snprintf(buf + n, len - n, spec, v);
+		} else if (conv == 's') {
+			spec[s++] = conv;
+			spec[s] = 0;
+			w = snprintf(buf + n, len - n, spec, (a->type == 's' && a->s) ? a->s : "?");
+		}
+		if (w > 0)
+			n = std::min(n + w, len - 1);
+	}
+	buf[n] = 0;
+}
+
+
+//
+//  emit(...) - write one formatted line to the target
+//
+static void emit(LogLevels level, uint64_t ns, const char *text) {
+	if (s_Syslog) {
+		static const int priority[] = { LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG };
+		syslog(priority[level], "%s", text);
+	} else if (s_File) {
+		const time_t sec = ns / 1000000000ULL;
+		struct tm tm;
+		localtime_r(&sec, &tm);
+		char stamp[32];
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+		fprintf(s_File, "%s.%03u %s: %s\n", stamp, static_cast<unsigned>((ns / 1000000ULL) % 1000), Logger::name(level), text);
+	} else {
+		fprintf(stderr, "%s: %s\n", Logger::name(level), text);
+	}
+}
+
+
+//
+//  release(...) - report what a call site held back, and start over
+//
+static void release(const char *format, log_site &site, uint64_t ns) {
+	if (site.held) {
+		char text[512];
+		snprintf(text, sizeof(text), "(%llu more like \"%s\")",
+			static_cast<unsigned long long>(site.held), format);
+		emit(site.level, ns, text);
+	}
+	site.second = ns / 1000000000ULL;
+	site.count = 0;
+	site.held = 0;
+}
+
+
+//
+//  drain(...) - format and write everything in the rings; the last
+//                drain reports everything held back
+//
+static void drain(std::vector<log_record> &batch, std::vector<log_text> &texts, log_sites &sites, bool last) {
+	batch.clear();
+	texts.clear();
+	uint64_t lost = s_Unowned.exchange(0);
+	const size_t ready = s_Ready.load(std::memory_order_acquire);
+	for (size_t i = 0; i != ready; ++i) {
+		log_ring *r = s_Rings[i];
+		const uint64_t head = r->head.load(std::memory_order_acquire);
+		uint64_t tail = r->tail.load(std::memory_order_relaxed);
+		for ( ; tail != head; ++tail)
+			batch.push_back(r->records[tail % LOG_RING_LEN]);
+		r->tail.store(tail, std::memory_order_release);
+		lost += r->lost.exchange(0);
+	}
+	{
+		std::lock_guard<std::mutex> l(s_Lock);
+		texts.swap(s_Texts);
+	}
+
+	// every thread's records, and the messages, in time order
+	std::stable_sort(batch.begin(), batch.end(),
+		[](const log_record &a, const log_record &b) { return a.ns < b.ns; });
+	std::stable_sort(texts.begin(), texts.end(),
+		[](const log_text &a, const log_text &b) { return a.ns < b.ns; });
+
+	char text[512];
+	size_t t = 0;
+	for (size_t i = 0; i <= batch.size(); ++i) {
+		while (t != texts.size() && (i == batch.size() || texts[t].ns <= batch[i].ns)) {
+			emit(texts[t].level, texts[t].ns, texts[t].text.c_str());
+			++t;
+		}
+		if (i == batch.size())
+			break;
+
+		const log_record &r = batch[i];
+		log_site &site = sites[r.format];
+		if (static_cast<time_t>(r.ns / 1000000000ULL) != site.second)
+			release(r.format, site, r.ns);
+		if (site.count == LOG_RATE_LIMIT) {
+			++site.held;
+			site.level = r.level;
+			++s_Suppressed;
+			continue;
+		}
+		++site.count;
+		format(r, text, sizeof(text));
+		emit(r.level, r.ns, text);
+	}
+
+	// a site that went quiet still reports what it held back
+	const uint64_t ns = now();
+	for (log_sites::iterator i = sites.begin(); i != sites.end(); ++i)
+		if (i->second.held && (last || static_cast<time_t>(ns / 1000000000ULL) != i->second.second))
+			release(i->first, i->second, ns);
+
+	if (lost) {
+		s_Lost += lost;
+		snprintf(text, sizeof(text), "%llu log records lost", static_cast<unsigned long long>(lost));
+		emit(LogWarning, ns, text);
+	}
+
+	if (s_File)
+		fflush(s_File);
+}
+
+
+//
+//  run() - the formatter thread body
+//
+static void run() {
+	std::vector<log_record> batch;
+	std::vector<log_text> texts;
+	log_sites sites;
+	while (s_Running.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_MS));
+		drain(batch, texts, sites, false);
+	}
+	drain(batch, texts, sites, true);
+}
+
+
+//
+//  Logger::record(...)
+//
+void Logger::record(LogLevels level, const char *format, const log_arg *args, size_t count) {
+	log_record rec;
+	rec.ns = now();
+	rec.format = format;
+	rec.level = level;
+	rec.count = count;
+	for (size_t i = 0; i != count; ++i)
+		rec.args[i] = args[i];
+
+	// with no formatter, the caller does the work
+	if (!s_Running.load(std::memory_order_acquire)) {
+		char text[512];
+		::format(rec, text, sizeof(text));
+		std::lock_guard<std::mutex> l(s_Lock);
+		fprintf(stderr, "%s: %s\n", name(level), text);
+		return;
+	}
+
+	log_ring *r = t_Owner.ring;
+	if (!r && !(r = claim())) {
+		s_Unowned.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	const uint64_t head = r->head.load(std::memory_order_relaxed);
+	if (head - r->tail.load(std::memory_order_acquire) >= LOG_RING_LEN) {
+		r->lost.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	r->records[head % LOG_RING_LEN] = rec;
+	r->head.store(head + 1, std::memory_order_release);
+}
+
+
+//
+//  Logger::message(...)
+//
+void Logger::message(LogLevels level, const std::string &text) {
+	if (!enabled(level))
+		return;
+	log_text m;
+	m.ns = now();
+	m.level = level;
+	m.text = text;
+
+	std::lock_guard<std::mutex> l(s_Lock);
+	if (!s_Running.load(std::memory_order_acquire))
+		fprintf(stderr, "%s: %s\n", name(level), text.c_str());
+	else
+		s_Texts.push_back(m);
+}
+
+
+//
+//  Logger::start(...)
+//
+bool Logger::start(const std::string &target) {
+	if (s_Running.load())
+		return false;
+
+	if (target == "syslog") {
+		openlog("fdvcore", LOG_PID, LOG_USER);
+		s_Syslog = true;
+	} else if (target != "stderr") {
+		s_File = fopen(target.c_str(), "a");
+		if (!s_File)
+			return false;
+	}
+	s_Target = target;
+
+	// every ring is ready before any thread needs one
+	for (size_t i = s_Ready.load(); i != LOG_MAX_THREADS; ++i) {
+		s_Rings[i] = new log_ring;
+		s_Ready.store(i + 1, std::memory_order_release);
+	}
+
+	static bool registered = false;
+	if (!registered) {
+		atexit(stop);
+		registered = true;
+	}
+
+	s_Running.store(true);
+	s_Formatter = std::thread(run);
+	return true;
+}
+
+
+//
+//  Logger::stop()
+//
+void Logger::stop() {
+	if (!s_Running.exchange(false))
+		return;
+	s_Formatter.join();
+
+	if (s_File) {
+		fclose(s_File);
+		s_File = 0;
+	}
+	if (s_Syslog) {
+		closelog();
+		s_Syslog = false;
+	}
+	s_Target.clear();
+}
+
+
+//
+//  Logger::target()
+//
+std::string Logger::target() {
+	return s_Running.load() ? s_Target : std::string();
+}
+
+
+//
+//  Logger::lost() and suppressed()
+//
+uint64_t Logger::lost() {
+	return s_Lost.load();
+}
+
+uint64_t Logger::suppressed() {
+	return s_Suppressed.load();
+}
+
+
+//
+//  Logger::name(...)
+//
+const char *Logger::name(LogLevels l) {
+	switch (l) {
+		case LogError: return "ERROR";
+		case LogWarning: return "WARNING";
+		case LogInfo: return "INFO";
+		case LogDebug: return "DEBUG";
+	}
+	return "?";
+}
+
+
+//
+//  Logger::parse(...)
+//
+bool Logger::parse(const std::string &name, LogLevels &l) {
+	for (int i = LogError; i <= LogDebug; ++i) {
+		if (name == Logger::name(static_cast<LogLevels>(i))) {
+			l = static_cast<LogLevels>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// EOF
@@ -0,0 +1,161 @@
+/*
+ *
+ *
+ *    logger.h
+ *
+ *    Logger class: per-thread record rings, formatted off the hot threads.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_LOGGER_H
+#define __FDVCORE_LOGGER_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+// records kept per thread; when a ring is full, new records are lost
+#define LOG_RING_LEN 1024
+
+// the most threads logging at once; records from a thread past this
+//    are lost
+#define LOG_MAX_THREADS 8
+
+// the most arguments one record carries
+#define LOG_ARGS 6
+
+// records written per second from one call site; the rest are counted
+#define LOG_RATE_LIMIT 10
+
+// how often the formatter drains the rings
+#define LOG_DRAIN_MS 50
+
+//
+//  log levels, most severe first
+//
+typedef enum : uint8_t {
+	LogError,
+	LogWarning,
+	LogInfo,
+	LogDebug,
+} LogLevels;
+
+//
+//  one argument, by value; strings must be literals, or otherwise
+//  outlive the logger
+//
+struct log_arg {
+	char type;  // 'i', 'u', 'd', or 's'
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+		const char *s;
+	};
+};
+
+//
+//  one record, as it sits in a ring
+//
+struct log_record {
+	uint64_t ns;         // CLOCK_REALTIME
+	const char *format;  // a string literal, printf-style
+	LogLevels level;
+	uint8_t count;       // arguments used
+	log_arg args[LOG_ARGS];
+};
+
+
+//
+//  Logger - printf-style logging that never blocks the caller
+//
+//  Each thread writes only to its own ring, so writing takes no lock
+//  and does no formatting.  start() allocates LOG_MAX_THREADS rings; a
+//  thread's first record claims a free one with a compare-and-swap, and
+//  the thread returns it when it exits.  A background thread drains the
+//  rings every LOG_DRAIN_MS, in time order, and formats and writes the
+//  records, LOG_RATE_LIMIT per second from any one format string.  Below
+//  the current level, write() costs one relaxed load.
+//
+//  message() is for the control thread, and other threads that may
+//  block: it takes any text (e.g., an exception's), copies it, and
+//  queues it under a lock, for the same background thread.
+//
+//  Until start() is called, records are formatted and written to
+//  stderr by the caller, as a plain tool would.
+//
+//  Conversions take any numeric argument: "%d" of a size_t is fine,
+//  since each argument is stored with its own type, and converted at
+//  format time.
+//
+class Logger {
+	private:
+		static std::atomic<int> s_Level;
+
+		// add one record to this thread's ring
+		static void record(LogLevels level, const char *format, const log_arg *args, size_t count);
+
+		static log_arg arg(int v) { log_arg a; a.type = 'i'; a.i = v; return a; }
+		static log_arg arg(long v) { log_arg a; a.type = 'i'; a.i = v; return a; }
+		static log_arg arg(long long v) { log_arg a; a.type = 'i'; a.i = v; return a; }
+		static log_arg arg(unsigned v) { log_arg a; a.type = 'u'; a.u = v; return a; }
+		static log_arg arg(unsigned long v) { log_arg a; a.type = 'u'; a.u = v; return a; }
+		static log_arg arg(unsigned long long v) { log_arg a; a.type = 'u'; a.u = v; return a; }
+		static log_arg arg(double v) { log_arg a; a.type = 'd'; a.d = v; return a; }
+		static log_arg arg(const char *v) { log_arg a; a.type = 's'; a.s = v; return a; }
+
+	public:
+		// returns true if 'level' is being logged
+		static bool enabled(LogLevels level) {
+			return level <= s_Level.load(std::memory_order_relaxed);
+		}
+
+		// log one record, from any thread
+		template <typename... Args>
+		static void write(LogLevels level, const char *format, Args... args) {
+			static_assert(sizeof...(Args) <= LOG_ARGS, "too many log arguments");
+			if (!enabled(level))
+				return;
+			const log_arg a[] = { arg(args)..., arg(0) };
+			record(level, format, a, sizeof...(Args));
+		}
+
+		// log one line of any text; this may block, so it is not for the
+		//    audio or modem threads
+		static void message(LogLevels level, const std::string &text);
+
+		// start the formatter, writing to "stderr", "syslog", or a file
+		//    (appended); false if the file can't be opened
+		static bool start(const std::string &target);
+
+		// write what is left, and stop the formatter
+		static void stop();
+
+		// set and get the level
+		static void level(LogLevels l) {
+			s_Level.store(l);
+		}
+		static LogLevels level() {
+			return static_cast<LogLevels>(s_Level.load());
+		}
+
+		// returns the target, or empty if the formatter isn't running
+		static std::string target();
+
+		// returns the records lost to full rings, and held back by the
+		//    rate limit
+		static uint64_t lost();
+		static uint64_t suppressed();
+
+		// level names: ERROR, WARNING, INFO, DEBUG
+		static const char *name(LogLevels l);
+		static bool parse(const std::string &name, LogLevels &l);
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *
+ *
+ *    modems.h
+ *
+ *    FreeDV modem name parsing, shared by the fdvcore tools.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_MODEMS_H
+#define __FDVCORE_MODEMS_H
+
+#include <cstring>
+#include <codec2/freedv_api.h>
+
+#ifdef FREEDV_MODE_700D
+#define FDV_MODES "1600, 800XA, 700, 700B, 700C, 700D"
+#else
+#define FDV_MODES "1600, 800XA, 700, 700B, 700C"
+#endif
+
+
+//
+//  parseModem(...) - convert a modem name to a FREEDV_MODE_*; -1 if unknown
+//
+inline int parseModem(const char *name) {
+	int modem = -1;
+	if (!strcmp(name,"1600"))
+		modem = FREEDV_MODE_1600;
+/*	if (!strcmp(name,"700"))
+		modem = FREEDV_MODE_700;
+	if (!strcmp(name,"700B"))
+		modem = FREEDV_MODE_700B; */
+	if (!strcmp(name,"700C"))
+		modem = FREEDV_MODE_700C;
+	#ifdef FREEDV_MODE_700D
+	if (!strcmp(name,"700D"))
+		modem = FREEDV_MODE_700D;
+	#endif
+	#if 0 // not supported yet
+	if (!strcmp(name,"2400A"))
+		modem = FREEDV_MODE_2400A;
+	if (!strcmp(name,"2400B"))
+		modem = FREEDV_MODE_2400B;
+	#endif
+	if (!strcmp(name,"800XA"))
+		modem = FREEDV_MODE_800XA;
+	return modem;
+}
+
+#endif
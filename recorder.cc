@@ -0,0 +1,120 @@
+/*
+ *
+ *
+ *    recorder.cc
+ *
+ *    AudioRecorder class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "recorder.h"
+#include "localtypes.h"
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+// seconds of audio the ring can hold before samples are dropped
+#define RECORDER_RING_SECONDS 2
+
+// the number of frames copied per ring operation
+#define RECORDER_CHUNK 1024
+
+
+//
+//  AudioRecorder::ctor
+//
+AudioRecorder::AudioRecorder(const std::string &path, Sources src, unsigned rate)
+	: m_Path(path),
+	  m_Source(src),
+	  m_Channels(src == Both ? 2 : 1),
+	  m_File(0),
+	  m_Ring(RECORDER_RING_SECONDS * rate * (src == Both ? 2 : 1)),
+	  m_Scratch(RECORDER_CHUNK * (src == Both ? 2 : 1)),
+	  m_Dropped(0),
+	  m_Running(false) {
+	SF_INFO info;
+	memset(&info, 0, sizeof(info));
+	info.samplerate = rate;
+	info.channels = m_Channels;
+	info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+	m_File = sf_open(path.c_str(), SFM_WRITE, &info);
+	if (!m_File) {
+		throw local_exception(std::string("Could not open recording: ") + sf_strerror(0));
+	}
+
+	m_Running = true;
+	m_Writer = std::thread(&AudioRecorder::run, this);
+}
+
+
+//
+//  AudioRecorder::dtor
+//
+AudioRecorder::~AudioRecorder() {
+	m_Running = false;
+	if (m_Writer.joinable())
+		m_Writer.join();
+	if (m_File) {
+		sf_close(m_File);
+		m_File = 0;
+	}
+}
+
+
+//
+//  AudioRecorder::write(...) - copy one buffer into the ring
+//
+void AudioRecorder::write(const float *in, unsigned ci, const float *out, unsigned co, size_t count) {
+	while (count) {
+		const size_t n = std::min(count, static_cast<size_t>(RECORDER_CHUNK));
+		float *dst = &m_Scratch[0];
+		for (size_t i = 0; i != n; ++i) {
+			switch (m_Source) {
+				case Input:
+					*dst++ = ci ? *in : 0;
+					break;
+				case Output:
+					*dst++ = co ? *out : 0;
+					break;
+				case Both:
+					*dst++ = ci ? *in : 0;
+					*dst++ = co ? *out : 0;
+					break;
+			}
+			in += ci;
+			out += co;
+		}
+		if (!m_Ring.push(&m_Scratch[0], n * m_Channels))
+			m_Dropped.fetch_add(n, std::memory_order_relaxed);
+		count -= n;
+	}
+}
+
+
+//
+//  AudioRecorder::run() - writer thread body
+//
+void AudioRecorder::run() {
+	std::vector<float> buffer(RECORDER_CHUNK * m_Channels);
+	for (;;) {
+		// read whole frames only; the audio thread writes whole frames
+		const size_t n = m_Ring.pop(&buffer[0], buffer.size());
+		if (n) {
+			sf_writef_float(m_File, &buffer[0], n / m_Channels);
+			continue;
+		}
+
+		// ring is empty; stop only once everything has been written
+		if (!m_Running)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+
+// EOF
@@ -0,0 +1,93 @@
+/*
+ *
+ *
+ *    recorder.h
+ *
+ *    AudioRecorder class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_RECORDER_H
+#define __FDVCORE_RECORDER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <sndfile.h>
+
+#include "LockFreeRing.h"
+
+
+//
+//  AudioRecorder - writes sound card audio to a WAV file
+//
+//  The audio thread copies samples into a lock-free ring with write(),
+//  which never blocks or touches the filesystem; if the ring is full, the
+//  samples are dropped and counted.  A background thread drains the ring
+//  into the file.
+//
+class AudioRecorder {
+	public:
+		typedef enum {
+			Input,  // the raw (left) input channel
+			Output, // the first output channel
+			Both,   // input on the left, output on the right
+		} Sources;
+
+	private:
+		std::string m_Path;
+		Sources m_Source;
+		unsigned m_Channels;
+		SNDFILE *m_File;
+
+		// interleaved frames from the audio thread
+		LockFreeRing<float> m_Ring;
+		std::vector<float> m_Scratch;
+		std::atomic<uint64_t> m_Dropped;
+
+		// writer thread
+		std::thread m_Writer;
+		std::atomic<bool> m_Running;
+
+	private:
+		AudioRecorder(const AudioRecorder&);
+		AudioRecorder &operator=(const AudioRecorder&);
+
+		// the writer thread body
+		void run();
+
+	public:
+		// opens the file and starts the writer; throws local_exception on failure
+		AudioRecorder(const std::string &path, Sources src, unsigned rate);
+
+		// stops the writer, flushes, and closes the file
+		~AudioRecorder();
+
+	public: // audio thread
+		// copy one sound card buffer; 'ci' and 'co' are the channel counts
+		void write(const float *in, unsigned ci, const float *out, unsigned co, size_t count);
+
+	public: // control thread
+		const std::string &path() const {
+			return m_Path;
+		}
+
+		Sources source() const {
+			return m_Source;
+		}
+
+		// the number of frames lost because the writer fell behind
+		uint64_t dropped() const {
+			return m_Dropped.load();
+		}
+};
+
+#endif
@@ -2,8 +2,8 @@
  *
  *   sc.h - soundcard interface
  *
- *   This is a class library that wraps an RtAudio soundcard object
- *   and simplifies the interface.
+ *   This is a class library that wraps an audio device (an RtAudio
+ *   soundcard object, by default) and simplifies the interface.
  *
  *   Copyright (C) 2015-2018 by Matt Roberts, KK5JY,
  *   All rights reserved.
@@ -20,6 +20,77 @@
 #include <cstring>
 #include <string>
 #include <rtaudio/RtAudio.h>
+#include "trace.h"
+#include "logger.h"
+
+
+//
+//  VirtualCard - channel layout for a SoundCard with no device behind it;
+//                the owner calls SoundCard::drive(...) to run each buffer
+//
+struct VirtualCard {
+	uint16_t channelsIn;
+	uint16_t channelsOut;
+
+	VirtualCard(uint16_t in = 2, uint16_t out = 2) : channelsIn(in), channelsOut(out) { /* nop */ }
+};
+
+
+class SoundCard;
+
+
+//
+//  AudioBackend - the device (or stand-in) behind a SoundCard
+//
+//  A backend owns the stream, and calls back into its SoundCard once per
+//  buffer, with interleaved float samples, from its own thread.  The
+//  channel layout is fixed when the backend is created; the rate and
+//  window are supplied by the SoundCard when the stream starts.
+//
+class AudioBackend {
+	protected:
+		SoundCard *mCard;
+		uint16_t mChannelsIn;
+		uint16_t mChannelsOut;
+
+	protected:
+		AudioBackend(uint16_t in, uint16_t out) : mCard(0), mChannelsIn(in), mChannelsOut(out) { }
+
+		// run one buffer through the card's event handler
+		static void deliver(SoundCard *card, float *in, float *out, size_t samples);
+		static void deliver(SoundCard *card, int16_t *in, int16_t *out, size_t samples);
+
+		// count an input overflow or output underflow on the card
+		static void xrun(SoundCard *card, bool overflow, bool underflow);
+
+	public:
+		virtual ~AudioBackend() { }
+
+		// a short name, for diagnostics
+		virtual std::string name() const = 0;
+
+		// open and start the stream; 'win' may be adjusted to suit the device
+		virtual bool start(SoundCard *card, unsigned rate, unsigned &win) = 0;
+
+		// stop the stream; no callbacks are made once this returns; a
+		//    stopped stream may be started again
+		virtual void stop() = 0;
+
+		// true if the stream may be stopped to save power while idle;
+		//    a data stream (e.g., a file) must keep flowing instead
+		virtual bool suspendable() const { return true; }
+
+		// true if the output may be clocked apart from the audio that
+		//    feeds it, so that drift correction is worthwhile; a stream
+		//    paced by one clock (e.g., a file, or a timer) is not
+		virtual bool independentClocks() const { return true; }
+
+		// true once a finite source (e.g., a file) has been consumed
+		virtual bool finished() const { return false; }
+
+		uint16_t channelsIn() const { return mChannelsIn; }
+		uint16_t channelsOut() const { return mChannelsOut; }
+};
 
 
 //
@@ -32,18 +103,23 @@ class SoundCard {
 			Float
 		} Formats;
 
-		RtAudio adc;
-		RtAudio::StreamParameters paramsIn;
-		RtAudio::StreamParameters paramsOut;
-		Formats mFormat;
-		unsigned mCard;
+		AudioBackend *mBackend;
+		uint16_t mChannelsIn;
+		uint16_t mChannelsOut;
 		unsigned mRate;
 		unsigned mWin;
+		volatile uint64_t mOverflows;
+		volatile uint64_t mUnderflows;
+		bool mVirtual;
 	
 	public:
 		SoundCard(unsigned id, unsigned rate, unsigned short win = 256);
 		SoundCard(unsigned id, unsigned rate, Formats format, unsigned short win = 256);
-		virtual ~SoundCard() { };
+
+		// 'backend' is owned by the card; pass 'vc' instead, with no
+		//    backend, for a virtual card
+		SoundCard(AudioBackend *backend, unsigned rate, unsigned short win, const VirtualCard *vc = 0);
+		virtual ~SoundCard();
 
 	public:
 		virtual bool start();
@@ -53,13 +129,54 @@ class SoundCard {
 		static void showDevices();
 		static unsigned deviceCount();
 
-		uint16_t channelsIn() const { return paramsIn.nChannels; }
-		uint16_t channelsOut() const { return paramsOut.nChannels; }
+		uint16_t channelsIn() const { return mChannelsIn; }
+		uint16_t channelsOut() const { return mChannelsOut; }
+		unsigned rate() const { return mRate; }
+		unsigned window() const { return mWin; }
+		bool isVirtual() const { return mVirtual; }
+		AudioBackend *backend() const { return mBackend; }
+
+		// run one buffer through event(...), exactly as the device callback
+		//    would; for virtual cards, which have no callback of their own
+		void drive(float *inBuffer, float *outBuffer, size_t samples) {
+			event(inBuffer, outBuffer, samples);
+		}
+
+		// sound card xrun counts
+		uint64_t overflows() const { return mOverflows; }
+		uint64_t underflows() const { return mUnderflows; }
 	
 	protected:
 		virtual void event(float *inBuffer, float *outBuffer, size_t samples) { }
 		virtual void event(int16_t *inBuffer, int16_t *outBuffer, size_t samples) { }
 
+	private:
+		SoundCard(const SoundCard&);
+		SoundCard &operator=(const SoundCard&);
+
+		friend class AudioBackend;
+};
+
+
+//
+//  RtAudioBackend - an ALSA device, through RtAudio
+//
+class RtAudioBackend : public AudioBackend {
+	private:
+		RtAudio adc;
+		RtAudio::StreamParameters paramsIn;
+		RtAudio::StreamParameters paramsOut;
+		SoundCard::Formats mFormat;
+
+	public:
+		RtAudioBackend(unsigned id, SoundCard::Formats format = SoundCard::Float);
+		~RtAudioBackend() { stop(); }
+
+	public:
+		std::string name() const { return "rtaudio"; }
+		bool start(SoundCard *card, unsigned rate, unsigned &win);
+		void stop();
+
 	private:
 		static int handler(
 			void *outputBuffer,
@@ -71,28 +188,68 @@ class SoundCard {
 };
 
 
+/*
+ *
+ *  AudioBackend::deliver(...)
+ *
+ */
+inline void AudioBackend::deliver(SoundCard *card, float *in, float *out, size_t samples) {
+	TraceScope ts("callback");
+	card->event(in, out, samples);
+}
+
+inline void AudioBackend::deliver(SoundCard *card, int16_t *in, int16_t *out, size_t samples) {
+	TraceScope ts("callback");
+	card->event(in, out, samples);
+}
+
+
+/*
+ *
+ *  AudioBackend::xrun(...)
+ *
+ */
+inline void AudioBackend::xrun(SoundCard *card, bool overflow, bool underflow) {
+	if (overflow)
+		++card->mOverflows;
+	if (underflow)
+		++card->mUnderflows;
+}
+
+
 /*
  *
  *  SoundCard::ctor(...)
  *
  */
 inline SoundCard::SoundCard(unsigned id, unsigned rate, unsigned short win)
-	: adc(RtAudio::LINUX_ALSA),
-	  mFormat(Formats::Float),
-	  mCard(id),
+	: mBackend(new RtAudioBackend(id)),
+	  mChannelsIn(mBackend->channelsIn()),
+	  mChannelsOut(mBackend->channelsOut()),
 	  mRate(rate),
-	  mWin(win) {
-
-	// read the caps of the sound card to configure channel counts
-	RtAudio::DeviceInfo info = adc.getDeviceInfo(id);
+	  mWin(win),
+	  mOverflows(0),
+	  mUnderflows(0),
+	  mVirtual(false) {
+	// nop
+}
 
-	paramsOut.deviceId = mCard;
-	paramsOut.nChannels = info.outputChannels;
-	paramsOut.firstChannel = 0;
 
-	paramsIn.deviceId = mCard;
-	paramsIn.nChannels = info.inputChannels;
-	paramsIn.firstChannel = 0;
+/*
+ *
+ *  SoundCard::ctor(...)
+ *
+ */
+inline SoundCard::SoundCard(unsigned id, unsigned rate, SoundCard::Formats format, unsigned short win)
+	: mBackend(new RtAudioBackend(id, format)),
+	  mChannelsIn(mBackend->channelsIn()),
+	  mChannelsOut(mBackend->channelsOut()),
+	  mRate(rate),
+	  mWin(win),
+	  mOverflows(0),
+	  mUnderflows(0),
+	  mVirtual(false) {
+	// nop
 }
 
 
@@ -101,45 +258,114 @@ inline SoundCard::SoundCard(unsigned id, unsigned rate, unsigned short win)
  *  SoundCard::ctor(...)
  *
  */
-inline SoundCard::SoundCard(unsigned id, unsigned rate, SoundCard::Formats format, unsigned short win)
-	: adc(RtAudio::LINUX_ALSA),
-	  mFormat(format),
-	  mCard(id),
+inline SoundCard::SoundCard(AudioBackend *backend, unsigned rate, unsigned short win, const VirtualCard *vc)
+	: mBackend(backend),
+	  mChannelsIn(0),
+	  mChannelsOut(0),
 	  mRate(rate),
-	  mWin(win) {
+	  mWin(win),
+	  mOverflows(0),
+	  mUnderflows(0),
+	  mVirtual(vc != 0) {
+
+	if (!vc) {
+		// the backend knows the channel counts
+		mChannelsOut = backend->channelsOut();
+		mChannelsIn = backend->channelsIn();
+	} else {
+		// no device to ask; use the requested layout
+		mChannelsOut = vc->channelsOut;
+		mChannelsIn = vc->channelsIn;
+	}
+}
+
+
+/*
+ *
+ *  SoundCard::dtor
+ *
+ */
+inline SoundCard::~SoundCard() {
+	stop();
+	delete mBackend;
+	mBackend = 0;
+}
+
+
+/*
+ *
+ *  SoundCard::start()
+ *
+ */
+inline bool SoundCard::start() {
+	// virtual cards are driven by their owner
+	if (mVirtual || !mBackend)
+		return true;
+	return mBackend->start(this, mRate, mWin);
+}
+
+/*
+ *
+ *  SoundCard::stop()
+ *
+ */
+inline void SoundCard::stop() {
+	if (mBackend)
+		mBackend->stop();
+}
+
+
+/*
+ *
+ *  RtAudioBackend::ctor(...)
+ *
+ */
+inline RtAudioBackend::RtAudioBackend(unsigned id, SoundCard::Formats format)
+	: AudioBackend(0, 0),
+	  adc(RtAudio::LINUX_ALSA),
+	  mFormat(format) {
 
 	// read the caps of the sound card to configure channel counts
 	RtAudio::DeviceInfo info = adc.getDeviceInfo(id);
 
-	paramsOut.deviceId = mCard;
+	paramsOut.deviceId = id;
 	paramsOut.nChannels = info.outputChannels;
 	paramsOut.firstChannel = 0;
 
-	paramsIn.deviceId = mCard;
+	paramsIn.deviceId = id;
 	paramsIn.nChannels = info.inputChannels;
 	paramsIn.firstChannel = 0;
+
+	mChannelsIn = paramsIn.nChannels;
+	mChannelsOut = paramsOut.nChannels;
 }
 
 
 /*
  *
- *  SoundCard::start()
+ *  RtAudioBackend::start()
  *
  */
-inline bool SoundCard::start() {
-	// open the sound card
+inline bool RtAudioBackend::start(SoundCard *card, unsigned rate, unsigned &win) {
+	mCard = card;
+
+	// open the sound card; once open, a stopped stream just restarts
 	try {
+		if (adc.isStreamOpen()) {
+			adc.startStream();
+			return true;
+		}
 		int format = RTAUDIO_FLOAT32;
 		switch (mFormat) {
-			case Float: format = RTAUDIO_FLOAT32; break;
-			case S16: format = RTAUDIO_SINT16; break;
+			case SoundCard::Float: format = RTAUDIO_FLOAT32; break;
+			case SoundCard::S16: format = RTAUDIO_SINT16; break;
 		}
 		adc.openStream(
 			&paramsOut, // output
 			&paramsIn,  // input
 			format, // format
-			mRate,  // rate
-			&mWin, // buffer size
+			rate,  // rate
+			&win, // buffer size
 			&handler,     // callback
 			this);        // callback user data
 		// start
@@ -153,53 +379,58 @@ inline bool SoundCard::start() {
 
 /*
  *
- *  SoundCard::stop()
+ *  RtAudioBackend::stop()
  *
  */
-inline void SoundCard::stop() {
-	if ( adc.isStreamOpen() )
+inline void RtAudioBackend::stop() {
+	if ( adc.isStreamOpen() && adc.isStreamRunning() )
 		adc.stopStream();
 }
 
 /*
  *
- *   SoundCard::handler(...)
+ *   RtAudioBackend::handler(...)
  *
  */
-inline int SoundCard::handler(
+inline int RtAudioBackend::handler(
 		void *outputBuffer,
 		void *inputBuffer,
 		unsigned int nBufferFrames,
 		double streamTime,
 		RtAudioStreamStatus status,
-		void *sc) {
+		void *be) {
 	#ifdef _DEBUG
 	if (status)
-		std::cout << "[sc:ov!]";
+		Logger::write(LogDebug, "[sc:ov!] stream status %x", status);
 	#endif
 
 	// extract appropriate pointers
-	SoundCard *thisPtr = (SoundCard*)(sc);
-	if (thisPtr == 0) return 0;
+	RtAudioBackend *thisPtr = (RtAudioBackend*)(be);
+	if (thisPtr == 0 || thisPtr->mCard == 0) return 0;
+
+	// count xruns
+	xrun(thisPtr->mCard,
+		(status & RTAUDIO_INPUT_OVERFLOW) != 0,
+		(status & RTAUDIO_OUTPUT_UNDERFLOW) != 0);
 
 	switch (thisPtr->mFormat) {
-		case Float: {
+		case SoundCard::Float: {
 			float *inData = (float*)(inputBuffer);
 			if (inData == 0) return 0;
 			float *outData = (float*)(outputBuffer);
 			if (outData == 0) return 0;
 
 			// call the user's handler
-			thisPtr->event(inData, outData, nBufferFrames);
+			deliver(thisPtr->mCard, inData, outData, nBufferFrames);
 		} break;
-		case S16: {
+		case SoundCard::S16: {
 			int16_t *inData = (int16_t*)(inputBuffer);
 			if (inData == 0) return 0;
 			int16_t *outData = (int16_t*)(outputBuffer);
 			if (outData == 0) return 0;
 
 			// call the user's handler
-			thisPtr->event(inData, outData, nBufferFrames);
+			deliver(thisPtr->mCard, inData, outData, nBufferFrames);
 		} break;
 	}
 
@@ -17,7 +17,10 @@
 
 #include "scdv.h"
 #include <climits>
+#include <cstring>
+#include <cmath>
 #include <algorithm>
+#include <chrono>
 
 // FreeDV headers
 #include <codec2/freedv_api.h>
@@ -31,24 +34,34 @@
 // define this to see total packet process counts
 //#define EMIT_THROUGHPUT_COUNTS
 
+// the number of callbacks summarized by each set of timing percentiles
+#define TELEMETRY_WINDOW 256
+
 //
 //  callback - returns the next TX data byte to send
 //
 char SoundCardDV::local_get_next_tx_char(void *callback_state) {
 	local_callback_state *pstate = (local_callback_state*)callback_state;
-	char  c = *pstate->ptx_str++;
-
-	if (*pstate->ptx_str == 0) {
-		pstate->ptx_str = pstate->tx_str;
-	}
+	char  c = pstate->text.next();
 
 	// DEBUG:
-	//std::cerr << "DEBUG: sent data char: " << c << std::endl;
+	//Logger::write(LogDebug, "sent data char: %c", c);
 
 	return c;
 }
 
 
+//
+//  callback - accepts the next RX data byte received
+//
+void SoundCardDV::local_put_next_rx_char(void *callback_state, char c) {
+	local_callback_state *pstate = (local_callback_state*)callback_state;
+
+	// if nobody is reading, the newest text is dropped
+	pstate->received.push(c);
+}
+
+
 //
 //  TX data callback - updates the callback counter
 //
@@ -64,7 +77,7 @@ void SoundCardDV::local_get_next_proto(void *callback_state, char *proto_bits) {
 //
 void SoundCardDV::local_datarx(void *callback_state, unsigned char *packet, size_t size) {
 	// TODO: to be replaced when RX implemented
-	std::cerr << "DEBUG: datarx callback called, this should not happen!" << std::endl;    
+	Logger::write(LogWarning, "datarx callback called, this should not happen!");
 }
 
 
@@ -98,36 +111,97 @@ void SoundCardDV::local_datatx(void *callback_state, unsigned char *packet, size
 //
 //  dynamic_window_size
 //
-static size_t dynamic_window_size(int modem) {
+static size_t dynamic_window_size(int modem, unsigned rate) {
 	size_t result = 0;
 	switch (modem) {
 		case FREEDV_MODE_1600: result = 320; break;
 		case FREEDV_MODE_700D: result = 1280; break;
 		default: result = 512; break;
 	}
-	return (result * CARD_FS) / MODEM_FS;
+	return (result * rate) / MODEM_FS;
 }
 
 
 //
 //  SoundCardDV::ctor
 //
-SoundCardDV::SoundCardDV(int modem, int id, int win)
-	: SoundCard(id, CARD_FS, win ? win : dynamic_window_size(modem)),
+SoundCardDV::SoundCardDV(int modem, AudioBackend *backend, int win, const VirtualCard *vc, unsigned rate)
+	: SoundCard(backend, rate, win ? win : dynamic_window_size(modem, rate), vc),
 	  mMode(ModesDV::Mute),
+	  m_Modem(modem),
 	  modem_in(0),
 	  modem_out(0),
 	  m_freedv(0),
 	  m_Frames(0),
+	  m_ModemFrames(0),
 	  clipping(false),
-	  dec_ctr(0),
-	  m_DecFilter(KK5JY::DSP::FirFilter<float>::Types::LowPass, FILTER_LEN, FILTER_COF, CARD_FS),
-	  m_IntFilter(KK5JY::DSP::FirFilter<float>::Types::LowPass, FILTER_LEN, FILTER_COF, CARD_FS) {
+	  m_ModemClips(0),
+	  m_InDrops(0),
+	  m_OutDrops(0),
+	  m_InDepth(0),
+	  m_OutDepth(0),
+	  m_Ratio(rate / MODEM_FS),
+	  m_Decimator(new KK5JY::DSP::Decimator<float>(rate / MODEM_FS, rate, FILTER_PASS, FILTER_ATTEN)),
+	  m_Interpolator(new KK5JY::DSP::Interpolator<float>(rate / MODEM_FS, rate, FILTER_PASS, FILTER_ATTEN)),
+	  m_IntOut(rate / MODEM_FS),
+	  m_FilterPass(FILTER_PASS),
+	  m_FilterAtten(FILTER_ATTEN),
+	  m_FilterWindow("KAISER"),
+	  m_FilterWindowFn(0),
+	  m_InLevel(rate, CLIP_LIMIT),
+	  m_OutLevel(rate, CLIP_LIMIT),
+	  m_Telemetry(0),
+	  m_ModemStats(0),
+	  m_SnapshotSeq(0),
+	  m_Recorder(0),
+	  m_TapBusy(false),
+	  m_RecordDrops(0),
+	  m_CodecTap(0),
+	  m_Codec2(0),
+	  codec_bits(0),
+	  m_CodecSource(0),
+	  m_CodecFrameBytes(0),
+	  m_CodecSent(0),
+	  m_CodecUnderruns(0),
+	  m_GateOn(false),
+	  m_GateLevel(0),
+	  m_GateHang(0),
+	  m_GateRun(0),
+	  m_GateSkipped(0),
+	  m_Running(false),
+	  m_IdleOn(false),
+	  m_Suspended(false),
+	  m_Suspends(0),
+	  m_Resuming(false),
+	  m_ResumeUsec(0),
+	  m_ResumeMax(0),
+	  m_Diversity(0),
+	  m_RxFilter(0),
+	  m_RxFilterRight(0),
+	  m_RxFilterLow(0),
+	  m_RxFilterHigh(0),
+	  m_Probe(0),
+	  m_DriftOn(backend && backend->independentClocks()),
+	  m_RxDrift(rate),
+	  m_TxDrift(rate),
+	  m_DriftMode(ModesDV::Mute),
+	  m_DriftFrame(0),
+	  m_DriftDrops(0),
+	  m_DriftGlitch(false),
+	  m_DriftTarget(0),
+	  m_DriftDepth(0) {
+	m_DivWins[0] = m_DivWins[1] = 0;
+	m_DriftPpm[0] = m_DriftPpm[1] = 0;
 	
 	// DEBUG:
-	std::cerr << "DEBUG: Card ID = " << id << std::endl;
-	std::cerr << "DEBUG: Modem   = " << modem << std::endl;
-	std::cerr << "DEBUG: Window  = " << (win ? win : dynamic_window_size(modem)) << std::endl;
+	Logger::message(LogDebug, "Backend = " + (backend ? backend->name() : std::string("virtual")));
+	Logger::write(LogDebug, "Modem   = %d", modem);
+	Logger::write(LogDebug, "Window  = %u", window());
+	Logger::write(LogDebug, "Rate    = %u", rate);
+
+	if (rate < MODEM_FS || (rate % MODEM_FS) != 0) {
+		throw local_exception("The sample rate must be a multiple of the modem rate");
+	}
 
 	// FreeDV SETUP begins ===========================================
 	m_freedv = freedv_open(modem);
@@ -151,11 +225,30 @@ SoundCardDV::SoundCardDV(int modem, int id, int win)
 		throw local_exception("Could not allocate buffers");
 	}
 
-	/* set up text buffer, and callback to service it */
-	strcpy(cb_state.tx_str, DEFAULT_TEXT);
-	cb_state.ptx_str = cb_state.tx_str;
+	// codec bits for the network tap; one byte per bit is plenty
+	m_Codec2 = freedv_get_codec2(m_freedv);
+	codec_bits = (unsigned char*)malloc(std::max(freedv_get_n_codec_bits(m_freedv), CODEC_TAP_MAX_BYTES));
+	if (!codec_bits) {
+		throw local_exception("Could not allocate buffers");
+	}
+
+	// packed codec bytes per modem frame, as taken by freedv_codectx(...)
+	if (m_Codec2) {
+		m_CodecFrameBytes =
+			(n_speech_samples / codec2_samples_per_frame(m_Codec2)) *
+			((codec2_bits_per_frame(m_Codec2) + 7) / 8);
+	}
+
+	// the extended stats are large, so keep them off the audio thread's stack
+	m_ModemStats = new ::MODEM_STATS;
+	memset(&m_TelemetryData, 0, sizeof(m_TelemetryData));
+	memset(&m_Snapshot, 0, sizeof(m_Snapshot));
+	memset(&m_SnapshotWork, 0, sizeof(m_SnapshotWork));
+	m_SnapshotWork.modem = m_Snapshot.modem = m_Modem;
+
+	/* set up callback to service the text buffer */
 	cb_state.calls = 0;
-	freedv_set_callback_txt(m_freedv, NULL, &local_get_next_tx_char, &cb_state);
+	freedv_set_callback_txt(m_freedv, &local_put_next_rx_char, &local_get_next_tx_char, &cb_state);
 
 	/* set up callback for protocol bits */
 	freedv_set_callback_protocol(m_freedv, NULL, &local_get_next_proto, &cb_state);
@@ -171,6 +264,9 @@ SoundCardDV::SoundCardDV(int modem, int id, int win)
 //  SoundCardDV::dtor
 //
 SoundCardDV::~SoundCardDV() {
+	// no more callbacks once the buffers are gone
+	stop();
+
 	if (modem_in) {
 		free(modem_in);
 		modem_in = 0;
@@ -183,6 +279,687 @@ SoundCardDV::~SoundCardDV() {
 		freedv_close(m_freedv);
 		m_freedv = 0;
 	}
+	record(std::string());
+	codecTap(std::string());
+	codecSource(std::string());
+	diversity(false);
+	rxFilterOff();
+	if (codec_bits) {
+		free(codec_bits);
+		codec_bits = 0;
+	}
+	delete m_Telemetry.exchange(0);
+	delete m_Probe.exchange(0);
+	delete m_Decimator.exchange(0);
+	delete m_Interpolator.exchange(0);
+	delete m_ModemStats;
+	m_ModemStats = 0;
+}
+
+
+//
+//  SoundCardDV::start() - start the stream
+//
+bool SoundCardDV::start() {
+	m_Running = SoundCard::start();
+	if (m_Running && m_IdleOn && mMode == ModesDV::Mute)
+		suspend();
+	return m_Running;
+}
+
+
+//
+//  SoundCardDV::stop() - stop the stream
+//
+void SoundCardDV::stop() {
+	SoundCard::stop();
+	m_Running = false;
+	m_Suspended = false;
+}
+
+
+//
+//  SoundCardDV::mode(...) - set the mode
+//
+bool SoundCardDV::mode(const ModesDV &newMode) {
+	if (newMode < ModesDV::MinValue || newMode > ModesDV::MaxValue) {
+		return false;
+	}
+
+	// set the new mode
+	mMode = newMode;
+
+	if (newMode != ModesDV::Mute)
+		return resume();
+	if (m_IdleOn)
+		suspend();
+	return true;
+}
+
+
+//
+//  SoundCardDV::idle(...) - turn low-power idle on or off
+//
+void SoundCardDV::idle(bool on) {
+	m_IdleOn = on;
+	if (on && mMode == ModesDV::Mute)
+		suspend();
+	else if (!on)
+		resume();
+}
+
+
+//
+//  SoundCardDV::suspend() - stop the stream while idle
+//
+void SoundCardDV::suspend() {
+	if (!m_Running || m_Suspended || !backend() || !backend()->suspendable())
+		return;
+	SoundCard::stop();
+	m_Suspended = true;
+	++m_Suspends;
+}
+
+
+//
+//  SoundCardDV::resume() - restart the stream after idle
+//
+bool SoundCardDV::resume() {
+	if (!m_Suspended)
+		return true;
+	m_ResumeStart = std::chrono::steady_clock::now();
+	m_Resuming.store(true);
+	if (!SoundCard::start()) {
+		m_Resuming.store(false);
+		Logger::write(LogError, "could not restart the audio stream");
+		return false;
+	}
+	m_Suspended = false;
+	return true;
+}
+
+
+//
+//  SoundCardDV::telemetry(...) - start or stop publishing telemetry
+//
+bool SoundCardDV::telemetry(const std::string &path) {
+	if (path.empty()) {
+		TelemetryRegion *old = m_Telemetry.exchange(0);
+		if (old) {
+			waitTaps();
+			delete old;
+		}
+		return true;
+	}
+
+	if (m_Telemetry.load())
+		return false;
+	try {
+		m_Telemetry.store(new TelemetryRegion(path));
+	} catch (const local_exception &e) {
+		Logger::message(LogError, e.what());
+		return false;
+	}
+	return true;
+}
+
+
+//
+//  SoundCardDV::record(...) - start or stop recording
+//
+bool SoundCardDV::record(const std::string &path, AudioRecorder::Sources src) {
+	// detach any current recorder, and wait for the audio thread to let go
+	AudioRecorder *old = m_Recorder.exchange(0);
+	if (old) {
+		waitTaps();
+		m_RecordDrops += old->dropped();
+		delete old;
+	}
+
+	if (path.empty())
+		return true;
+
+	try {
+		m_Recorder.store(new AudioRecorder(path, src, rate()));
+	} catch (const local_exception &e) {
+		Logger::message(LogError, e.what());
+		return false;
+	}
+	return true;
+}
+
+
+//
+//  SoundCardDV::waitTaps() - wait for the audio thread to leave event()
+//
+void SoundCardDV::waitTaps() const {
+	while (m_TapBusy.load())
+		std::this_thread::yield();
+}
+
+
+//
+//  SoundCardDV::codecTap(...) - start or stop forwarding codec frames
+//
+bool SoundCardDV::codecTap(const std::string &target) {
+	CodecTap *old = m_CodecTap.exchange(0);
+	if (old) {
+		waitTaps();
+		delete old;
+	}
+
+	if (target.empty())
+		return true;
+	if (!m_Codec2)
+		return false;
+
+	try {
+		m_CodecTap.store(new CodecTap(target, m_Modem));
+	} catch (const local_exception &e) {
+		Logger::message(LogError, e.what());
+		return false;
+	}
+	return true;
+}
+
+
+//
+//  SoundCardDV::codecTap() - returns the codec tap target
+//
+std::string SoundCardDV::codecTap() const {
+	CodecTap *t = m_CodecTap.load();
+	return t ? t->target() : std::string();
+}
+
+
+//
+//  SoundCardDV::codecTapSent() - returns the number of frames sent
+//
+uint64_t SoundCardDV::codecTapSent() const {
+	CodecTap *t = m_CodecTap.load();
+	return t ? t->sent() : 0;
+}
+
+
+//
+//  SoundCardDV::codecTapDropped() - returns the number of frames dropped
+//
+uint64_t SoundCardDV::codecTapDropped() const {
+	CodecTap *t = m_CodecTap.load();
+	return t ? t->dropped() : 0;
+}
+
+
+//
+//  SoundCardDV::rxCodec(...) - demodulate to codec bits, forward them,
+//                              and decode them locally
+//
+size_t SoundCardDV::rxCodec(CodecTap *tap) {
+	const int bytes = freedv_codecrx(m_freedv, codec_bits, modem_in);
+	if (bytes <= 0) {
+		// no valid frame; keep the output flowing with silence
+		memset(modem_out, 0, sizeof(short) * n_speech_samples);
+		return n_speech_samples;
+	}
+
+	const int bpf = (codec2_bits_per_frame(m_Codec2) + 7) / 8;
+	const int spf = codec2_samples_per_frame(m_Codec2);
+	int frames = bytes / bpf;
+	if (frames * spf > n_speech_samples)
+		frames = n_speech_samples / spf;
+
+	int syncVal = 0;
+	float snrVal = 0;
+	freedv_get_modem_stats(m_freedv, &syncVal, &snrVal);
+	tap->write(codec_bits, bytes, frames, syncVal, snrVal);
+
+	for (int i = 0; i != frames; ++i) {
+		codec2_decode(m_Codec2, modem_out + (i * spf), codec_bits + (i * bpf));
+	}
+	return frames * spf;
+}
+
+
+//
+//  SoundCardDV::codecSource(...) - start or stop sending coded frames
+//
+bool SoundCardDV::codecSource(const std::string &source) {
+	CodecSource *old = m_CodecSource.exchange(0);
+	if (old) {
+		waitTaps();
+		delete old;
+	}
+
+	if (source.empty())
+		return true;
+	if (!m_Codec2)
+		return false;
+
+	try {
+		m_CodecSource.store(new CodecSource(source, m_CodecFrameBytes, m_Modem));
+	} catch (const local_exception &e) {
+		Logger::message(LogError, e.what());
+		return false;
+	}
+	return true;
+}
+
+
+//
+//  SoundCardDV::codecSource() - returns the TX codec source
+//
+std::string SoundCardDV::codecSource() const {
+	CodecSource *s = m_CodecSource.load();
+	return s ? s->source() : std::string();
+}
+
+
+//
+//  SoundCardDV::txCodec(...) - modulate one frame of pre-encoded bits
+//
+size_t SoundCardDV::txCodec(CodecSource *src) {
+	if (src->read(codec_bits)) {
+		freedv_codectx(m_freedv, modem_out, codec_bits);
+		++m_CodecSent;
+	} else {
+		// nothing ready; keep the modem running on silence
+		memset(modem_in, 0, sizeof(short) * n_speech_samples);
+		freedv_tx(m_freedv, modem_out, modem_in);
+		++m_CodecUnderruns;
+	}
+	return n_nom_modem_samples;
+}
+
+
+//
+//  SoundCardDV::gateOn(...) - turn on the RX energy gate
+//
+bool SoundCardDV::gateOn(float dbfs) {
+	if (m_Diversity.load())
+		return false;
+	m_GateLevel.store(pow(10.0, dbfs / 10.0));
+	m_GateOn.store(true);
+	return true;
+}
+
+
+//
+//  SoundCardDV::gateLevel(...) - returns the RX energy gate level
+//
+bool SoundCardDV::gateLevel(float &dbfs) const {
+	dbfs = 10.0 * log10(m_GateLevel.load());
+	return m_GateOn.load();
+}
+
+
+//
+//  SoundCardDV::gate(...) - the RX energy gate
+//
+//  Measures the newest modem frame of input; while it and the frames
+//  before it (GATE_HANG_MS) are quiet and the modem has no sync, the
+//  oldest input is passed on as silence without demodulating it.  The
+//  newest GATE_LOOKBACK_MS of input is always held back, so when the
+//  gate opens the demodulator starts on the audio from just before the
+//  signal arrived, and its sync search isn't cut short.
+//
+bool SoundCardDV::gate(size_t nin) {
+	TraceScope ts("gate");
+	const size_t lookback = (MODEM_FS * GATE_LOOKBACK_MS) / 1000;
+	const size_t have = in_buffer.size();
+	if (have < nin)
+		return false;
+
+	// the mean-square level of the newest frame
+	double sum = 0;
+	for (size_t i = have - nin; i != have; ++i) {
+		const double s = static_cast<double>(in_buffer[i]) / SHRT_MAX;
+		sum += s * s;
+	}
+	if (sum / nin >= m_GateLevel.load(std::memory_order_relaxed)) {
+		m_GateHang = (MODEM_FS * GATE_HANG_MS) / 1000;
+	} else if (m_GateHang) {
+		m_GateHang -= std::min(m_GateHang, nin);
+	}
+	if (m_GateHang == 0) {
+		// a fading signal the modem still holds keeps the gate open
+		int syncVal = 0;
+		float snrVal = 0;
+		freedv_get_modem_stats(m_freedv, &syncVal, &snrVal);
+		if (syncVal)
+			m_GateHang = nin;
+	}
+	if (m_GateHang) {
+		m_GateRun.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// closed; pass the oldest frame on as silence, once the look-back is full
+	if (have >= lookback + nin) {
+		for (size_t i = 0; i != nin; ++i) {
+			in_buffer.pop_front();
+		}
+		memset(modem_out, 0, sizeof(short) * nin);
+		interpolate(modem_out, nin);
+		m_GateSkipped.fetch_add(1, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+
+//
+//  SoundCardDV::newDiversity(...) - create a diversity receiver
+//
+DiversityRx *SoundCardDV::newDiversity(unsigned r, float pass, float atten, KK5JY::DSP::WindowFunction fn) {
+	DiversityRx *div = new DiversityRx(m_Modem, r, sql_en, sql_th, pass, atten, fn);
+	div->textCallback(&local_put_next_rx_char, &cb_state);
+	return div;
+}
+
+
+//
+//  SoundCardDV::diversity(...) - start or stop diversity receive
+//
+bool SoundCardDV::diversity(bool on) {
+	DiversityRx *old = m_Diversity.exchange(0);
+	if (old) {
+		waitTaps();
+		m_DivWins[0] += old->wins(0);
+		m_DivWins[1] += old->wins(1);
+		delete old;
+	}
+
+	// the energy gate watches the single receiver's input only
+	if (!on)
+		return true;
+	if (channelsIn() < 2 || m_GateOn.load())
+		return false;
+
+	try {
+		m_Diversity.store(newDiversity(rate(), m_FilterPass, m_FilterAtten, m_FilterWindowFn));
+	} catch (const local_exception &e) {
+		Logger::message(LogError, e.what());
+		return false;
+	}
+	return true;
+}
+
+
+//
+//  SoundCardDV::diversityWins(...) - returns frames taken from a receiver
+//
+uint64_t SoundCardDV::diversityWins(int branch) const {
+	DiversityRx *d = m_Diversity.load();
+	return m_DivWins[branch ? 1 : 0] + (d ? d->wins(branch) : 0);
+}
+
+
+//
+//  the windows that FILTER may name
+//
+static const struct {
+	const char *name;
+	KK5JY::DSP::WindowFunction fn;
+} s_Windows[] = {
+	{ "KAISER", 0 },
+	{ "HAMMING", KK5JY::DSP::FirFilterUtils::HammingWindow },
+	{ "HANN", KK5JY::DSP::FirFilterUtils::HannWindow },
+	{ "BLACKMAN", KK5JY::DSP::FirFilterUtils::BlackmanWindow },
+	{ "NUTTALL", KK5JY::DSP::FirFilterUtils::NuttallWindow },
+	{ "BLACKMANNUTTALL", KK5JY::DSP::FirFilterUtils::BlackmanNuttallWindow },
+	{ "BLACKMANHARRIS", KK5JY::DSP::FirFilterUtils::BlackmanHarrisWindow },
+	{ "FLATTOP", KK5JY::DSP::FirFilterUtils::FlatTopWindow },
+	{ "RECTANGLE", KK5JY::DSP::FirFilterUtils::RectangleWindow },
+};
+
+
+//
+//  SoundCardDV::filter(...) - redesign the rate conversion filters
+//
+bool SoundCardDV::filter(float pass, float atten, const std::string &window) {
+	if (pass < FILTER_MIN_PASS || pass > (MODEM_FS / 2 - FILTER_MIN_TRANSITION) ||
+	    atten < FILTER_MIN_ATTEN || atten > FILTER_MAX_ATTEN)
+		return false;
+	size_t w = 0;
+	while (w != sizeof(s_Windows) / sizeof(s_Windows[0]) && window != s_Windows[w].name)
+		++w;
+	if (w == sizeof(s_Windows) / sizeof(s_Windows[0]))
+		return false;
+
+	// design both here, on the control thread
+	const unsigned r = rate();
+	KK5JY::DSP::Decimator<float> *d =
+		new KK5JY::DSP::Decimator<float>(m_Ratio, r, pass, atten, s_Windows[w].fn);
+	KK5JY::DSP::Interpolator<float> *i =
+		new KK5JY::DSP::Interpolator<float>(m_Ratio, r, pass, atten, s_Windows[w].fn);
+
+	// diversity receivers have their own decimators, so a running one
+	//    is replaced with one of the new design
+	DiversityRx *div = 0;
+	if (m_Diversity.load()) {
+		try {
+			div = newDiversity(r, pass, atten, s_Windows[w].fn);
+		} catch (const local_exception &e) {
+			Logger::message(LogError, e.what());
+			delete d;
+			delete i;
+			return false;
+		}
+	}
+
+	// swap them in, and wait for the audio thread to let go of the old ones
+	KK5JY::DSP::Decimator<float> *oldD = m_Decimator.exchange(d);
+	KK5JY::DSP::Interpolator<float> *oldI = m_Interpolator.exchange(i);
+	DiversityRx *oldDiv = div ? m_Diversity.exchange(div) : 0;
+	waitTaps();
+	delete oldD;
+	delete oldI;
+	if (oldDiv) {
+		m_DivWins[0] += oldDiv->wins(0);
+		m_DivWins[1] += oldDiv->wins(1);
+		delete oldDiv;
+	}
+
+	m_FilterPass = pass;
+	m_FilterAtten = atten;
+	m_FilterWindow = s_Windows[w].name;
+	m_FilterWindowFn = s_Windows[w].fn;
+	return true;
+}
+
+
+//
+//  SoundCardDV::filterDesign(...) - returns the rate conversion design
+//
+void SoundCardDV::filterDesign(float &pass, float &atten, std::string &window, double &macs) const {
+	pass = m_FilterPass;
+	atten = m_FilterAtten;
+	window = m_FilterWindow;
+
+	// with diversity on, each branch decimates
+	macs = m_Decimator.load()->macs() * (m_Diversity.load() ? 2 : 1);
+}
+
+
+//
+//  SoundCardDV::rxFilterOn(...) - start the RX channel filter
+//
+bool SoundCardDV::rxFilterOn(float low, float high, size_t taps) {
+	if (low < 0 || high <= low || high >= MODEM_FS / 2 || taps < 3 || taps > RXFILTER_MAX_TAPS)
+		return false;
+
+	// design it here, on the control thread
+	taps |= 1;
+	double *h = KK5JY::DSP::FirFilterUtils::GenerateBandPassCoefficients<double>(
+		KK5JY::DSP::FirFilterUtils::BlackmanWindow, taps,
+		2.0 * M_PI * low / MODEM_FS, 2.0 * M_PI * high / MODEM_FS);
+	const std::vector<float> coefs(h, h + taps);
+	delete[] h;
+	KK5JY::DSP::FastFirFilter<float> *f =
+		new KK5JY::DSP::FastFirFilter<float>(coefs, (RXFILTER_MAX_DELAY_MS * MODEM_FS) / 1000);
+	KK5JY::DSP::FastFirFilter<float> *r =
+		new KK5JY::DSP::FastFirFilter<float>(coefs, (RXFILTER_MAX_DELAY_MS * MODEM_FS) / 1000);
+
+	// swap them in, and wait for the audio thread to let go of the old ones
+	KK5JY::DSP::FastFirFilter<float> *old = m_RxFilter.exchange(f);
+	KK5JY::DSP::FastFirFilter<float> *oldR = m_RxFilterRight.exchange(r);
+	if (old || oldR) {
+		waitTaps();
+		delete old;
+		delete oldR;
+	}
+	m_RxFilterLow = low;
+	m_RxFilterHigh = high;
+	return true;
+}
+
+
+//
+//  SoundCardDV::rxFilterOff() - remove the RX channel filter
+//
+void SoundCardDV::rxFilterOff() {
+	KK5JY::DSP::FastFirFilter<float> *old = m_RxFilter.exchange(0);
+	KK5JY::DSP::FastFirFilter<float> *oldR = m_RxFilterRight.exchange(0);
+	if (old || oldR) {
+		waitTaps();
+		delete old;
+		delete oldR;
+	}
+}
+
+
+//
+//  SoundCardDV::rxFilter(...) - returns the RX channel filter settings
+//
+bool SoundCardDV::rxFilter(float &low, float &high, size_t &taps, bool &fast) const {
+	const KK5JY::DSP::FastFirFilter<float> *f = m_RxFilter.load();
+	if (!f)
+		return false;
+	low = m_RxFilterLow;
+	high = m_RxFilterHigh;
+	taps = f->length();
+	fast = f->fast();
+	return true;
+}
+
+
+//
+//  SoundCardDV::measureLatency(...) - time a chirp through a loopback
+//
+bool SoundCardDV::measureLatency(double &ms, double &quality) {
+	ms = quality = 0;
+	if (!m_Running || m_Suspended || m_Probe.load())
+		return false;
+
+	// arm the probe, and give the audio thread the whole recording, and
+	//    as long again, to fill it
+	LatencyProbe *p = new LatencyProbe(rate());
+	const std::chrono::steady_clock::time_point limit = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(2 * p->seconds() + 0.5));
+	m_Probe.store(p);
+	while (!p->done() && std::chrono::steady_clock::now() < limit)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	m_Probe.exchange(0);
+	waitTaps();
+	const bool result = p->result(ms, quality);
+	delete p;
+	return result;
+}
+
+
+//
+//  SoundCardDV::pipelineLatency(...) - the latency of each stage
+//
+void SoundCardDV::pipelineLatency(pipeline_latency &p) const {
+	const double card = rate();
+	p.card = 2000.0 * window() / card;
+	p.decimator = 1000.0 * m_Decimator.load()->delay() / card;
+	p.interpolator = 1000.0 * m_Interpolator.load()->delay() / card;
+
+	// the RX filter only runs in RX, and is linear-phase
+	p.rx_filter = 0;
+	const KK5JY::DSP::FastFirFilter<float> *f = m_RxFilter.load();
+	if (f && mMode == ModesDV::RX)
+		p.rx_filter = 1000.0 * (f->delay() + (f->length() - 1) / 2.0) / MODEM_FS;
+
+	// the modem waits for a whole frame before it runs
+	p.in_buffer = 1000.0 * inputDepth() / MODEM_FS;
+	p.frame = 1000.0 * ((mMode == ModesDV::TX) ? n_speech_samples : n_nom_modem_samples) / MODEM_FS;
+	p.out_buffer = 1000.0 * outputDepth() / card;
+
+	p.total = p.card + p.decimator + p.rx_filter + p.in_buffer + p.frame + p.out_buffer + p.interpolator;
+}
+
+
+//
+//  SoundCardDV::interpolate(...) - upsample modem output to the card
+//
+void SoundCardDV::interpolate(const short *samples, size_t count) {
+	TraceScope ts("interpolate");
+	KK5JY::DSP::Interpolator<float> *ip = m_Interpolator.load();
+	const bool drift = m_DriftOn;
+	size_t i = 0;
+	for (i = 0; (i != count) && (out_buffer.size() <= (10 * count)); ++i) {
+		ip->write(*samples++, &m_IntOut[0]);
+		for (size_t j = 0; j != m_Ratio; ++j) {
+			if (drift) {
+				float y[2];
+				const size_t n = m_Farrow.write(m_IntOut[j], y);
+				for (size_t k = 0; k != n; ++k)
+					out_buffer.push_back(y[k]);
+			} else {
+				out_buffer.push_back(m_IntOut[j]);
+			}
+		}
+	}
+
+	// samples lost here would read as drift
+	if (i != count)
+		m_DriftGlitch = true;
+}
+
+
+//
+//  SoundCardDV::track(...) - update the drift estimate
+//
+void SoundCardDV::track(size_t count) {
+	DriftTracker &d = (mMode == ModesDV::TX) ? m_TxDrift : m_RxDrift;
+
+	// a new mode, or a gap in tracking, starts the buffer over; lost
+	//    samples only spoil the current window
+	if (mMode != m_DriftMode || m_Frames != m_DriftFrame + 1)
+		d.reset();
+	else if (m_DriftGlitch || m_OutDrops != m_DriftDrops)
+		d.restart();
+	m_DriftMode = mMode;
+	m_DriftFrame = m_Frames;
+	m_DriftDrops = m_OutDrops;
+	m_DriftGlitch = false;
+
+	const size_t depth = out_buffer.size();
+	m_DriftDepth.store(depth, std::memory_order_relaxed);
+	m_Farrow.step(d.update(depth, count));
+	m_DriftPpm[(mMode == ModesDV::TX) ? 1 : 0] = d.ppm();
+	m_DriftTarget = d.target();
+}
+
+
+//
+//  SoundCardDV::recording() - returns the recording path
+//
+std::string SoundCardDV::recording() const {
+	AudioRecorder *r = m_Recorder.load();
+	return r ? r->path() : std::string();
+}
+
+
+//
+//  SoundCardDV::recordDrops() - returns frames lost by all recordings
+//
+uint64_t SoundCardDV::recordDrops() const {
+	AudioRecorder *r = m_Recorder.load();
+	return m_RecordDrops + (r ? r->dropped() : 0);
 }
 
 
@@ -191,6 +968,12 @@ SoundCardDV::~SoundCardDV() {
 //
 basic_stats SoundCardDV::stats() {
 	basic_stats result;
+	DiversityRx *d = m_Diversity.load();
+	if (d) {
+		result.sync = d->sync();
+		result.snr = d->snr();
+		return result;
+	}
 	int syncVal;
 	freedv_get_modem_stats(m_freedv, &syncVal, &result.snr);
 	result.sync = syncVal;
@@ -202,6 +985,9 @@ basic_stats SoundCardDV::stats() {
 //  SoundCardDV::sync() - returns sync value
 //
 bool SoundCardDV::sync() {
+	DiversityRx *d = m_Diversity.load();
+	if (d)
+		return d->sync() ? true : false;
 	int syncVal = 0;
 	float snrVal = 0;
 	freedv_get_modem_stats(m_freedv, &syncVal, &snrVal);
@@ -213,6 +999,9 @@ bool SoundCardDV::sync() {
 //  SoundCardDV::snr() - returns SNR value
 //
 float SoundCardDV::snr() {
+	DiversityRx *d = m_Diversity.load();
+	if (d)
+		return d->snr();
 	int syncVal = 0;
 	float snrVal = 0;
 	freedv_get_modem_stats(m_freedv, &syncVal, &snrVal);
@@ -224,9 +1013,97 @@ float SoundCardDV::snr() {
 //  SoundCardDV::df() - returns delta-freq value
 //
 float SoundCardDV::df() {
-	::MODEM_STATS stats;
-	freedv_get_modem_extended_stats(m_freedv, &stats);
-	return stats.foff;
+	modem_snapshot m;
+	modemStats(m);
+	return m.foff;
+}
+
+
+//
+//  SoundCardDV::snapshot(...) - take and publish the extended modem stats
+//                               of the receiver 'f'
+//
+void SoundCardDV::snapshot(freedv *f) {
+	TraceScope ts("snapshot");
+	::MODEM_STATS *ms = m_ModemStats;
+	modem_snapshot &m = m_SnapshotWork;
+	int syncVal = 0;
+	freedv_get_modem_stats(f, &syncVal, &m.snr);
+	freedv_get_modem_extended_stats(f, ms);
+
+	m.frame = m_ModemFrames + 1;
+	m.sync = syncVal;
+	m.foff = ms->foff;
+	m.rx_timing = ms->rx_timing;
+	m.clock_offset = ms->clock_offset;
+	m.sync_metric = ms->sync_metric;
+	for (size_t i = 0; i != 4; ++i)
+		m.f_est[i] = ms->f_est[i];
+
+	// the constellation, row by row, and the mean magnitude per carrier
+	const size_t nc = std::min(std::max(ms->Nc, 0), MODEM_SNAPSHOT_CARRIERS);
+	const size_t nr = nc ? std::min(static_cast<size_t>(std::max(ms->nr, 0)), MODEM_SNAPSHOT_POINTS / nc) : 0;
+	m.nc = nc;
+	m.nr = nr;
+	m.points = nc * nr;
+	float *xy = m.scatter;
+	for (size_t c = 0; c != nc; ++c)
+		m.carrier[c] = 0;
+	for (size_t r = 0; r != nr; ++r) {
+		for (size_t c = 0; c != nc; ++c) {
+			const COMP &p = ms->rx_symbols[r][c];
+			*xy++ = p.real;
+			*xy++ = p.imag;
+			m.carrier[c] += sqrtf(p.real * p.real + p.imag * p.imag);
+		}
+	}
+	for (size_t c = 0; nr && c != nc; ++c)
+		m.carrier[c] /= nr;
+
+	seqWrite(m_SnapshotSeq, m_Snapshot, m);
+
+	// the same values go to shared memory, when it is on
+	TelemetryRegion *t = m_Telemetry.load(std::memory_order_relaxed);
+	if (t) {
+		m_TelemetryData.sync = m.sync;
+		m_TelemetryData.snr = m.snr;
+		m_TelemetryData.df = m.foff;
+		t->publish(m);
+	}
+}
+
+
+//
+//  SoundCardDV::publish(...) - update and publish the telemetry
+//
+void SoundCardDV::publish(TelemetryRegion *t, float usec) {
+	telemetry_data &d = m_TelemetryData;
+
+	// roll the timing window
+	m_Timer.add(usec);
+	if (m_Timer.count() >= TELEMETRY_WINDOW) {
+		d.event_p50 = m_Timer.percentile(0.50);
+		d.event_p90 = m_Timer.percentile(0.90);
+		d.event_p99 = m_Timer.percentile(0.99);
+		d.event_max = m_Timer.max();
+		m_Timer.clear();
+	}
+
+	d.frames = m_Frames;
+	d.modem_frames = m_ModemFrames;
+	d.clips = m_InLevel.clips();
+	d.in_peak = m_InLevel.peakDb();
+	d.in_rms = m_InLevel.rmsDb();
+	d.out_peak = m_OutLevel.peakDb();
+	d.out_rms = m_OutLevel.rmsDb();
+	d.xrun_in = overflows();
+	d.xrun_out = underflows();
+	d.drop_in = m_InDrops;
+	d.drop_out = m_OutDrops;
+	d.mode = mMode;
+	d.in_depth = m_InDepth.load(std::memory_order_relaxed);
+	d.out_depth = m_OutDepth.load(std::memory_order_relaxed);
+	t->publish(d);
 }
 
 
@@ -240,23 +1117,74 @@ float SoundCardDV::df() {
 //	NOTE: input and output are in stereo by default, L first, then R
 //
 void SoundCardDV::event(float *in, float *out, size_t count) {
+	// m_TapBusy keeps the taps alive while this callback uses them
+	m_TapBusy.store(true);
+
+	TelemetryRegion *t = m_Telemetry.load();
+	std::chrono::steady_clock::time_point start;
+	if (t)
+		start = std::chrono::steady_clock::now();
+
+	// the first callback after idle measures how long the restart took
+	if (m_Resuming.load(std::memory_order_relaxed) && m_Resuming.exchange(false)) {
+		const float usec = std::chrono::duration<float, std::micro>(
+			std::chrono::steady_clock::now() - m_ResumeStart).count();
+		m_ResumeUsec = usec;
+		if (usec > m_ResumeMax)
+			m_ResumeMax = usec;
+	}
+
+	TraceScope ts("event");
+
+	process(in, out, count);
+
+	// the depths, for the control thread
+	m_InDepth.store(in_buffer.size(), std::memory_order_relaxed);
+	m_OutDepth.store(out_buffer.size(), std::memory_order_relaxed);
+
+	// a latency measurement replaces the output
+	LatencyProbe *probe = m_Probe.load();
+	if (probe)
+		probe->process(in, channelsIn(), out, channelsOut(), count);
+
+	// meter the first output channel
+	if (mMode != ModesDV::Mute)
+		m_OutLevel.block(out, count, channelsOut());
+
+	// recorder tap
+	AudioRecorder *r = m_Recorder.load();
+	if (r)
+		r->write(in, channelsIn(), out, channelsOut(), count);
+
+	if (t) {
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		publish(t, std::chrono::duration<float, std::micro>(end - start).count());
+	}
+
+	m_TapBusy.store(false);
+}
+
+
+//
+//  process one sound card buffer
+//
+void SoundCardDV::process(float *in, float *out, size_t count) {
 	++m_Frames;
 
+	// meter the (left) input; the decimated stream is checked again
+	//    below, since the filters can overshoot
+	if (mMode != ModesDV::Mute) {
+		if (m_InLevel.block(in, count, channelsIn()))
+			clipping = true;
+	}
+
 	switch (mMode) {
 		//
 		//  MODE == MUTE
 		//
 		case ModesDV::Mute: {
-			// read the number of output channels
-			const uint16_t co = channelsOut();
-
-			// for each sample
-			for (size_t i = 0; i != count; ++i) {
-				// copy zero into ALL output channels
-				for (size_t j = 0; j != co; ++j) {
-					*out++ = 0;
-				}
-			}
+			// zero ALL output channels, in one pass
+			memset(out, 0, sizeof(float) * count * channelsOut());
 		} break;
 
 		//
@@ -299,45 +1227,86 @@ void SoundCardDV::event(float *in, float *out, size_t count) {
 			// the number of samples that the en/decoder expects
 			size_t nin = (mMode == ModesDV::RX) ? freedv_nin(m_freedv) : n_speech_samples;
 
+			// a pre-encoded source replaces the TX audio
+			CodecSource *src = (mMode == ModesDV::TX) ? m_CodecSource.load() : 0;
+
+			// diversity receive takes both input channels, and replaces
+			//    the single receiver below
+			DiversityRx *div = (mMode == ModesDV::RX) ? m_Diversity.load() : 0;
+			if (div) {
+				TraceScope ts("diversity");
+				const size_t clips = div->write(in, ci, count, &m_Spectrum, m_RxFilter.load(), m_RxFilterRight.load());
+				if (clips) {
+					m_ModemClips += clips;
+					clipping = true;
+				}
+				size_t nout = 0;
+				CodecTap *tap = m_CodecTap.load();
+				while ((nout = div->read(modem_out, tap)) != 0) {
+					// the stats are those of the receiver that won the frame
+					snapshot(div->winner());
+					++m_ModemFrames;
+					interpolate(modem_out, nout);
+				}
+			}
+
 			#ifdef EMIT_THROUGHPUT_COUNTS
 			uint16_t input_count = 0;
 			#endif
 
+			// the decimator, and the RX channel filter, if any
+			KK5JY::DSP::Decimator<float> *dec = m_Decimator.load();
+			KK5JY::DSP::FastFirFilter<float> *rxf = (mMode == ModesDV::RX) ? m_RxFilter.load() : 0;
+
 			// for each sample
-			for (size_t i = 0; (i != count) && (in_buffer.size() <= (10 * nin)); ++i) {
+			size_t i = 0;
+			size_t clips = 0;
+			Trace::begin("decimate");
+			for (i = 0; !src && !div && (i != count) && (in_buffer.size() <= (10 * nin)); ++i) {
 				#ifdef EMIT_THROUGHPUT_COUNTS
 				++input_count;
 				#endif
 
 				float sample = *in; // LEFT input
 				in += ci; // step to next sample, stepping over any other channels
-				if (abs(sample) >= CLIP_LIMIT)
-					clipping = true;
-				sample = m_DecFilter.filter(sample);
-				if (abs(sample) >= CLIP_LIMIT)
-					clipping = true;
-				if (++dec_ctr == (CARD_FS / MODEM_FS)) {
-					dec_ctr = 0;
-					in_buffer.push_back(SHRT_MAX * sample);
+				if (dec->write(sample, sample)) {
+					float v = rxf ? rxf->filter(sample) : sample;
+					if (fabs(v) >= CLIP_LIMIT) {
+						++clips;
+						v = std::max(-1.0f, std::min(1.0f, v));
+					}
+					in_buffer.push_back(SHRT_MAX * v);
+					m_Spectrum.write(sample);
 				}
 			}
+			Trace::end("decimate");
+			if (clips) {
+				m_ModemClips += clips;
+				clipping = true;
+			}
+			if (!src && !div && i != count)
+				++m_InDrops;
 			#ifdef EMIT_THROUGHPUT_COUNTS
-			std::cerr << "IN: " << input_count << "; " << in_buffer.size() << std::endl;
+			Logger::write(LogDebug, "IN: %u; %u", input_count, in_buffer.size());
 			#endif
 
+			// the energy gate may skip the demodulator on an empty channel
+			const bool gated = (mMode == ModesDV::RX) && !div && m_GateOn.load(std::memory_order_relaxed) && gate(nin);
+
 			//
-			//  MODEM: encode or decode data
+			//  MODEM: encode or decode data; a codec source is paced
+			//         by the output buffer instead of the input
 			//
-			if (in_buffer.size() >= nin) { // underflow check
+			if (!div && !gated && (src ? (out_buffer.size() < 2 * count) : (in_buffer.size() >= nin))) { // underflow check
 				#ifdef EMIT_THROUGHPUT_COUNTS
-				std::cerr << "MODEM_IN: " << nin << std::endl;
+				Logger::write(LogDebug, "MODEM_IN: %u", nin);
 				#endif
 
 				int16_t *toCopy = 0;
 
 				// set up the input buffer
 				toCopy = modem_in;
-				for (size_t i = 0; i != nin; ++i) {
+				for (size_t i = 0; !src && i != nin; ++i) {
 					*toCopy++ = in_buffer.front();
 					in_buffer.pop_front();
 				}
@@ -345,29 +1314,37 @@ void SoundCardDV::event(float *in, float *out, size_t count) {
 				// encode/decode
 				size_t nout = 0;
 				if (mMode == ModesDV::RX) {
-					nout = freedv_rx(m_freedv, modem_out, modem_in);
+					CodecTap *tap = m_CodecTap.load();
+					if (tap) {
+						TraceScope ts("rx_codec");
+						nout = rxCodec(tap);
+					} else {
+						TraceScope ts("freedv_rx");
+						nout = freedv_rx(m_freedv, modem_out, modem_in);
+					}
+
+					// snapshot the stats here, on the modem thread
+					snapshot(m_freedv);
+				} else if (src) {
+					TraceScope ts("tx_codec");
+					nout = txCodec(src);
 				} else {
+					TraceScope ts("freedv_tx");
 					freedv_tx(m_freedv, modem_out, modem_in);
 					nout = n_nom_modem_samples;
 				}
+				++m_ModemFrames;
 
-				// copy the modem output to the buffer
-				toCopy = modem_out;
-				for (size_t i = 0; (i != nout) && (out_buffer.size() <= (10 * nout)); ++i) {
-					float sample = *toCopy++;
-					// and upsample
-					for (size_t j = 0; j != (CARD_FS / MODEM_FS); ++j) {
-						out_buffer.push_back(m_IntFilter.filter(sample));
-					}
-				}
+				// copy the modem output to the buffer, and upsample
+				interpolate(modem_out, nout);
 
 				#ifdef EMIT_THROUGHPUT_COUNTS
-				std::cerr << "MODEM_OUT: " << nout << std::endl;
+				Logger::write(LogDebug, "MODEM_OUT: %u", nout);
 				#endif
 			#ifdef INPUT_UNDERFLOW_DEBUG
-				std::cerr << "DEBUG: modem(" << ((mMode == ModesDV::RX) ? "RX" : "TX") << ") buffer OK" << std::endl;
+				Logger::write(LogDebug, "modem(%s) buffer OK", (mMode == ModesDV::RX) ? "RX" : "TX");
 			} else {
-				std::cerr << "DEBUG: modem(" << ((mMode == ModesDV::RX) ? "RX" : "TX") << ") underflow, needed " << nin << ", had " << in_buffer.size() << std::endl;
+				Logger::write(LogDebug, "modem(%s) underflow, needed %u, had %u", (mMode == ModesDV::RX) ? "RX" : "TX", nin, in_buffer.size());
 			#endif
 			}
 
@@ -379,6 +1356,8 @@ void SoundCardDV::event(float *in, float *out, size_t count) {
 			#endif
 
 			if (out_buffer.size() >= count) {
+				TraceScope ts("output");
+
 				// for each sample
 				for (size_t i = 0; i != count; ++i) {
 					#ifdef EMIT_THROUGHPUT_COUNTS
@@ -398,12 +1377,14 @@ void SoundCardDV::event(float *in, float *out, size_t count) {
 				}
 
 				#ifdef EMIT_THROUGHPUT_COUNTS
-				std::cout << "OUT: " << output_count << "; " << out_buffer.size() << std::endl;
+				Logger::write(LogDebug, "OUT: %u; %u", output_count, out_buffer.size());
 				#endif
 				#ifdef OUTPUT_UNDERFLOW_DEBUG
-				std::cerr << "DEBUG: output buffer OK" << std::endl;
+				Logger::write(LogDebug, "output buffer OK");
 				#endif
 			} else {
+				++m_OutDrops;
+
 				// copy to output soundcard buffer
 				for (size_t i = 0; i != count; ++i) {
 					for (size_t j = 0; j != co; ++j) {
@@ -413,9 +1394,13 @@ void SoundCardDV::event(float *in, float *out, size_t count) {
 				}
 
 				#ifdef OUTPUT_UNDERFLOW_DEBUG
-				std::cerr << "DEBUG: output underflow, needed" << count << ", had " << out_buffer.size() << std::endl;
+				Logger::write(LogDebug, "output underflow, needed %u, had %u", count, out_buffer.size());
 				#endif
 			}
+
+			// a codec source is paced by the output buffer, so it can't drift
+			if (m_DriftOn && !src)
+				track(count);
 		} break;
 	}
 }
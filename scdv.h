@@ -24,15 +24,60 @@
 // needed for buffer types
 #include <deque>
 
+// resume timing
+#include <chrono>
+
 // import sound card interface
 #include "sc.h"
 
-// import FIR filter type
-#include "FirFilter.h"
+// import the rate converters
+#include "Resampler.h"
+
+// import the long FIR filter type
+#include "FastFirFilter.h"
+
+// import the drift-correcting resampler
+#include "FarrowResampler.h"
+
+// import level meter type
+#include "LevelMeter.h"
 
 // local data types
 #include "localtypes.h"
 
+// spectrum monitor
+#include "spectrum.h"
+
+// shared-memory telemetry
+#include "telemetry.h"
+
+// WAV recorder
+#include "recorder.h"
+
+// codec2 bitstream tap
+#include "codectap.h"
+
+// pre-encoded codec2 TX source
+#include "codecsource.h"
+
+// dual-receiver diversity
+#include "diversity.h"
+
+// loopback latency measurement
+#include "latency.h"
+
+// sample clock drift
+#include "drift.h"
+
+// non-blocking logging
+#include "logger.h"
+
+// extended modem stats
+struct MODEM_STATS;
+
+// codec2 state
+struct CODEC2;
+
 
 //
 //
@@ -42,6 +87,7 @@
 class SoundCardDV : public SoundCard {
 	private:
 		ModesDV mMode;
+		int m_Modem;
 
 		// FreeDV API fields
 		local_callback_state cb_state;
@@ -54,22 +100,121 @@ class SoundCardDV : public SoundCard {
 		int sql_en;
 		float sql_th;
 		volatile uint64_t m_Frames;
+		volatile uint64_t m_ModemFrames;
 		volatile bool clipping;
+		volatile uint64_t m_ModemClips;
+		volatile uint64_t m_InDrops;
+		volatile uint64_t m_OutDrops;
 
 		// buffers between FreeDV and the sound card
 		std::deque<int16_t> in_buffer;
 		std::deque<int16_t> out_buffer;
 
-		// decimation counter
-		uint8_t dec_ctr;
-
-		// decimation and interpolation filters
-		KK5JY::DSP::FirFilter<float> m_DecFilter;
-		KK5JY::DSP::FirFilter<float> m_IntFilter;
+		// their depths, published by the audio thread once per callback,
+		//    for other threads to read
+		std::atomic<size_t> m_InDepth;
+		std::atomic<size_t> m_OutDepth;
+
+		// the sound card to modem rate ratio
+		const unsigned m_Ratio;
+
+		// decimation and interpolation cascades, replaced whole by the
+		//    control thread, and one modem sample's worth of output
+		std::atomic<KK5JY::DSP::Decimator<float>*> m_Decimator;
+		std::atomic<KK5JY::DSP::Interpolator<float>*> m_Interpolator;
+		std::vector<float> m_IntOut;
+
+		// the current filter design (control thread only)
+		float m_FilterPass;
+		float m_FilterAtten;
+		std::string m_FilterWindow;
+		KK5JY::DSP::WindowFunction m_FilterWindowFn;
+
+		// input and output level meters
+		KK5JY::DSP::LevelMeter m_InLevel;
+		KK5JY::DSP::LevelMeter m_OutLevel;
+
+		// spectrum of the decimated input
+		SpectrumMonitor m_Spectrum;
+
+		// shared-memory telemetry (written by the audio thread)
+		std::atomic<TelemetryRegion*> m_Telemetry;
+		EventTimer m_Timer;
+		telemetry_data m_TelemetryData;
+		::MODEM_STATS *m_ModemStats;
+
+		// extended stats of the latest RX frame, behind a sequence lock
+		std::atomic<uint32_t> m_SnapshotSeq;
+		modem_snapshot m_Snapshot;
+		modem_snapshot m_SnapshotWork;
+
+		// WAV recorder tap
+		std::atomic<AudioRecorder*> m_Recorder;
+		std::atomic<bool> m_TapBusy;
+		uint64_t m_RecordDrops;
+
+		// codec2 bitstream tap
+		std::atomic<CodecTap*> m_CodecTap;
+		struct CODEC2 *m_Codec2;
+		unsigned char *codec_bits;
+
+		// pre-encoded codec2 TX source
+		std::atomic<CodecSource*> m_CodecSource;
+		size_t m_CodecFrameBytes;
+		uint64_t m_CodecSent;
+		uint64_t m_CodecUnderruns;
+
+		// RX energy gate; the level is mean-square, relative to full scale
+		std::atomic<bool> m_GateOn;
+		std::atomic<float> m_GateLevel;
+		size_t m_GateHang;
+		std::atomic<uint64_t> m_GateRun;
+		std::atomic<uint64_t> m_GateSkipped;
+
+		// low-power idle: the stream is stopped while muted
+		bool m_Running;
+		volatile bool m_IdleOn;
+		bool m_Suspended;
+		uint64_t m_Suspends;
+		std::chrono::steady_clock::time_point m_ResumeStart;
+		std::atomic<bool> m_Resuming;
+		volatile float m_ResumeUsec;
+		volatile float m_ResumeMax;
+
+		// dual-receiver diversity (RX only)
+		std::atomic<DiversityRx*> m_Diversity;
+		uint64_t m_DivWins[2];
+
+		// RX channel filter, at the modem rate, ahead of the demodulator,
+		//    and its twin for the right channel with diversity on; the
+		//    settings are only used by the control thread
+		std::atomic<KK5JY::DSP::FastFirFilter<float>*> m_RxFilter;
+		std::atomic<KK5JY::DSP::FastFirFilter<float>*> m_RxFilterRight;
+		float m_RxFilterLow;
+		float m_RxFilterHigh;
+
+		// loopback latency probe, armed by the control thread
+		std::atomic<LatencyProbe*> m_Probe;
+
+		// sample clock drift, tracked separately for RX and TX, and the
+		//    output resampler that corrects it (audio thread only)
+		volatile bool m_DriftOn;
+		DriftTracker m_RxDrift;
+		DriftTracker m_TxDrift;
+		KK5JY::DSP::FarrowResampler<float> m_Farrow;
+		ModesDV m_DriftMode;
+		uint64_t m_DriftFrame;
+		uint64_t m_DriftDrops;
+		bool m_DriftGlitch;
+		volatile float m_DriftPpm[2];
+		volatile float m_DriftTarget;
+		std::atomic<size_t> m_DriftDepth;
 
 	private: // callbacks
 		//  callback - returns the next TX data byte to send
 		static char local_get_next_tx_char(void *callback_state);
+		//  callback - accepts the next RX data byte received
+		static void local_put_next_rx_char(void *callback_state, char c);
 		//  TX data callback - updates the callback counter
 		static void local_get_next_proto(void *callback_state, char *proto_bits);
 		//  RX modem callback -- for safety
@@ -77,22 +222,61 @@ class SoundCardDV : public SoundCard {
 		//  TX modem callback
 		static void local_datatx(void *callback_state, unsigned char *packet, size_t *size);
 
+	private:
+		//  process one sound card buffer
+		void process(float *in, float *out, size_t count);
+
+		//  update and publish the shared-memory telemetry
+		void publish(TelemetryRegion *t, float usec);
+
+		//  take and publish the extended stats of the frame just demodulated
+		//  by 'f'
+		void snapshot(freedv *f);
+
+		//  demodulate to codec bits, forward them, and decode locally
+		size_t rxCodec(CodecTap *tap);
+
+		//  modulate one frame from the pre-encoded source
+		size_t txCodec(CodecSource *src);
+
+		//  create a diversity receiver with the given rate filters
+		DiversityRx *newDiversity(unsigned r, float pass, float atten, KK5JY::DSP::WindowFunction fn);
+
+		//  stop the stream for idle, if the backend allows it
+		void suspend();
+
+		//  restart a stream stopped for idle, timing the first callback
+		bool resume();
+
+		//  run the RX energy gate; returns true if the demodulator should
+		//    not run this pass
+		bool gate(size_t nin);
+
+		//  upsample one frame of modem output into the output buffer
+		void interpolate(const short *samples, size_t count);
+
+		//  update the drift estimate, and the output resampler, after
+		//    'count' samples were played
+		void track(size_t count);
+
+		//  wait until the audio thread is not using any tap
+		void waitTaps() const;
+
 	public: // [cd]tors
-		SoundCardDV(int modem, int id, int win = 0);
+		// 'backend' is owned by the card (see createBackend(...)); or pass
+		//    'vc' instead, to run without one, driven by SoundCard::drive(...);
+		//    'rate' must be a multiple of MODEM_FS, which needs no resampling
+		SoundCardDV(int modem, AudioBackend *backend, int win = 0, const VirtualCard *vc = 0, unsigned rate = CARD_FS);
 		virtual ~SoundCardDV();
 
-	public: // accessors
-		// set mode
-		bool mode(const ModesDV &newMode) {
-			if (newMode < ModesDV::MinValue || newMode > ModesDV::MaxValue) {
-				return false;
-			}
-
-			// set the new mode
-			mMode = newMode;
+	public: // stream control
+		bool start();
+		void stop();
 
-			return true;
-		}
+	public: // accessors
+		// set mode; with idle on, entering MUTE stops the stream, and
+		//    leaving it starts the stream again
+		bool mode(const ModesDV &newMode);
 
 		// set squelch threshold
 		void threshold(float value) {
@@ -108,13 +292,44 @@ class SoundCardDV : public SoundCard {
 
 		// set text
 		void text(const std::string &s) {
-			strcpy(cb_state.tx_str, s.empty() ? DEFAULT_TEXT : s.c_str());
-			cb_state.ptx_str = cb_state.tx_str;
+			cb_state.text.beacon(s.empty() ? DEFAULT_TEXT : s);
 		}
 
 		// get text
 		std::string text() const {
-			return cb_state.tx_str;
+			return cb_state.text.beacon();
+		}
+
+		// returns (and removes) the text received since the last call
+		std::string receivedText() {
+			char buffer[RX_TEXT_LEN];
+			const size_t n = cb_state.received.pop(buffer, sizeof(buffer));
+			return std::string(buffer, n);
+		}
+
+		// queue a one-shot text message; false if the queue is full
+		bool queueText(const std::string &s) {
+			return cb_state.text.enqueue(s);
+		}
+
+		// the number of one-shot text messages waiting
+		size_t queuedText() const {
+			return cb_state.text.pending();
+		}
+
+		// enable modem test frames; TX sends them, RX counts bit errors
+		void testFrames(bool value) {
+			freedv_set_test_frames(m_freedv, value ? 1 : 0);
+		}
+
+		// returns the number of test frame bits received
+		int testBits() {
+			return freedv_get_total_bits(m_freedv);
+		}
+
+		// returns the number of test frame bit errors received
+		int testBitErrors() {
+			return freedv_get_total_bit_errors(m_freedv);
 		}
 
 		// get mode
@@ -139,11 +354,224 @@ class SoundCardDV : public SoundCard {
 			return value;
 		}
 
+		// returns the decimated input samples that reached the clip
+		//    limit; the filters can overshoot the card input
+		uint64_t modemClips() const {
+			return m_ModemClips;
+		}
+
+		// returns the input level meter
+		const KK5JY::DSP::LevelMeter &inputLevel() const {
+			return m_InLevel;
+		}
+
+		// returns the output level meter
+		const KK5JY::DSP::LevelMeter &outputLevel() const {
+			return m_OutLevel;
+		}
+
 		// returns the frame count
 		uint64_t frames() const {
 			return m_Frames;
 		}
 
+		// returns the number of frames passed through the modem
+		uint64_t modemFrames() const {
+			return m_ModemFrames;
+		}
+
+		// returns the number of samples waiting for the modem, as of
+		//    the last callback
+		size_t inputDepth() const {
+			return m_InDepth.load(std::memory_order_relaxed);
+		}
+
+		// returns the number of samples waiting for the sound card, as
+		//    of the last callback
+		size_t outputDepth() const {
+			return m_OutDepth.load(std::memory_order_relaxed);
+		}
+
+		// returns the spectrum monitor
+		SpectrumMonitor &spectrum() {
+			return m_Spectrum;
+		}
+
+		// start publishing telemetry to a shared-memory file; returns
+		//    false if already publishing, or on failure; an empty path
+		//    stops publishing, and removes the file
+		bool telemetry(const std::string &path);
+
+		// returns the telemetry file, or empty if not publishing
+		std::string telemetry() const {
+			TelemetryRegion *t = m_Telemetry.load();
+			return t ? t->path() : std::string();
+		}
+
+		// start recording to a WAV file, replacing any current recording;
+		//    an empty path just stops recording
+		bool record(const std::string &path, AudioRecorder::Sources src = AudioRecorder::Both);
+
+		// returns the recording file, or empty if not recording
+		std::string recording() const;
+
+		// returns the number of recorded frames lost to overflow
+		uint64_t recordDrops() const;
+
+		// start forwarding received codec2 frames to 'target' (see
+		//    CodecTap), replacing any current tap; empty just stops it
+		bool codecTap(const std::string &target);
+
+		// returns the codec tap target, or empty if not forwarding
+		std::string codecTap() const;
+
+		// returns the number of codec frames sent and dropped
+		uint64_t codecTapSent() const;
+		uint64_t codecTapDropped() const;
+
+		// transmit pre-encoded codec2 frames from 'source' (see
+		//    CodecSource) in place of the TX audio; empty just stops it
+		bool codecSource(const std::string &source);
+
+		// returns the TX codec source, or empty if not in use
+		std::string codecSource() const;
+
+		// returns the number of codec frames sent, and the number of
+		//    modem frames sent as silence because none was ready
+		uint64_t codecSourceSent() const {
+			return m_CodecSent;
+		}
+		uint64_t codecSourceUnderruns() const {
+			return m_CodecUnderruns;
+		}
+
+		// skip the demodulator while the input is below 'dbfs' (and the
+		//    modem has no sync), waking it when the input rises above;
+		//    returns false with diversity on, which the gate can't serve
+		bool gateOn(float dbfs);
+
+		// turn off the RX energy gate
+		void gateOff() {
+			m_GateOn.store(false);
+		}
+
+		// returns true, and the wake level, if the gate is on
+		bool gateLevel(float &dbfs) const;
+
+		// redesign the decimation and interpolation filters, for a passband
+		//    edge of 'pass' Hz, 'atten' dB of stopband, and a FirFilterUtils
+		//    window by name (e.g., "HAMMING"), or "KAISER"; the audio thread
+		//    takes up the new filters at its next callback.  False if the
+		//    settings are out of range.
+		bool filter(float pass, float atten, const std::string &window);
+
+		// returns the filter design, and its multiplies per card-rate
+		//    sample, in each direction; on receive, with diversity on,
+		//    that is for both branches
+		void filterDesign(float &pass, float &atten, std::string &window, double &macs) const;
+
+		// band-pass the RX input from 'low' to 'high' Hz, with 'taps' taps,
+		//    by direct form or FFT convolution, whichever is cheaper; false
+		//    if the settings are out of range
+		bool rxFilterOn(float low, float high, size_t taps = RXFILTER_TAPS);
+
+		// remove the RX channel filter
+		void rxFilterOff();
+
+		// returns true, and the settings, if the RX channel filter is on
+		bool rxFilter(float &low, float &high, size_t &taps, bool &fast) const;
+
+		// play a chirp on the outputs, in place of the modem, and find it
+		//    in the left input, which must be looped back to an output;
+		//    blocks for about LATENCY_CHIRP_MS + LATENCY_MAX_MS, and sets
+		//    the round trip in milliseconds and the peak correlation (0-1).
+		//    False if the stream is stopped, or no echo was found.
+		bool measureLatency(double &ms, double &quality);
+
+		// the latency of each stage between the card and the modem, from
+		//    the filter designs and the current buffer depths
+		void pipelineLatency(pipeline_latency &p) const;
+
+		// hold the output buffer depth against sample clock drift, by
+		//    resampling the output; on by default when the backend has
+		//    independent clocks (see AudioBackend::independentClocks())
+		void drift(bool on) {
+			m_DriftOn = on;
+		}
+
+		// returns true if drift correction is on
+		bool drift() const {
+			return m_DriftOn;
+		}
+
+		// returns the drift estimate for RX or TX, in ppm; positive when
+		//    the modem side runs faster than the card's output clock
+		float driftPpm(ModesDV m) const {
+			return m_DriftPpm[(m == ModesDV::TX) ? 1 : 0];
+		}
+
+		// returns the output buffer depth held, in samples, or zero
+		//    before the first estimate of this mode
+		float driftTarget() const {
+			return m_DriftTarget;
+		}
+
+		// returns the output buffer depth that drift tracking last saw,
+		//    in samples
+		size_t driftDepth() const {
+			return m_DriftDepth.load(std::memory_order_relaxed);
+		}
+
+		// returns the number of modem frames demodulated and skipped
+		//    while the gate was on
+		uint64_t gateRun() const {
+			return m_GateRun.load(std::memory_order_relaxed);
+		}
+		uint64_t gateSkipped() const {
+			return m_GateSkipped.load(std::memory_order_relaxed);
+		}
+
+		// stop the stream whenever the mode is MUTE, to save power; a
+		//    virtual card, or a data stream (see suspendable()), keeps running
+		void idle(bool on);
+
+		// returns true if idle is on
+		bool idle() const {
+			return m_IdleOn;
+		}
+
+		// returns true if the stream is stopped for idle
+		bool suspended() const {
+			return m_Suspended;
+		}
+
+		// returns the number of times the stream was stopped for idle
+		uint64_t suspends() const {
+			return m_Suspends;
+		}
+
+		// returns the time from leaving MUTE to the first callback, in
+		//    microseconds, for the last resume and the slowest one
+		float resumeLatency() const {
+			return m_ResumeUsec;
+		}
+		float resumeLatencyMax() const {
+			return m_ResumeMax;
+		}
+
+		// decode the left and right inputs with two receivers, keeping
+		//    the better frame of each pair; needs two input channels
+		bool diversity(bool on);
+
+		// returns true if diversity receive is on
+		bool diversity() const {
+			return m_Diversity.load() != 0;
+		}
+
+		// returns the number of frames taken from the left (0) or
+		//    right (1) receiver, since the card was opened
+		uint64_t diversityWins(int branch) const;
+
 		// returns basic stats pair
 		basic_stats stats();
 
@@ -153,9 +581,15 @@ class SoundCardDV : public SoundCard {
 		// returns SNR value
 		float snr();
 
-		// returns delta-freq value
+		// returns delta-freq value, as of the last RX frame
 		float df();
 
+		// copy the extended stats of the last RX frame; 'frame' is zero
+		//    if none has been demodulated yet
+		void modemStats(modem_snapshot &m) const {
+			seqRead(m_SnapshotSeq, m_Snapshot, m);
+		}
+
 	protected:
 		//  sound event handler
 		virtual void event(float *in, float *out, size_t count);
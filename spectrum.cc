@@ -0,0 +1,164 @@
+/*
+ *
+ *
+ *    spectrum.cc
+ *
+ *    SpectrumMonitor class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "spectrum.h"
+#include <chrono>
+#include <cmath>
+
+// the largest frame rate accepted
+#define SPECTRUM_MAX_RATE 50
+
+
+//
+//  SpectrumMonitor::ctor
+//
+SpectrumMonitor::SpectrumMonitor(size_t length, KK5JY::DSP::WindowFunction f)
+	: m_Length(length),
+	  m_FFT(length),
+	  m_Window(length),
+	  m_Scale(1),
+	  m_Samples(MODEM_FS),
+	  m_Dropped(0),
+	  m_Running(false),
+	  m_Rate(0),
+	  m_Seq(0) {
+	// the window functions are centered at zero
+	double sum = 0;
+	const int limit = static_cast<int>(length / 2);
+	for (size_t i = 0; i != length; ++i) {
+		m_Window[i] = f(static_cast<int>(i) - limit, static_cast<int>(length));
+		sum += m_Window[i];
+	}
+
+	// scale so that a full-scale sine reads 0 dBFS
+	if (sum != 0)
+		m_Scale = 2.0 / sum;
+}
+
+
+//
+//  SpectrumMonitor::dtor
+//
+SpectrumMonitor::~SpectrumMonitor() {
+	rate(0);
+}
+
+
+//
+//  SpectrumMonitor::rate(...) - start, retune, or stop the worker
+//
+void SpectrumMonitor::rate(unsigned fps) {
+	if (fps > SPECTRUM_MAX_RATE)
+		fps = SPECTRUM_MAX_RATE;
+	m_Rate.store(fps);
+
+	if (fps == 0 && m_Worker.joinable()) {
+		m_Running = false;
+		m_Worker.join();
+	} else if (fps != 0 && !m_Worker.joinable()) {
+		m_Running = true;
+		m_Worker = std::thread(&SpectrumMonitor::run, this);
+	}
+}
+
+
+//
+//  SpectrumMonitor::frame(...) - copy the most recent frame
+//
+bool SpectrumMonitor::frame(std::vector<uint8_t> &result) const {
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (m_Frame.empty())
+		return false;
+	result = m_Frame;
+	return true;
+}
+
+
+//
+//  SpectrumMonitor::run() - worker thread body
+//
+void SpectrumMonitor::run() {
+	std::vector<float> history(m_Length, 0.0f);
+	std::vector<std::complex<float> > work(m_Length);
+	size_t pos = 0;
+	size_t filled = 0;
+	size_t fresh = 0;
+
+	while (m_Running) {
+		// drain everything the audio thread has written
+		bool any = false;
+		float s;
+		while (m_Samples.pop(s)) {
+			history[pos] = s;
+			pos = (pos + 1) % m_Length;
+			if (filled < m_Length)
+				++filled;
+			++fresh;
+			any = true;
+		}
+
+		// transform once per hop, using the newest samples
+		const unsigned fps = m_Rate.load();
+		const size_t hop = fps ? (MODEM_FS / fps) : 0;
+		if (hop && filled == m_Length && fresh >= hop) {
+			compute(history, pos, work);
+			fresh = 0;
+		}
+
+		if (!any)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	// drop anything left over, so a restart begins fresh
+	float s;
+	while (m_Samples.pop(s)) { /* nop */ }
+}
+
+
+//
+//  SpectrumMonitor::compute(...) - transform one block and publish it
+//
+void SpectrumMonitor::compute(const std::vector<float> &history, size_t pos, std::vector<std::complex<float> > &work) {
+	// window the samples, oldest first
+	for (size_t i = 0; i != m_Length; ++i) {
+		work[i] = std::complex<float>(history[(pos + i) % m_Length] * m_Window[i], 0.0f);
+	}
+	m_FFT.forward(&work[0]);
+
+	// pack the frame
+	const size_t bins = m_Length / 2;
+	std::vector<uint8_t> result(HeaderSize + bins);
+	const uint32_t seq = m_Seq++;
+	result[0] = seq & 0xFF;
+	result[1] = (seq >> 8) & 0xFF;
+	result[2] = (seq >> 16) & 0xFF;
+	result[3] = (seq >> 24) & 0xFF;
+	result[4] = bins & 0xFF;
+	result[5] = (bins >> 8) & 0xFF;
+	result[6] = MODEM_FS & 0xFF;
+	result[7] = (MODEM_FS >> 8) & 0xFF;
+	for (size_t k = 0; k != bins; ++k) {
+		const float mag = std::abs(work[k]) * m_Scale;
+		float level = 2.0f * (20.0f * log10f(mag + 1e-9f) + 127.5f);
+		if (level < 0) level = 0;
+		if (level > 255) level = 255;
+		result[HeaderSize + k] = static_cast<uint8_t>(level);
+	}
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Frame.swap(result);
+}
+
+// EOF
@@ -0,0 +1,113 @@
+/*
+ *
+ *
+ *    spectrum.h
+ *
+ *    SpectrumMonitor class.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_SPECTRUM_H
+#define __FDVCORE_SPECTRUM_H
+
+#include <atomic>
+#include <complex>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "FirFilter.h"
+#include "FFT.h"
+#include "LockFreeRing.h"
+#include "localtypes.h"
+
+
+//
+//  SpectrumMonitor - computes a power spectrum of the modem-rate input
+//                    on a worker thread
+//
+//  The audio thread feeds samples with write(), which never blocks.  The
+//  worker thread windows and transforms the most recent samples at the
+//  configured frame rate, and publishes each result as a packed frame:
+//
+//      uint32_t seq    - frame sequence number (little-endian)
+//      uint16_t bins   - number of bins that follow (little-endian)
+//      uint16_t fs     - sample rate of the input, in Hz (little-endian)
+//      uint8_t  db[]   - bin levels, 0.5 dB per step, 0 = -127.5 dBFS,
+//                        255 = 0 dBFS; bin k is centered at k*fs/(2*bins)
+//
+class SpectrumMonitor {
+	public:
+		// size of the frame header, in bytes
+		static const size_t HeaderSize = 8;
+
+	private:
+		// FFT configuration
+		const size_t m_Length;
+		KK5JY::DSP::FFT<float> m_FFT;
+		std::vector<float> m_Window;
+		float m_Scale;
+
+		// samples from the audio thread
+		LockFreeRing<float> m_Samples;
+		std::atomic<uint64_t> m_Dropped;
+
+		// worker state
+		std::thread m_Worker;
+		std::atomic<bool> m_Running;
+		std::atomic<unsigned> m_Rate;
+
+		// the most recent frame
+		mutable std::mutex m_Lock;
+		std::vector<uint8_t> m_Frame;
+		uint32_t m_Seq;
+
+	private:
+		SpectrumMonitor(const SpectrumMonitor&);
+		SpectrumMonitor &operator=(const SpectrumMonitor&);
+
+		// the worker thread body
+		void run();
+
+		// transform one block and publish the frame
+		void compute(const std::vector<float> &history, size_t pos, std::vector<std::complex<float> > &work);
+
+	public:
+		SpectrumMonitor(size_t length = SPECTRUM_FFT_LEN, KK5JY::DSP::WindowFunction f = KK5JY::DSP::FirFilterUtils::HannWindow);
+		~SpectrumMonitor();
+
+	public: // audio thread
+		// add one modem-rate sample, in the range [-1, 1]
+		void write(float sample) {
+			if (m_Rate.load(std::memory_order_relaxed) == 0)
+				return;
+			if (!m_Samples.push(sample))
+				m_Dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	public: // control thread
+		// set the frame rate, in frames per second; zero stops the worker
+		void rate(unsigned fps);
+
+		// get the frame rate
+		unsigned rate() const {
+			return m_Rate.load();
+		}
+
+		// copy the most recent frame; returns false if there is none
+		bool frame(std::vector<uint8_t> &result) const;
+
+		// the number of samples dropped because the worker fell behind
+		uint64_t dropped() const {
+			return m_Dropped.load();
+		}
+};
+
+#endif
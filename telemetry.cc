@@ -0,0 +1,106 @@
+/*
+ *
+ *
+ *    telemetry.cc
+ *
+ *    Shared-memory telemetry region.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "telemetry.h"
+#include "localtypes.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+//
+//  TelemetryRegion::isRegion(...)
+//
+//  Any version is accepted, so that a region left by an older build is
+//  replaced, but the header must agree with the file.
+//
+bool TelemetryRegion::isRegion(const std::string &path) {
+	int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	uint32_t header[3];
+	const bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+		::read(fd, header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+		header[0] == TELEMETRY_MAGIC &&
+		header[1] != 0 && header[1] <= TELEMETRY_VERSION &&
+		header[2] == static_cast<uint64_t>(st.st_size);
+	close(fd);
+	return ok;
+}
+
+
+//
+//  TelemetryRegion::ctor
+//
+TelemetryRegion::TelemetryRegion(const std::string &path)
+	: m_Path(path),
+	  m_Region(0),
+	  m_Dev(0),
+	  m_Ino(0) {
+	// start from an empty file, so stale readers see the new layout; but
+	//    never remove a file that isn't a region
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0) {
+		if (!isRegion(path))
+			throw local_exception("Not a telemetry region, not replacing " + path);
+		unlink(path.c_str());
+	}
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		throw local_exception("Could not create telemetry region " + path);
+	}
+	if (fstat(fd, &st) == 0) {
+		m_Dev = st.st_dev;
+		m_Ino = st.st_ino;
+	}
+	if (ftruncate(fd, sizeof(telemetry_region)) != 0) {
+		close(fd);
+		unlink(path.c_str());
+		throw local_exception("Could not size telemetry region " + path);
+	}
+	void *p = mmap(0, sizeof(telemetry_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		unlink(path.c_str());
+		throw local_exception("Could not map telemetry region " + path);
+	}
+
+	// fill in the header; the file is already zeroed
+	m_Region = static_cast<telemetry_region*>(p);
+	m_Region->magic = TELEMETRY_MAGIC;
+	m_Region->version = TELEMETRY_VERSION;
+	m_Region->size = sizeof(telemetry_region);
+}
+
+
+//
+//  TelemetryRegion::dtor
+//
+TelemetryRegion::~TelemetryRegion() {
+	if (m_Region) {
+		munmap(m_Region, sizeof(telemetry_region));
+		m_Region = 0;
+
+		// the file may have been replaced since
+		struct stat st;
+		if (lstat(m_Path.c_str(), &st) == 0 && st.st_dev == m_Dev && st.st_ino == m_Ino)
+			unlink(m_Path.c_str());
+	}
+}
+
+// EOF
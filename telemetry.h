@@ -0,0 +1,269 @@
+/*
+ *
+ *
+ *    telemetry.h
+ *
+ *    Shared-memory telemetry region.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_TELEMETRY_H
+#define __FDVCORE_TELEMETRY_H
+
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <sys/types.h>
+
+// identifies the region ("FDVT")
+#define TELEMETRY_MAGIC 0x54564446
+
+// bump this whenever telemetry_data changes
+#define TELEMETRY_VERSION 3
+
+// the default region name, under /dev/shm
+#define TELEMETRY_DEFAULT_PATH "/dev/shm/fdvcore"
+
+// the most carriers and constellation points kept per modem frame
+#define MODEM_SNAPSHOT_CARRIERS 52
+#define MODEM_SNAPSHOT_POINTS 256
+
+
+//
+//  telemetry_data - the published values
+//
+//  All fields are naturally aligned, so that consumers in other languages
+//  can map the struct directly (e.g., Python 'struct' with '<' and no padding).
+//
+struct telemetry_data {
+	uint64_t frames;        // sound card callbacks
+	uint64_t modem_frames;  // frames passed through the modem
+	uint64_t clips;         // input samples at or above CLIP_LIMIT
+	uint64_t xrun_in;       // sound card input overflows
+	uint64_t xrun_out;      // sound card output underflows
+	uint64_t drop_in;       // callbacks that dropped input (buffer full)
+	uint64_t drop_out;      // callbacks that muted output (buffer empty)
+	uint32_t mode;          // current ModesDV value
+	uint32_t sync;          // modem sync state
+	float    snr;           // modem SNR estimate (dB)
+	float    df;            // modem frequency offset estimate (Hz)
+	uint32_t in_depth;      // samples waiting for the modem
+	uint32_t out_depth;     // samples waiting for the sound card
+	float    event_p50;     // callback time percentiles (usec)
+	float    event_p90;
+	float    event_p99;
+	float    event_max;
+	float    in_peak;       // decaying peak input level (dBFS)
+	float    in_rms;        // averaged RMS input level (dBFS)
+	float    out_peak;      // decaying peak output level (dBFS)
+	float    out_rms;       // averaged RMS output level (dBFS)
+};
+
+
+//
+//  modem_snapshot - the extended modem stats of one RX frame
+//
+//  Taken on the audio thread after each demodulated frame, so that a
+//  display can draw the constellation and tuning aids without calling
+//  into the modem itself.  Laid out like telemetry_data.
+//
+struct modem_snapshot {
+	uint64_t frame;         // modem_frames when taken; zero before the first
+	uint32_t modem;         // the FreeDV mode number
+	uint32_t sync;          // modem sync state
+	uint32_t nc;            // carriers used in 'carrier'
+	uint32_t nr;            // symbol rows in 'scatter'
+	uint32_t points;        // I/Q pairs used in 'scatter' (nc * nr, at most)
+	float    snr;           // SNR estimate (dB)
+	float    foff;          // frequency offset estimate (Hz)
+	float    rx_timing;     // fine timing estimate (samples)
+	float    clock_offset;  // sample clock offset (ratio, not ppm)
+	float    sync_metric;   // the modem's own sync quality measure
+	float    f_est[4];      // FSK tone frequency estimates (Hz)
+	float    carrier[MODEM_SNAPSHOT_CARRIERS];    // mean symbol magnitude per carrier
+	float    scatter[2 * MODEM_SNAPSHOT_POINTS];  // I/Q pairs, row by row
+};
+
+
+//
+//  seqWrite(...), seqRead(...) - a sequence lock around a plain struct
+//
+//  'seq' is odd while the single writer changes 'dst', and even
+//  afterward.  A reader copies the struct, then retries if 'seq' was odd
+//  or changed during the copy.
+//
+template <typename T>
+inline void seqWrite(std::atomic<uint32_t> &seq, T &dst, const T &src) {
+	const uint32_t s = seq.load(std::memory_order_relaxed);
+	seq.store(s + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(&dst, &src, sizeof(src));
+	std::atomic_thread_fence(std::memory_order_release);
+	seq.store(s + 2, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void seqRead(const std::atomic<uint32_t> &seq, const T &src, T &dst) {
+	for (;;) {
+		const uint32_t s1 = seq.load(std::memory_order_acquire);
+		if (s1 & 1)
+			continue;
+		memcpy(&dst, &src, sizeof(dst));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (seq.load(std::memory_order_relaxed) == s1)
+			return;
+	}
+}
+
+
+//
+//  telemetry_region - the layout of the mapped file
+//
+//  'seq' guards 'data', and 'modem_seq' guards 'modem', each as a
+//  sequence lock (see seqWrite).  'data' changes on every sound card
+//  callback, and 'modem' once per demodulated frame.
+//
+struct telemetry_region {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          // sizeof(telemetry_region)
+	std::atomic<uint32_t> seq;
+	telemetry_data data;
+	std::atomic<uint32_t> modem_seq;
+	uint32_t reserved;      // keeps 'modem' 8-byte aligned
+	modem_snapshot modem;
+};
+
+
+//
+//  EventTimer - rolling histogram of callback durations
+//
+//  Durations fall into buckets four per octave of microseconds, so
+//  percentiles are accurate to about 19%, and cost a scan of 64 counters.
+//
+class EventTimer {
+	private:
+		static const size_t Buckets = 64;
+		uint32_t m_Counts[Buckets];
+		uint32_t m_Total;
+		float m_Max;
+
+		static size_t bucket(float usec) {
+			size_t b = 0;
+			float edge = 1.0f;
+			while (b != Buckets - 1 && usec >= edge) {
+				edge *= 1.189207f; // 2^(1/4)
+				++b;
+			}
+			return b;
+		}
+
+		static float edge(size_t b) {
+			float result = 1.0f;
+			for (size_t i = 0; i != b; ++i)
+				result *= 1.189207f;
+			return result;
+		}
+
+	public:
+		EventTimer() {
+			clear();
+		}
+
+		void clear() {
+			memset(m_Counts, 0, sizeof(m_Counts));
+			m_Total = 0;
+			m_Max = 0;
+		}
+
+		void add(float usec) {
+			++m_Counts[bucket(usec)];
+			++m_Total;
+			if (usec > m_Max)
+				m_Max = usec;
+		}
+
+		uint32_t count() const {
+			return m_Total;
+		}
+
+		float max() const {
+			return m_Max;
+		}
+
+		// the upper bucket edge below which fraction 'p' of the samples fall
+		float percentile(float p) const {
+			const uint32_t target = static_cast<uint32_t>(p * m_Total);
+			uint32_t sum = 0;
+			for (size_t b = 0; b != Buckets; ++b) {
+				sum += m_Counts[b];
+				if (sum > target)
+					return edge(b);
+			}
+			return m_Max;
+		}
+};
+
+
+//
+//  TelemetryRegion - creates and writes the mapped region
+//
+class TelemetryRegion {
+	private:
+		std::string m_Path;
+		telemetry_region *m_Region;
+
+		// the file created, so that only it is removed
+		dev_t m_Dev;
+		ino_t m_Ino;
+
+	private:
+		TelemetryRegion(const TelemetryRegion&);
+		TelemetryRegion &operator=(const TelemetryRegion&);
+
+	public:
+		// create the region, replacing only an old region file (one
+		//    that starts with TELEMETRY_MAGIC); throws local_exception
+		//    on failure, or if 'path' is some other file
+		TelemetryRegion(const std::string &path);
+
+		// unmaps the region, and removes the file if it is still ours
+		~TelemetryRegion();
+
+		// returns true if 'path' is an existing region file
+		static bool isRegion(const std::string &path);
+
+	public:
+		// the file backing the region
+		const std::string &path() const {
+			return m_Path;
+		}
+
+		// publish new values (single writer only)
+		void publish(const telemetry_data &d) {
+			seqWrite(m_Region->seq, m_Region->data, d);
+		}
+
+		// publish a new modem snapshot (single writer only)
+		void publish(const modem_snapshot &m) {
+			seqWrite(m_Region->modem_seq, m_Region->modem, m);
+		}
+
+		// read a consistent copy of a region (for consumers)
+		static void read(const telemetry_region *r, telemetry_data &d) {
+			seqRead(r->seq, r->data, d);
+		}
+
+		static void read(const telemetry_region *r, modem_snapshot &m) {
+			seqRead(r->modem_seq, r->modem, m);
+		}
+};
+
+#endif
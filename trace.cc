@@ -0,0 +1,197 @@
+/*
+ *
+ *
+ *    trace.cc
+ *
+ *    Trace class: per-thread event rings, exported as Chrome trace JSON.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#include "trace.h"
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <mutex>
+
+
+//
+//  one thread's ring
+//
+struct trace_ring {
+	trace_event events[TRACE_RING_LEN];
+	std::atomic<uint64_t> count;        // events written this generation
+	std::atomic<uint32_t> generation;   // the start() they belong to
+	std::atomic<bool> used;             // claimed by a thread
+	unsigned tid;
+	const char *first;                  // the first event, to name the thread
+
+	trace_ring() : count(0), generation(0), used(false), tid(0), first(0) { }
+};
+
+
+// the rings, allocated by start(); never freed, since a ring must
+//    outlive any dump that reads it
+static std::mutex s_Lock;
+static trace_ring *s_Rings[TRACE_MAX_THREADS];
+static std::atomic<size_t> s_Ready(0);
+static std::atomic<uint32_t> s_Generation(0);
+
+std::atomic<bool> Trace::s_On(false);
+
+
+//
+//  trace_owner - this thread's ring, returned when the thread exits
+//
+struct trace_owner {
+	trace_ring *ring;
+
+	trace_owner() : ring(0) { }
+	~trace_owner() {
+		if (ring)
+			ring->used.store(false, std::memory_order_release);
+	}
+};
+
+static thread_local trace_owner t_Owner;
+
+
+//
+//  claim(...) - take a ready ring for this thread, or none if all are
+//               in use; never blocks
+//
+static trace_ring *claim(const char *name) {
+	const size_t ready = s_Ready.load(std::memory_order_acquire);
+	for (size_t i = 0; i != ready; ++i) {
+		trace_ring *r = s_Rings[i];
+		bool expected = false;
+		if (!r->used.load(std::memory_order_relaxed) &&
+		    r->used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			r->first = name;
+			t_Owner.ring = r;
+			return r;
+		}
+	}
+	return 0;
+}
+
+
+//
+//  now() - monotonic nanoseconds
+//
+static inline uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//
+//  Trace::record(...)
+//
+void Trace::record(const char *name, char phase) {
+	trace_ring *r = t_Owner.ring;
+	if (!r && !(r = claim(name)))
+		return;
+
+	// the writer clears its own ring for a new trace, so that a late
+	//    event can't undo the reset
+	const uint32_t g = s_Generation.load(std::memory_order_acquire);
+	if (r->generation.load(std::memory_order_relaxed) != g) {
+		r->count.store(0, std::memory_order_relaxed);
+		r->generation.store(g, std::memory_order_release);
+	}
+
+	const uint64_t n = r->count.load(std::memory_order_relaxed);
+	trace_event &e = r->events[n % TRACE_RING_LEN];
+	e.ns = now();
+	e.name = name;
+	e.phase = phase;
+	r->count.store(n + 1, std::memory_order_release);
+}
+
+
+//
+//  Trace::start()
+//
+void Trace::start() {
+	{
+		// keep spare rings ready, so no traced thread allocates
+		std::lock_guard<std::mutex> l(s_Lock);
+		size_t ready = s_Ready.load(std::memory_order_relaxed);
+		size_t used = 0;
+		for (size_t i = 0; i != ready; ++i)
+			if (s_Rings[i]->used.load(std::memory_order_relaxed))
+				++used;
+		while (ready != TRACE_MAX_THREADS && ready < used + TRACE_SPARE_RINGS) {
+			s_Rings[ready] = new trace_ring;
+			s_Rings[ready]->tid = ready + 1;
+			s_Ready.store(++ready, std::memory_order_release);
+		}
+	}
+	s_Generation.fetch_add(1, std::memory_order_release);
+	s_On.store(true);
+}
+
+
+//
+//  Trace::stop()
+//
+void Trace::stop() {
+	s_On.store(false);
+}
+
+
+//
+//  Trace::dump(...)
+//
+long Trace::dump(const std::string &path) {
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+		return -1;
+
+	std::lock_guard<std::mutex> l(s_Lock);
+	const size_t ready = s_Ready.load(std::memory_order_acquire);
+	const uint32_t g = s_Generation.load(std::memory_order_acquire);
+
+	// timestamps start from the earliest event kept; a ring from an
+	//    earlier trace, whose thread hasn't written since, is skipped
+	uint64_t origin = UINT64_MAX;
+	for (size_t i = 0; i != ready; ++i) {
+		const trace_ring *r = s_Rings[i];
+		if (r->generation.load(std::memory_order_acquire) != g)
+			continue;
+		const uint64_t count = r->count.load(std::memory_order_acquire);
+		if (count)
+			origin = std::min(origin, r->events[(count > TRACE_RING_LEN ? count - TRACE_RING_LEN : 0) % TRACE_RING_LEN].ns);
+	}
+
+	long written = 0;
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (size_t i = 0; i != ready; ++i) {
+		const trace_ring *r = s_Rings[i];
+		if (r->generation.load(std::memory_order_acquire) != g)
+			continue;
+		const uint64_t count = r->count.load(std::memory_order_acquire);
+		if (!count)
+			continue;
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			written ? ",\n" : "", r->tid, r->first);
+		for (uint64_t n = (count > TRACE_RING_LEN) ? (count - TRACE_RING_LEN) : 0; n != count; ++n) {
+			const trace_event &e = r->events[n % TRACE_RING_LEN];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+				e.name, e.phase, r->tid, (e.ns - origin) / 1000.0);
+		}
+		written += count - ((count > TRACE_RING_LEN) ? (count - TRACE_RING_LEN) : 0);
+	}
+	fprintf(f, "\n]}\n");
+	const bool ok = (fclose(f) == 0);
+	return ok ? written : -1;
+}
+
+// EOF
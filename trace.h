@@ -0,0 +1,116 @@
+/*
+ *
+ *
+ *    trace.h
+ *
+ *    Trace class: per-thread event rings, exported as Chrome trace JSON.
+ *
+ *    Copyright (C) 2018 by Matt Roberts,
+ *    All rights reserved.
+ *
+ *    License: GNU GPL3 (www.gnu.org)
+ *
+ *
+ */
+
+#ifndef __FDVCORE_TRACE_H
+#define __FDVCORE_TRACE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// events kept per thread; the oldest are overwritten
+#define TRACE_RING_LEN 65536
+
+// the most threads traced at once; a thread past this records nothing
+#define TRACE_MAX_THREADS 8
+
+// rings kept ready, beyond those in use, for threads yet to trace
+#define TRACE_SPARE_RINGS 2
+
+// where TRACE=<seconds> writes, by default, and its longest run
+#define TRACE_DEFAULT_PATH "/tmp/fdvcore-trace.json"
+#define TRACE_MAX_SECONDS 60
+
+//
+//  one begin or end event
+//
+struct trace_event {
+	uint64_t ns;       // monotonic
+	const char *name;  // a string literal
+	char phase;        // 'B' or 'E'
+};
+
+
+//
+//  Trace - records begin/end events on whichever thread calls it
+//
+//  Each thread writes only to its own ring, so recording takes no lock.
+//  start() allocates the rings, so a thread's first event only claims a
+//  ready one, with a compare-and-swap; a thread returns its ring when it
+//  exits.  Each writer clears its own ring when it sees that start() was
+//  called again.  While tracing is off, begin()/end() cost one relaxed
+//  load.
+//
+//  Names must be string literals, or otherwise outlive the trace.
+//
+class Trace {
+	private:
+		static std::atomic<bool> s_On;
+
+		// record one event on this thread's ring
+		static void record(const char *name, char phase);
+
+		friend class TraceScope;
+
+	public:
+		// returns true while tracing
+		static bool on() {
+			return s_On.load(std::memory_order_relaxed);
+		}
+
+		static void begin(const char *name) {
+			if (on())
+				record(name, 'B');
+		}
+
+		static void end(const char *name) {
+			if (on())
+				record(name, 'E');
+		}
+
+		// make rings ready, clear them all, and start recording
+		static void start();
+
+		// stop recording
+		static void stop();
+
+		// write the rings to 'path' as Chrome/Perfetto trace JSON; returns
+		//    the number of events written, or -1 on failure
+		static long dump(const std::string &path);
+};
+
+
+//
+//  TraceScope - a begin/end pair around a C++ scope
+//
+class TraceScope {
+	private:
+		const char *m_Name;
+		const bool m_On;
+
+	public:
+		TraceScope(const char *name) : m_Name(name), m_On(Trace::on()) {
+			if (m_On)
+				Trace::record(m_Name, 'B');
+		}
+		~TraceScope() {
+			// end what was begun, even if tracing stopped in between
+			if (m_On)
+				Trace::record(m_Name, 'E');
+		}
+};
+
+#endif